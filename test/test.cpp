@@ -6,6 +6,7 @@
 #include <numeric>
 #include <utility>
 #include <stdexcept>
+#include <cstring>
 
 #include "gtest/gtest.h"
 #include "Mrpt.h"
@@ -87,8 +88,7 @@ class MrptTest : public testing::Test {
   * @return index of index:th data point in leaf:th leaf of tree:th tree
   */
   int getLeafPoint(const Mrpt &mrpt, int tree, int leaf, int index) {
-    const std::vector<int> &leaf_first_indices = mrpt.leaf_first_indices_all[mrpt.depth];
-    int leaf_begin = leaf_first_indices[leaf];
+    int leaf_begin = mrpt.leaf_first_index(tree, leaf, mrpt.depth);
     return mrpt.tree_leaves[tree][leaf_begin + index];
   }
 
@@ -99,8 +99,7 @@ class MrptTest : public testing::Test {
   * @return - number of data points in leaf:th leaf of tree:th tree
   */
   int getLeafSize(const Mrpt &mrpt, int tree, int leaf) const {
-    const std::vector<int> &leaf_first_indices = mrpt.leaf_first_indices_all[mrpt.depth];
-    return leaf_first_indices[leaf + 1] - leaf_first_indices[leaf];
+    return mrpt.leaf_first_index(tree, leaf + 1, mrpt.depth) - mrpt.leaf_first_index(tree, leaf, mrpt.depth);
   }
 
 
@@ -291,19 +290,167 @@ class MrptTest : public testing::Test {
       expect_equal(*it, *it2);
   }
 
-  void saveTester(int n_trees, int depth, float density, int seed_mrpt) {
+  void saveTester(int n_trees, int depth, float density, int seed_mrpt, bool seed_only = false,
+      Mrpt::ptype projection = Mrpt::gaussian_projection, int pool_size = 0) {
     Mrpt mrpt(M2);
-    mrpt.grow(n_trees, depth, density, seed_mrpt);
-    mrpt.save("save/mrpt_saved");
+    mrpt.grow(n_trees, depth, density, seed_mrpt, 0, projection, pool_size);
+    mrpt.save("save/mrpt_saved", seed_only);
 
     Mrpt mrpt_reloaded(M2);
     mrpt_reloaded.load("save/mrpt_saved");
 
     splitPointsEqual(mrpt, mrpt_reloaded);
     leavesEqual(mrpt, mrpt_reloaded);
+    randomMatricesEqual(mrpt, mrpt_reloaded);
     normalQueryEquals(mrpt, mrpt_reloaded, 5, 1);
   }
 
+  // Test that the index is not loaded if the random matrix regenerated from
+  // the seed is not the one the trees were grown with
+  void seedChecksumTester(int n_trees, int depth, float density) {
+    Mrpt mrpt(M2);
+    mrpt.grow(n_trees, depth, density, seed_mrpt);
+    ++mrpt.random_seed;
+    ASSERT_TRUE(mrpt.save("save/mrpt_saved", true));
+
+    Mrpt mrpt_reloaded(M2);
+    EXPECT_FALSE(mrpt_reloaded.load("save/mrpt_saved"));
+    EXPECT_TRUE(mrpt_reloaded.empty());
+  }
+
+  void saveLegacyParameters(const Mrpt_Parameters &p, FILE *fd) {
+    fwrite(&p.n_trees, sizeof(int), 1, fd);
+    fwrite(&p.depth, sizeof(int), 1, fd);
+    fwrite(&p.votes, sizeof(int), 1, fd);
+    fwrite(&p.k, sizeof(int), 1, fd);
+    fwrite(&p.estimated_qtime, sizeof(double), 1, fd);
+    fwrite(&p.estimated_recall, sizeof(double), 1, fd);
+  }
+
+  // Writes the index in the format of the index files without a format version
+  void saveLegacy(const Mrpt &mrpt, const char *path) {
+    FILE *fd = fopen(path, "wb");
+    int index_type = mrpt.index_type == Mrpt::autotuned_unpruned ? 2 : 0;
+    fwrite(&index_type, sizeof(int), 1, fd);
+    if(index_type == 2) {
+      int par_sz = mrpt.opt_pars.size();
+      fwrite(&par_sz, sizeof(int), 1, fd);
+      for(const auto &p : mrpt.opt_pars)
+        saveLegacyParameters(p, fd);
+    }
+    saveLegacyParameters(mrpt.par, fd);
+    fwrite(&mrpt.n_trees, sizeof(int), 1, fd);
+    fwrite(&mrpt.depth, sizeof(int), 1, fd);
+    fwrite(&mrpt.density, sizeof(float), 1, fd);
+    fwrite(mrpt.split_points.data(), sizeof(float), mrpt.n_array * mrpt.n_trees, fd);
+    for(int i = 0; i < mrpt.n_trees; ++i) {
+      int sz = mrpt.tree_leaves[i].size();
+      fwrite(&sz, sizeof(int), 1, fd);
+      fwrite(&mrpt.tree_leaves[i][0], sizeof(int), sz, fd);
+    }
+    if(mrpt.density < 1) {
+      int non_zeros = mrpt.sparse_random_matrix.nonZeros();
+      fwrite(&non_zeros, sizeof(int), 1, fd);
+      for(int k = 0; k < mrpt.sparse_random_matrix.outerSize(); ++k) {
+        for(SparseMatrix<float, RowMajor>::InnerIterator it(mrpt.sparse_random_matrix, k); it; ++it) {
+          float val = it.value();
+          int row = it.row(), col = it.col();
+          fwrite(&row, sizeof(int), 1, fd);
+          fwrite(&col, sizeof(int), 1, fd);
+          fwrite(&val, sizeof(float), 1, fd);
+        }
+      }
+    } else {
+      fwrite(mrpt.dense_random_matrix.data(), sizeof(float), mrpt.n_pool * d, fd);
+    }
+    fclose(fd);
+  }
+
+  void legacyLoadTester(int n_trees, int depth, float density) {
+    Mrpt mrpt(M2);
+    mrpt.generator = Mrpt::legacy;
+    mrpt.grow(n_trees, depth, density, seed_mrpt);
+    saveLegacy(mrpt, "save/mrpt_legacy");
+
+    Mrpt mrpt_reloaded(M2);
+    ASSERT_TRUE(mrpt_reloaded.load("save/mrpt_legacy"));
+
+    splitPointsEqual(mrpt, mrpt_reloaded);
+    leavesEqual(mrpt, mrpt_reloaded);
+    randomMatricesEqual(mrpt, mrpt_reloaded);
+    normalQueryEquals(mrpt, mrpt_reloaded, 5, 1);
+  }
+
+  void legacyAutotunedLoadTester(int k, int trees_max, int depth_max, int depth_min,
+      int votes_max, float density) {
+    Mrpt mrpt(M2);
+    mrpt.generator = Mrpt::legacy;
+    mrpt.grow(test_queries, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    saveLegacy(mrpt, "save/mrpt_legacy");
+
+    Mrpt mrpt_reloaded(M2);
+    ASSERT_TRUE(mrpt_reloaded.load("save/mrpt_legacy"));
+    ASSERT_EQ(mrpt_reloaded.index_type, Mrpt::autotuned_unpruned);
+
+    std::vector<Mrpt_Parameters> pars = mrpt.optimal_parameters();
+    std::vector<Mrpt_Parameters> pars_reloaded = mrpt_reloaded.optimal_parameters();
+    ASSERT_EQ(pars.size(), pars_reloaded.size());
+    for(int i = 0; i < pars.size(); ++i) {
+      EXPECT_EQ(pars[i].n_trees, pars_reloaded[i].n_trees);
+      EXPECT_EQ(pars[i].depth, pars_reloaded[i].depth);
+      EXPECT_EQ(pars[i].votes, pars_reloaded[i].votes);
+      EXPECT_EQ(pars[i].estimated_recall, pars_reloaded[i].estimated_recall);
+    }
+
+    splitPointsEqual(mrpt, mrpt_reloaded);
+    leavesEqual(mrpt, mrpt_reloaded);
+    autotuningQueryEquals(mrpt, mrpt_reloaded, 0.4);
+  }
+
+  // Tests that the index file of mrpt with its n_removed last bytes removed
+  // (half of it, if n_removed is 0) is not loaded, and that an autotuned
+  // index loaded before is left empty and not autotuned
+  void truncatedLoadTester(const Mrpt &mrpt, int n_removed) {
+    ASSERT_TRUE(mrpt.save("save/mrpt_saved"));
+    std::vector<char> bytes(1 << 22);
+    FILE *fd = fopen("save/mrpt_saved", "rb");
+    size_t n_bytes = fread(bytes.data(), 1, bytes.size(), fd);
+    fclose(fd);
+    ASSERT_LT(n_bytes, bytes.size());
+    fd = fopen("save/mrpt_truncated", "wb");
+    fwrite(bytes.data(), 1, n_removed ? n_bytes - n_removed : n_bytes / 2, fd);
+    fclose(fd);
+
+    Mrpt mrpt_autotuned(M2);
+    mrpt_autotuned.grow(test_queries, 5, 5, 6, 4, 5, 1.0 / std::sqrt(d), seed_mrpt);
+    ASSERT_TRUE(mrpt_autotuned.save("save/mrpt_autotuned"));
+
+    Mrpt mrpt_reloaded(M2);
+    ASSERT_TRUE(mrpt_reloaded.load("save/mrpt_autotuned"));
+    EXPECT_FALSE(mrpt_reloaded.load("save/mrpt_truncated"));
+    EXPECT_TRUE(mrpt_reloaded.empty());
+    EXPECT_EQ(mrpt_reloaded.index_type, Mrpt::normal);
+    EXPECT_EQ(mrpt_reloaded.par.k, 0);
+    EXPECT_TRUE(mrpt_reloaded.opt_pars.empty());
+  }
+
+  void randomMatricesEqual(const Mrpt &mrpt1, const Mrpt &mrpt2) {
+    ASSERT_EQ(mrpt1.projection, mrpt2.projection);
+    ASSERT_EQ(mrpt1.pool_size, mrpt2.pool_size);
+    EXPECT_EQ(mrpt1.pool_directions, mrpt2.pool_directions);
+    if(mrpt1.projection == Mrpt::hadamard_projection) {
+      EXPECT_EQ(mrpt1.hadamard_transform.signs, mrpt2.hadamard_transform.signs);
+      EXPECT_EQ(mrpt1.hadamard_transform.rows, mrpt2.hadamard_transform.rows);
+    } else if(mrpt1.projection == Mrpt::sign_projection) {
+      EXPECT_EQ(mrpt1.sign_random_matrix.outer, mrpt2.sign_random_matrix.outer);
+      EXPECT_EQ(mrpt1.sign_random_matrix.inner, mrpt2.sign_random_matrix.inner);
+    } else if(mrpt1.density < 1) {
+      EXPECT_EQ(MatrixXf(mrpt1.sparse_random_matrix), MatrixXf(mrpt2.sparse_random_matrix));
+    } else {
+      EXPECT_EQ(mrpt1.dense_random_matrix, mrpt2.dense_random_matrix);
+    }
+  }
+
   void saveTesterAutotuning(int k, int trees_max, int depth_max, int depth_min,
       int votes_max, float density, int seed_mrpt) {
     Mrpt mrpt(M2);
@@ -321,16 +468,19 @@ class MrptTest : public testing::Test {
   }
 
   void saveTesterAutotuningTargetRecall(double target_recall, int k, int trees_max,
-      int depth_max, int depth_min, int votes_max, float density, int seed_mrpt) {
+      int depth_max, int depth_min, int votes_max, float density, int seed_mrpt,
+      bool seed_only = false, Mrpt::ptype projection = Mrpt::gaussian_projection, int pool_size = 0) {
     Mrpt mrpt(M2);
-    mrpt.grow(target_recall, test_queries, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
-    mrpt.save("save/mrpt_saved");
+    mrpt.grow(target_recall, test_queries, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt,
+              projection, pool_size);
+    mrpt.save("save/mrpt_saved", seed_only);
 
     Mrpt mrpt_reloaded(M2);
     mrpt_reloaded.load("save/mrpt_saved");
 
     splitPointsEqual(mrpt, mrpt_reloaded);
     leavesEqual(mrpt, mrpt_reloaded);
+    randomMatricesEqual(mrpt, mrpt_reloaded);
     normalQueryEquals(mrpt, mrpt_reloaded, 5, 1);
     autotuningQueryEquals(mrpt, mrpt_reloaded);
     expect_equal(mrpt.parameters(), mrpt_reloaded.parameters());
@@ -338,6 +488,1014 @@ class MrptTest : public testing::Test {
 
 
 
+  void sampledSplitsTester(int n_trees, int depth, float density, int sample_size,
+      Mrpt::ptype projection = Mrpt::gaussian_projection) {
+    Mrpt mrpt(M);
+    mrpt.grow(n_trees, depth, density, seed_mrpt, sample_size, projection);
+
+    int n_leaf = 1 << depth;
+    for(int tree = 0; tree < n_trees; ++tree) {
+      MatrixXf projected(depth, n);
+      if(projection == Mrpt::sign_projection)
+        for(int i = 0; i < n; ++i)
+          mrpt.sign_random_matrix.multiply(M.col(i).data(), projected.col(i).data(), tree * depth, depth);
+      else if(projection == Mrpt::hadamard_projection)
+        projected.noalias() = mrpt.hadamard_transform.dense_rows(tree * depth, depth) * M;
+      else if(!mrpt.sell_random_matrix.empty())
+        for(int i = 0; i < n; ++i)
+          mrpt.sell_random_matrix.multiply(M.col(i).data(), projected.col(i).data(), tree * depth, depth);
+      else if(mrpt.density < 1)
+        projected.noalias() = mrpt.sparse_random_matrix.middleRows(tree * depth, depth) * M;
+      else
+        projected.noalias() = mrpt.dense_random_matrix.middleRows(tree * depth, depth) * M;
+
+      VectorXi leaves = VectorXi::Zero(n);
+      for(int j = 0; j < n_leaf; ++j) {
+        for(int i = 0; i < getLeafSize(mrpt, tree, j); ++i) {
+          int idx = getLeafPoint(mrpt, tree, j, i);
+
+          // Test that each point is routed into the leaf given by the split points
+          int idx_tree = 0;
+          for(int level = 0; level < depth; ++level)
+            idx_tree = projected(level, idx) <= getSplitPoint(mrpt, tree, idx_tree) ? 2 * idx_tree + 1 : 2 * idx_tree + 2;
+          ASSERT_EQ(idx_tree - n_leaf + 1, j);
+
+          leaves(idx)++;
+        }
+      }
+
+      // Test that all data points are found exactly once at a tree
+      EXPECT_EQ(leaves, VectorXi::Ones(n));
+    }
+
+    mrpt.save("save/mrpt_saved");
+    Mrpt mrpt_reloaded(M);
+    mrpt_reloaded.load("save/mrpt_saved");
+
+    splitPointsEqual(mrpt, mrpt_reloaded);
+    leavesEqual(mrpt, mrpt_reloaded);
+  }
+
+  void randomMatrixTester(int n_row, int n_col, float density) {
+    SparseMatrix<float, RowMajor> sparse1, sparse2;
+    Matrix<float, Dynamic, Dynamic, RowMajor> dense1, dense2;
+
+    omp_set_num_threads(1);
+    Mrpt::build_sparse_random_matrix(sparse1, n_row, n_col, density, seed_mrpt);
+    Mrpt::build_dense_random_matrix(dense1, n_row, n_col, seed_mrpt);
+    omp_set_num_threads(4);
+    Mrpt::build_sparse_random_matrix(sparse2, n_row, n_col, density, seed_mrpt);
+    Mrpt::build_dense_random_matrix(dense2, n_row, n_col, seed_mrpt);
+    omp_set_num_threads(1);
+
+    EXPECT_EQ(MatrixXf(sparse1), MatrixXf(sparse2));
+    EXPECT_EQ(dense1, dense2);
+
+    // Test that the proportion of non-zeros and the moments of the non-zeros are as expected
+    double n_nonzero = sparse1.nonZeros(), n_total = static_cast<double>(n_row) * n_col;
+    EXPECT_NEAR(n_nonzero / n_total, density, 4 * std::sqrt(density * (1 - density) / n_total));
+    EXPECT_NEAR(sparse1.sum() / n_nonzero, 0.0, 4 / std::sqrt(n_nonzero));
+    EXPECT_NEAR(sparse1.squaredNorm() / n_nonzero, 1.0, 6 / std::sqrt(n_nonzero));
+    EXPECT_NEAR(dense1.mean(), 0.0, 4 / std::sqrt(n_total));
+  }
+
+  void signMatrixTester(int n_row, int n_col, float density) {
+    Mrpt::Sign_Matrix sign1, sign2;
+
+    omp_set_num_threads(1);
+    Mrpt::build_sign_random_matrix(sign1, n_row, n_col, density, seed_mrpt);
+    omp_set_num_threads(4);
+    Mrpt::build_sign_random_matrix(sign2, n_row, n_col, density, seed_mrpt);
+    omp_set_num_threads(1);
+
+    EXPECT_EQ(sign1.outer, sign2.outer);
+    EXPECT_EQ(sign1.inner, sign2.inner);
+
+    // Test that the products agree with the products of the equivalent dense matrix
+    MatrixXf dense = MatrixXf::Zero(n_row, n_col);
+    for(int j = 0; j < n_row; ++j)
+      for(int l = sign1.outer[j]; l < sign1.outer[j + 1]; ++l)
+        dense(j, sign1.inner[l] & 0x7fffffff) = sign1.inner[l] >> 31 ? -1 : 1;
+
+    VectorXf x = VectorXf::Random(n_col), projected(n_row);
+    sign1.multiply(x.data(), projected.data(), 0, n_row);
+    VectorXf expected = dense * x;
+    for(int j = 0; j < n_row; ++j)
+      EXPECT_NEAR(projected(j), expected(j), 1e-4);
+
+    // Test that the proportion of non-zeros and the sum of the components are as expected
+    double n_nonzero = sign1.nonZeros(), n_total = static_cast<double>(n_row) * n_col;
+    EXPECT_NEAR(n_nonzero / n_total, density, 4 * std::sqrt(density * (1 - density) / n_total));
+    EXPECT_NEAR(dense.sum() / n_nonzero, 0.0, 4 / std::sqrt(n_nonzero));
+  }
+
+  void sellTester(int n_row, int n_col, float density) {
+    SparseMatrix<float, RowMajor> sparse;
+    Mrpt::build_sparse_random_matrix(sparse, n_row, n_col, density, seed_mrpt);
+    Mrpt::Sell_Matrix sell(sparse);
+
+    // Test that the products of all the rows and of blocks of rows agree with Eigen
+    VectorXf x = VectorXf::Random(n_col), projected(n_row);
+    VectorXf expected = sparse * x;
+    sell.multiply(x.data(), projected.data(), 0, n_row);
+    for(int j = 0; j < n_row; ++j)
+      EXPECT_NEAR(projected(j), expected(j), 1e-4);
+
+    for(int row_begin = 0; row_begin < n_row; row_begin += 5) {
+      int n_rows = std::min(5, n_row - row_begin);
+      VectorXf block(n_rows);
+      sell.multiply(x.data(), block.data(), row_begin, n_rows);
+      for(int j = 0; j < n_rows; ++j)
+        EXPECT_NEAR(block(j), expected(row_begin + j), 1e-4);
+    }
+  }
+
+  void fixedDimTester(int dim, bool fixed) {
+    int n_rows = 10;
+    MatrixXf data = MatrixXf::Random(dim, n);
+    Matrix<float, Dynamic, Dynamic, RowMajor> m = Matrix<float, Dynamic, Dynamic, RowMajor>::Random(n_rows, dim);
+    VectorXf x = VectorXf::Random(dim);
+
+    // Test that the specialized kernels agree with Eigen
+    bool called = Mrpt::with_fixed_dim(dim, [&](auto kernels) {
+      for(int i = 0; i < n; ++i)
+        ASSERT_NEAR(kernels.squared_distance(x.data(), data.col(i).data()), (data.col(i) - x).squaredNorm(), 1e-3);
+
+      VectorXf projected(n_rows), expected = m * x;
+      kernels.multiply(m.data(), x.data(), projected.data(), n_rows);
+      for(int j = 0; j < n_rows; ++j)
+        EXPECT_NEAR(projected(j), expected(j), 1e-3);
+    });
+    EXPECT_EQ(called, fixed);
+
+    // Test that the exact search gives the same neighbors as the search by Eigen
+    int k = 10;
+    std::vector<int> result(k), result_index(k);
+    Mrpt::exact_knn(x, data, k, &result[0]);
+    Mrpt mrpt(data);
+    mrpt.exact_knn(x, k, &result_index[0]);
+
+    VectorXf distances = (data.colwise() - x).colwise().squaredNorm(), sorted = distances;
+    std::sort(sorted.data(), sorted.data() + n);
+    for(int i = 0; i < k; ++i) {
+      EXPECT_EQ(result[i], result_index[i]);
+      EXPECT_NEAR(distances(result[i]), sorted(i), 1e-3);
+    }
+  }
+
+  void groundTruthTester(int k, int n_threads) {
+    // Test that the blocked ground truth agrees with the exact search of each query
+    Mrpt mrpt(M);
+    mrpt.k = k;
+    MatrixXi exact(k, n_test);
+    omp_set_num_threads(n_threads);
+    mrpt.compute_exact(Map<const MatrixXf>(Q.data(), d, n_test), exact);
+    omp_set_num_threads(1);
+
+    std::vector<int> result(k);
+    for(int i = 0; i < n_test; ++i) {
+      mrpt.exact_knn(Q.col(i), k, &result[0]);
+      std::sort(result.begin(), result.end());
+      for(int j = 0; j < k; ++j)
+        ASSERT_EQ(exact(j, i), result[j]);
+    }
+
+    // Test that the test points sampled from the data are not their own neighbors
+    std::vector<int> indices_test = {0, 5, 17, n - 1};
+    MatrixXf T(d, indices_test.size());
+    for(int i = 0; i < static_cast<int>(indices_test.size()); ++i)
+      T.col(i) = X.col(indices_test[i]);
+    MatrixXi exact_sampled(k, indices_test.size());
+    omp_set_num_threads(n_threads);
+    mrpt.compute_exact(Map<const MatrixXf>(T.data(), d, T.cols()), exact_sampled, indices_test);
+    omp_set_num_threads(1);
+
+    std::vector<int> all(k + 1);
+    for(int i = 0; i < static_cast<int>(indices_test.size()); ++i) {
+      mrpt.exact_knn(T.col(i), k + 1, &all[0]);
+      EXPECT_EQ(all[0], indices_test[i]);
+      std::sort(all.begin() + 1, all.end());
+      for(int j = 0; j < k; ++j)
+        ASSERT_EQ(exact_sampled(j, i), all[j + 1]);
+    }
+  }
+
+  void costModelTester(int trees_max, int depth_max, Mrpt::ptype projection) {
+    int k = 5, depth_min = depth_max - 2, votes_max = trees_max / 2;
+    float density = 1.0 / std::sqrt(d);
+    Mrpt mrpt(M);
+    mrpt.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, {}, projection);
+
+    Mrpt_Cost_Model model = mrpt.cost_model();
+    ASSERT_TRUE(model.save("save/cost_model"));
+    Mrpt_Cost_Model model_reloaded;
+    ASSERT_TRUE(model_reloaded.load("save/cost_model"));
+
+    EXPECT_EQ(model_reloaded.dim, d);
+    EXPECT_FLOAT_EQ(model_reloaded.density, density);
+    EXPECT_EQ(model_reloaded.projection, projection);
+    EXPECT_EQ(model_reloaded.depth_min, depth_min);
+    EXPECT_EQ(model_reloaded.depth_max(), depth_max);
+    EXPECT_EQ(model_reloaded.cpu, Mrpt_Cost_Model::cpu_id());
+    EXPECT_EQ(model_reloaded.projection_beta, model.projection_beta);
+    EXPECT_EQ(model_reloaded.exact_beta, model.exact_beta);
+    EXPECT_EQ(model_reloaded.voting_betas, model.voting_betas);
+
+    // Test that an index autotuned with the cost model has the same
+    // estimated query times and the same optimal parameters as the index
+    // whose times were measured
+    Mrpt::Autotuning options;
+    options.cost_model = model_reloaded;
+    Mrpt mrpt2(M);
+    mrpt2.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, {},
+               projection, 0, options);
+    std::vector<Mrpt_Parameters> pars = mrpt.optimal_parameters(), pars2 = mrpt2.optimal_parameters();
+    ASSERT_EQ(pars.size(), pars2.size());
+    for(size_t i = 0; i < pars.size(); ++i) {
+      EXPECT_EQ(pars[i].n_trees, pars2[i].n_trees);
+      EXPECT_EQ(pars[i].depth, pars2[i].depth);
+      EXPECT_EQ(pars[i].votes, pars2[i].votes);
+      EXPECT_DOUBLE_EQ(pars[i].estimated_qtime, pars2[i].estimated_qtime);
+      EXPECT_DOUBLE_EQ(pars[i].estimated_recall, pars2[i].estimated_recall);
+    }
+
+    // Test that a model can be used for a narrower range of depths
+    Mrpt mrpt3(M);
+    mrpt3.grow(Q.data(), n_test, k, trees_max, depth_max - 1, depth_min + 1, votes_max, density, seed_mrpt, {},
+               projection, 0, options);
+    EXPECT_EQ(mrpt3.cost_model().voting_betas.size(), 1);
+    EXPECT_EQ(mrpt3.cost_model().voting_betas[0], model.voting_betas[1]);
+
+    // Test that a model of another kind of data set or of another CPU is rejected
+    Mrpt mrpt4(M);
+    EXPECT_THROW(mrpt4.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density / 2,
+                            seed_mrpt, {}, projection, 0, options), std::invalid_argument);
+    EXPECT_THROW(mrpt4.grow(Q.data(), n_test, k, trees_max, depth_max + 1, depth_min, votes_max, density,
+                            seed_mrpt, {}, projection, 0, options), std::out_of_range);
+    options.cost_model.cpu += "x";
+    EXPECT_THROW(mrpt4.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density,
+                            seed_mrpt, {}, projection, 0, options), std::invalid_argument);
+    EXPECT_THROW(mrpt4.cost_model(), std::logic_error);
+
+    corruptedModelTester(model);
+  }
+
+  // Tests that the file of the cost model is not loaded if it is truncated,
+  // if its magic number or format version is unknown, or if the length of
+  // the CPU identifier or the number of vote thresholds of a depth is out
+  // of range
+  void corruptedModelTester(const Mrpt_Cost_Model &model) {
+    ASSERT_TRUE(model.save("save/cost_model"));
+    std::vector<char> bytes(1 << 16);
+    FILE *fd = fopen("save/cost_model", "rb");
+    size_t n_bytes = fread(bytes.data(), 1, bytes.size(), fd);
+    fclose(fd);
+    ASSERT_LT(n_bytes, bytes.size());
+    bytes.resize(n_bytes);
+
+    const int cpu_length = model.cpu.size(), n_betas_offset = 9 * sizeof(int) + cpu_length + 4 * sizeof(double);
+    std::vector<std::pair<int,int>> corruptions = {{0, 0}, {sizeof(int), 2}, {6 * sizeof(int), 257},
+                                                    {6 * sizeof(int), -1}, {n_betas_offset, -1}};
+    for(int i = -1; i < static_cast<int>(corruptions.size()); ++i) {
+      std::vector<char> corrupted(bytes);
+      if(i < 0)
+        corrupted.resize(n_bytes / 2);
+      else
+        memcpy(&corrupted[corruptions[i].first], &corruptions[i].second, sizeof(int));
+      fd = fopen("save/cost_model_corrupted", "wb");
+      fwrite(corrupted.data(), 1, corrupted.size(), fd);
+      fclose(fd);
+
+      Mrpt_Cost_Model model_reloaded;
+      EXPECT_FALSE(model_reloaded.load("save/cost_model_corrupted"));
+      EXPECT_TRUE(model_reloaded.empty());
+    }
+
+    // Test that a CPU identifier longer than 256 characters is not saved
+    Mrpt_Cost_Model model2 = model;
+    model2.cpu.assign(257, 'x');
+    EXPECT_FALSE(model2.save("save/cost_model_corrupted"));
+  }
+
+  int64_t indexBytes(const Mrpt &mrpt) {
+    int64_t bytes = mrpt.split_points.size() * sizeof(float) + mrpt.pool_directions.size() * sizeof(int);
+    for(const auto &leaves : mrpt.tree_leaves)
+      bytes += leaves.size() * sizeof(int);
+    bytes += mrpt.dense_random_matrix.size() * sizeof(float);
+    if(mrpt.sparse_random_matrix.rows())
+      bytes += mrpt.sparse_random_matrix.nonZeros() * (sizeof(float) + sizeof(int)) +
+               (mrpt.sparse_random_matrix.rows() + 1) * sizeof(int);
+    bytes += mrpt.sell_random_matrix.columns.size() * sizeof(uint16_t) +
+             mrpt.sell_random_matrix.values.size() * sizeof(float);
+    if(!mrpt.sign_random_matrix.inner.empty())
+      bytes += mrpt.sign_random_matrix.inner.size() * sizeof(uint32_t) +
+               mrpt.sign_random_matrix.outer.size() * sizeof(int);
+    return bytes;
+  }
+
+  void memoryBudgetTester(int trees_max, int depth_max, float density, Mrpt::ptype projection, double tolerance) {
+    int k = 5, depth_min = depth_max - 2, votes_max = trees_max / 2;
+    Mrpt mrpt(M);
+    mrpt.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, {}, projection);
+
+    std::vector<Mrpt_Parameters> pars = mrpt.optimal_parameters_memory();
+    for(const Mrpt_Parameters &par : pars) {
+      // Test that no parameters on the frontier are dominated by others
+      for(const Mrpt_Parameters &other : pars)
+        EXPECT_FALSE(other.estimated_qtime < par.estimated_qtime && other.estimated_recall >= par.estimated_recall &&
+                     other.estimated_bytes <= par.estimated_bytes);
+
+      // Test that the fastest index fitting in the memory of the parameters is
+      // the index of the parameters, and that its memory is estimated correctly
+      Mrpt mrpt2 = mrpt.subset(par.estimated_recall, par.estimated_bytes);
+      EXPECT_EQ(mrpt2.parameters().n_trees, par.n_trees);
+      EXPECT_EQ(mrpt2.parameters().depth, par.depth);
+      EXPECT_EQ(mrpt2.parameters().votes, par.votes);
+      EXPECT_NEAR(indexBytes(mrpt2), par.estimated_bytes, tolerance * par.estimated_bytes);
+    }
+
+    // Test that the frontier over the query times and the recalls is a subset
+    // of the frontier including the memory
+    for(const Mrpt_Parameters &par : mrpt.optimal_parameters())
+      EXPECT_TRUE(std::any_of(pars.begin(), pars.end(), [&par](const Mrpt_Parameters &p) {
+        return p.n_trees == par.n_trees && p.depth == par.depth && p.votes == par.votes;
+      }));
+
+    // Test that an index autotuned to a memory budget fits in it
+    int64_t budget = pars[pars.size() / 2].estimated_bytes;
+    Mrpt::Autotuning options;
+    options.memory_budget = budget;
+    Mrpt mrpt3(M);
+    mrpt3.grow(1.0, Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, {},
+               projection, 0, options);
+    EXPECT_LE(mrpt3.parameters().estimated_bytes, budget);
+    EXPECT_GT(mrpt3.parameters().n_trees, 0);
+
+    options.memory_budget = 100;
+    Mrpt mrpt4(M);
+    EXPECT_THROW(mrpt4.grow(1.0, Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt,
+                            {}, projection, 0, options), std::out_of_range);
+    EXPECT_THROW(mrpt.subset(1.0, 100), std::out_of_range);
+  }
+
+  void throughputTester(int trees_max, int depth_max, int load_threads) {
+    int k = 5, depth_min = depth_max - 2, votes_max = trees_max / 2;
+    float density = 1.0 / std::sqrt(d);
+    Mrpt::Autotuning options;
+    options.load_threads = load_threads;
+    omp_set_num_threads(4);
+    Mrpt mrpt(M);
+    mrpt.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, {},
+              Mrpt::gaussian_projection, 0, options);
+    omp_set_num_threads(1);
+
+    // Test that the throughput of the chosen number of threads is reported
+    std::vector<Mrpt_Parameters> pars = mrpt.optimal_parameters();
+    int n_threads = pars[0].n_threads;
+    if(load_threads == -1) {
+      EXPECT_TRUE(n_threads == 1 || n_threads == 2 || n_threads == 4);
+    } else {
+      EXPECT_EQ(n_threads, load_threads);
+    }
+    for(const Mrpt_Parameters &par : pars) {
+      EXPECT_EQ(par.n_threads, n_threads);
+      EXPECT_DOUBLE_EQ(par.estimated_qps, n_threads / par.estimated_qtime);
+    }
+
+    // Test that the cost model is fitted for the number of threads, and that
+    // a model of another number of threads is rejected
+    Mrpt_Cost_Model model = mrpt.cost_model();
+    EXPECT_EQ(model.n_threads, n_threads);
+    options.cost_model = model;
+    options.load_threads = -1;
+    Mrpt mrpt2(M);
+    mrpt2.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, {},
+               Mrpt::gaussian_projection, 0, options);
+    EXPECT_EQ(mrpt2.optimal_parameters()[0].n_threads, n_threads);
+
+    options.load_threads = n_threads + 1;
+    Mrpt mrpt3(M);
+    EXPECT_THROW(mrpt3.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, {},
+                            Mrpt::gaussian_projection, 0, options), std::invalid_argument);
+  }
+
+  void densityTuningTester(int trees_max, int depth_max, double target_recall, Mrpt::ptype projection) {
+    int k = 5, depth_min = depth_max - 2, votes_max = trees_max / 2;
+    Mrpt mrpt(M);
+    mrpt.grow(target_recall, Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, 0, seed_mrpt, {},
+              projection);
+
+    // Test that the density is chosen from the grid, and that the chosen
+    // index reaches the target recall
+    std::vector<float> densities = mrpt.density_grid();
+    EXPECT_EQ(densities.back(), 1.0f);
+    EXPECT_TRUE(std::find(densities.begin(), densities.end(), mrpt.density) != densities.end());
+    EXPECT_EQ(mrpt.cost_model().density, mrpt.density);
+    EXPECT_GE(mrpt.parameters().estimated_recall, target_recall - 0.0001);
+
+    // Test that an index grown without the target recall reaches the recalls
+    // of the index grown with the chosen density and the same times
+    Mrpt::Autotuning options;
+    options.cost_model = mrpt.cost_model();
+    Mrpt mrpt2(M);
+    mrpt2.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, mrpt.density, seed_mrpt, {},
+               projection, 0, options);
+    Mrpt_Parameters par = mrpt2.subset(target_recall).parameters();
+    EXPECT_EQ(par.n_trees, mrpt.parameters().n_trees);
+    EXPECT_EQ(par.depth, mrpt.parameters().depth);
+    EXPECT_EQ(par.votes, mrpt.parameters().votes);
+  }
+
+  void addTreesTester(int n_trees, int depth, Mrpt::ptype projection, int pool_size, double latency_quantile) {
+    int k = 5, votes_max = n_trees / 2;
+    float density = 1.0 / std::sqrt(d);
+    Map<const MatrixXf> T(Q.data(), d, n_test);
+
+    Mrpt mrpt(M), mrpt2(M);
+    for(Mrpt *index : {&mrpt, &mrpt2}) {
+      index->k = k;
+      index->ks = {k};
+      index->depth_min = depth - 2;
+      index->votes_max = votes_max;
+      index->latency_quantile = latency_quantile;
+    }
+    MatrixXi exact(k, n_test);
+    mrpt.compute_exact(T, exact);
+
+    mrpt.grow(2 * n_trees, depth, density, seed_mrpt, 0, projection, pool_size);
+    mrpt.count_votes(T, exact);
+    mrpt2.grow(n_trees, depth, density, seed_mrpt, 0, projection, pool_size);
+    mrpt2.count_votes(T, exact);
+    mrpt2.add_trees(n_trees);
+    mrpt2.count_votes(T, exact, n_trees - 1);
+
+    // Test that the trees added to an index are the trees of an index grown
+    // with all the trees at once
+    ASSERT_EQ(mrpt2.n_trees, 2 * n_trees);
+    EXPECT_EQ(mrpt2.tree_leaves, mrpt.tree_leaves);
+    for(int tree = 0; tree < 2 * n_trees; ++tree)
+      for(int i = 0; i < (1 << depth) - 1; ++i)
+        ASSERT_EQ(getSplitPoint(mrpt2, tree, i), getSplitPoint(mrpt, tree, i));
+
+    // Test that counting the votes of the added trees only gives the same
+    // estimates as counting the votes of all the trees
+    ASSERT_EQ(mrpt2.recalls.size(), 3);
+    ASSERT_EQ(mrpt2.cs_quantiles.size(), mrpt.cs_quantiles.size());
+    for(int i = 0; i < 3; ++i) {
+      EXPECT_EQ(mrpt2.recalls[i], mrpt.recalls[i]);
+      EXPECT_EQ(mrpt2.cs_sizes[i], mrpt.cs_sizes[i]);
+      if(latency_quantile > 0) {
+        EXPECT_EQ(mrpt2.cs_quantiles[i], mrpt.cs_quantiles[i]);
+      }
+    }
+  }
+
+  void treesLimitTester(int trees_max, int depth_max, double target_recall, int trees_limit) {
+    int k = 5, depth_min = depth_max - 2, votes_max = trees_max / 2;
+    float density = 1.0 / std::sqrt(d);
+    Mrpt mrpt(M);
+    mrpt.grow(target_recall, Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    EXPECT_LT(mrpt.parameters().estimated_recall, target_recall);
+
+    // Test that more trees are grown when the target recall is missed, and
+    // that the frontier is derived from the recalls of all the trees
+    Mrpt::Autotuning options;
+    options.trees_limit = trees_limit;
+    Mrpt mrpt2(M);
+    mrpt2.grow(target_recall, Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt,
+               {}, Mrpt::gaussian_projection, 0, options);
+    Mrpt_Parameters par = mrpt2.parameters();
+    EXPECT_GE(par.estimated_recall, target_recall - 0.0001);
+    EXPECT_GT(par.n_trees, trees_max);
+    EXPECT_LE(par.n_trees, trees_limit);
+    EXPECT_EQ(mrpt2.recalls[par.depth - depth_min](par.votes - 1, par.n_trees - 1), par.estimated_recall);
+  }
+
+  void validationTester(int trees_max, int depth_max, double target_recall, int n_validated,
+                        double latency_quantile) {
+    int k = 5, depth_min = depth_max - 2, votes_max = trees_max / 2;
+    float density = 1.0 / std::sqrt(d);
+    Mrpt::Autotuning options;
+    options.latency_quantile = latency_quantile;
+    options.n_validated = n_validated;
+    Mrpt mrpt(M);
+    mrpt.grow(target_recall, Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt,
+              {}, Mrpt::gaussian_projection, 0, options);
+    Mrpt_Parameters par = mrpt.parameters();
+
+    // Test that the parameters are chosen among the n_validated fastest
+    // parameters reaching the target recall
+    int rank = 0;
+    bool found = false;
+    for(const Mrpt_Parameters &p : mrpt.opt_pars) {
+      if(p.estimated_recall <= target_recall - 0.0001)
+        continue;
+      if(p.n_trees == par.n_trees && p.depth == par.depth && p.votes == par.votes) {
+        found = true;
+        break;
+      }
+      ++rank;
+    }
+    EXPECT_TRUE(found);
+    EXPECT_LT(rank, n_validated);
+
+    // Test that the recall measured on the test queries is the estimated recall
+    EXPECT_GT(par.measured_qtime, 0.0);
+    EXPECT_NEAR(par.measured_recall, par.estimated_recall, 0.01);
+
+    // Test that the measured query time and recall are saved and loaded
+    ASSERT_TRUE(mrpt.save("save/validated"));
+    Mrpt mrpt2(M);
+    ASSERT_TRUE(mrpt2.load("save/validated"));
+    EXPECT_EQ(mrpt2.parameters().measured_qtime, par.measured_qtime);
+    EXPECT_EQ(mrpt2.parameters().measured_recall, par.measured_recall);
+  }
+
+  void validationFallbackTester(int trees_max, int depth_max, int n_validated) {
+    int k = 5, depth_min = depth_max - 2, votes_max = trees_max / 2;
+    float density = 1.0 / std::sqrt(d);
+    Map<const MatrixXf> T(Q.data(), d, n_test);
+    Mrpt mrpt(M);
+    mrpt.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    MatrixXi exact(k, n_test);
+    mrpt.compute_exact(T, exact);
+
+    // Test that the parameters of the highest measured recall are chosen if
+    // none of the validated parameters reaches the target recall
+    double target_recall = 2.0;
+    std::vector<Mrpt_Parameters> opt_pars(mrpt.opt_pars.begin(), mrpt.opt_pars.end());
+    mrpt.opt_pars.clear();
+    for(Mrpt_Parameters &p : opt_pars) {
+      p.estimated_recall = target_recall;
+      mrpt.opt_pars.insert(p);
+    }
+    Mrpt_Parameters par = mrpt.validate(T, exact, target_recall, n_validated, {});
+
+    double recall_max = -1.0;
+    for(int i = 0; i < n_validated && i < static_cast<int>(opt_pars.size()); ++i) {
+      mrpt.opt_pars.clear();
+      mrpt.opt_pars.insert(opt_pars[i]);
+      recall_max = std::max(recall_max, mrpt.validate(T, exact, target_recall, 1, {}).measured_recall);
+    }
+    EXPECT_EQ(par.measured_recall, recall_max);
+  }
+
+  void testSetTester(int trees_max, int depth_max, int k) {
+    int depth_min = depth_max - 2, votes_max = trees_max / 2, n_depths = 3, n_test_initial = 20;
+    float density = 1.0 / std::sqrt(d);
+    Mrpt mrpt_initial(M), mrpt_all(M);
+    mrpt_initial.grow_autotune(k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, n_test_initial);
+    mrpt_all.grow_autotune(k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, n);
+
+    // Test that the test set grows to the whole data set if the tolerance
+    // is not reached before
+    Mrpt::Autotuning options;
+    options.recall_tolerance = 1e-9;
+    Mrpt mrpt(M);
+    mrpt.grow_autotune(k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, n_test_initial,
+                       Mrpt::gaussian_projection, 0, options);
+    for(int i = 0; i < n_depths; ++i)
+      EXPECT_EQ(mrpt.recalls[i], mrpt_all.recalls[i]);
+
+    // Test that no test queries are added after the time limit
+    options.test_time_limit = 1e-9;
+    Mrpt mrpt2(M);
+    mrpt2.grow_autotune(k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, n_test_initial,
+                        Mrpt::gaussian_projection, 0, options);
+    for(int i = 0; i < n_depths; ++i)
+      EXPECT_EQ(mrpt2.recalls[i], mrpt_initial.recalls[i]);
+
+    // Test that the test set does not grow if the tolerance is reached
+    options.recall_tolerance = 1.0;
+    options.test_time_limit = 0.0;
+    Mrpt mrpt3(M);
+    mrpt3.grow_autotune(k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, n_test_initial,
+                        Mrpt::gaussian_projection, 0, options);
+    for(int i = 0; i < n_depths; ++i)
+      EXPECT_EQ(mrpt3.recalls[i], mrpt_initial.recalls[i]);
+  }
+
+  void precomputedExactTester(int trees_max, int depth_max, int k) {
+    int depth_min = depth_max - 2, votes_max = trees_max / 2, n_depths = 3, n_rows = k + 5;
+    float density = 1.0 / std::sqrt(d);
+
+    MatrixXi exact(n_rows, n_test);
+    for(int i = 0; i < n_test; ++i) {
+      VectorXf distances = (X.colwise() - Q.col(i)).colwise().squaredNorm();
+      std::vector<int> idx(n);
+      std::iota(idx.begin(), idx.end(), 0);
+      std::partial_sort(idx.begin(), idx.begin() + n_rows, idx.end(),
+                        [&distances](int a, int b) { return distances(a) < distances(b); });
+      for(int j = 0; j < n_rows; ++j)
+        exact(j, i) = idx[j];
+    }
+
+    // Test that the recalls estimated using the given nearest neighbors are
+    // the recalls estimated using the exact search of the autotuning
+    Mrpt mrpt(M), mrpt_exact(M);
+    mrpt.grow(Q, exact, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    mrpt_exact.grow(Q, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    for(int i = 0; i < n_depths; ++i)
+      EXPECT_EQ(mrpt.recalls[i], mrpt_exact.recalls[i]);
+
+    Mrpt mrpt2(M);
+    mrpt2.grow(0.5, Q, exact, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    for(int i = 0; i < n_depths; ++i)
+      EXPECT_EQ(mrpt2.recalls[i], mrpt_exact.recalls[i]);
+    EXPECT_GE(mrpt2.parameters().estimated_recall, 0.5 - 0.0001);
+
+    std::vector<int> ks {1, k};
+    Mrpt mrpt3(M), mrpt3_exact(M);
+    mrpt3.grow(Q, exact, ks, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    mrpt3_exact.grow(Q, ks, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    ASSERT_EQ(mrpt3.recalls.size(), mrpt3_exact.recalls.size());
+    for(size_t i = 0; i < mrpt3.recalls.size(); ++i)
+      EXPECT_EQ(mrpt3.recalls[i], mrpt3_exact.recalls[i]);
+  }
+
+  void multiKTester(int trees_max, int depth_max, const std::vector<int> &ks) {
+    int depth_min = depth_max - 2, votes_max = trees_max / 2, n_depths = 3;
+    float density = 1.0 / std::sqrt(d);
+    Mrpt mrpt(M);
+    mrpt.grow(Q.data(), n_test, ks, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    ASSERT_TRUE(mrpt.save("save/multi_k"));
+    Mrpt mrpt_reloaded(M);
+    ASSERT_TRUE(mrpt_reloaded.load("save/multi_k"));
+
+    for(size_t j = 0; j < ks.size(); ++j) {
+      int k = ks[j];
+
+      // Test that the recalls of each k are the recalls of an index autotuned
+      // for that k only
+      Mrpt mrpt2(M);
+      mrpt2.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+      for(int i = 0; i < n_depths; ++i)
+        EXPECT_EQ(mrpt.recalls[j * n_depths + i], mrpt2.recalls[i]);
+
+      // Test that the frontier of each k is derived from its recalls, and
+      // that it is saved and loaded
+      std::vector<Mrpt_Parameters> pars = mrpt.optimal_parameters(k);
+      ASSERT_FALSE(pars.empty());
+      for(const Mrpt_Parameters &par : pars) {
+        EXPECT_EQ(par.k, k);
+        EXPECT_EQ(par.estimated_recall,
+                  mrpt.recalls[j * n_depths + par.depth - depth_min](par.votes - 1, par.n_trees - 1));
+      }
+      EXPECT_EQ(mrpt_reloaded.optimal_parameters(k).size(), pars.size());
+      EXPECT_EQ(mrpt_reloaded.optimal_parameters_memory(k).size(), mrpt.optimal_parameters_memory(k).size());
+
+      // Test that an index subsetted for each k searches for k neighbors
+      Mrpt mrpt3 = mrpt.subset(pars.back().estimated_recall, 0, k);
+      Mrpt_Parameters par = mrpt3.parameters();
+      EXPECT_EQ(par.k, k);
+      EXPECT_EQ(par.estimated_recall, pars.back().estimated_recall);
+      std::vector<int> result(k), result2(k);
+      mrpt3.query(Q.col(0), &result[0]);
+      mrpt3.query(Q.col(0), k, par.votes, &result2[0]);
+      EXPECT_EQ(result, result2);
+    }
+
+    EXPECT_EQ(mrpt.parameters().k, ks.back());
+    EXPECT_THROW(mrpt.subset(0.5, 0, ks.back() + 1), std::out_of_range);
+    EXPECT_THROW(mrpt.optimal_parameters(ks.back() + 1), std::out_of_range);
+  }
+
+  // The test queries are the first n_queries data points, if n_queries is
+  // given, so that the candidate set sizes of several blocks of them are counted
+  void latencyQuantileTester(int trees_max, int depth_max, double latency_quantile, int n_queries = 0) {
+    int k = 5, depth_min = depth_max - 2, votes_max = trees_max / 2;
+    const MatrixXf &queries = n_queries ? X : Q;
+    const int n_test = n_queries ? n_queries : this->n_test;
+    float density = 1.0 / std::sqrt(d);
+    Mrpt::Autotuning options;
+    options.latency_quantile = latency_quantile;
+    Mrpt mrpt(M);
+    mrpt.grow(queries.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, {},
+              Mrpt::gaussian_projection, 0, options);
+
+    // Test that the frontier is ordered by the estimated quantile of the
+    // query times, and that the quantiles of the candidate set sizes are
+    // the quantiles of the candidate set sizes of the test queries
+    std::vector<Mrpt_Parameters> pars = mrpt.optimal_parameters();
+    int rank = std::max(static_cast<int>(std::ceil(latency_quantile * n_test)) - 1, 0);
+    for(size_t i = 0; i < pars.size(); ++i) {
+      const Mrpt_Parameters &par = pars[i];
+      if(i > 0) {
+        EXPECT_LE(pars[i - 1].estimated_qtime_quantile, par.estimated_qtime_quantile);
+        EXPECT_LT(pars[i - 1].estimated_recall, par.estimated_recall);
+      }
+
+      std::vector<double> cs_sizes(n_test);
+      for(int j = 0; j < n_test; ++j) {
+        VectorXf projected(mrpt.n_pool);
+        mrpt.project(queries.col(j).data(), projected);
+        VectorXi elected;
+        int n_elected = 0;
+        mrpt.vote(projected, par.votes, elected, n_elected, par.n_trees, par.depth);
+        cs_sizes[j] = n_elected;
+      }
+      std::nth_element(cs_sizes.begin(), cs_sizes.begin() + rank, cs_sizes.end());
+      EXPECT_FLOAT_EQ(mrpt.cs_quantiles[par.depth - depth_min](par.votes - 1, par.n_trees - 1), cs_sizes[rank]);
+      EXPECT_FLOAT_EQ(par.estimated_qtime_quantile, mrpt.get_query_time_quantile(par.n_trees, par.depth, par.votes));
+      EXPECT_FLOAT_EQ(par.estimated_qtime, mrpt.get_query_time(par.n_trees, par.depth, par.votes));
+    }
+
+    // Test that the frontier and its ordering are saved with the index
+    mrpt.save("save/mrpt_saved");
+    Mrpt mrpt_reloaded(M);
+    mrpt_reloaded.load("save/mrpt_saved");
+    std::vector<Mrpt_Parameters> pars_reloaded = mrpt_reloaded.optimal_parameters();
+    ASSERT_EQ(pars.size(), pars_reloaded.size());
+    for(size_t i = 0; i < pars.size(); ++i) {
+      EXPECT_EQ(pars[i].n_trees, pars_reloaded[i].n_trees);
+      EXPECT_EQ(pars[i].votes, pars_reloaded[i].votes);
+      EXPECT_EQ(pars[i].estimated_qtime_quantile, pars_reloaded[i].estimated_qtime_quantile);
+    }
+
+    Mrpt_Parameters par = mrpt.subset(0.5).parameters(), par_reloaded = mrpt_reloaded.subset(0.5).parameters();
+    EXPECT_EQ(par.n_trees, par_reloaded.n_trees);
+    EXPECT_EQ(par.depth, par_reloaded.depth);
+    EXPECT_EQ(par.votes, par_reloaded.votes);
+  }
+
+  void voteCountTester(int trees_max, int depth_max, int votes_max, int n_threads) {
+    int k = 5, depth_min = depth_max - 2;
+    float density = 1.0 / std::sqrt(d);
+    Mrpt mrpt(M);
+    omp_set_num_threads(n_threads);
+    mrpt.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    omp_set_num_threads(1);
+
+    // Test that the estimated candidate set sizes are the averages of the
+    // candidate set sizes of the test queries
+    for(int depth = depth_min; depth <= depth_max; ++depth) {
+      for(int t : {1, trees_max / 2, trees_max}) {
+        for(int v = 1; v <= std::min(t, votes_max); ++v) {
+          double cs_size = 0;
+          for(int i = 0; i < n_test; ++i) {
+            VectorXf projected(mrpt.n_pool);
+            mrpt.project(Q.col(i).data(), projected);
+            VectorXi elected;
+            int n_elected = 0;
+            mrpt.vote(projected, v, elected, n_elected, t, depth);
+            cs_size += n_elected;
+          }
+          EXPECT_DOUBLE_EQ(mrpt.get_candidate_set_size(t, depth, v), cs_size / n_test);
+        }
+      }
+    }
+
+    // Test that the counts do not depend on the number of threads
+    Mrpt mrpt_serial(M);
+    mrpt_serial.grow(Q.data(), n_test, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt);
+    for(int depth = depth_min; depth <= depth_max; ++depth)
+      for(int t = 1; t <= trees_max; ++t)
+        for(int v = 1; v <= std::min(t, votes_max); ++v)
+          EXPECT_DOUBLE_EQ(mrpt.get_candidate_set_size(t, depth, v), mrpt_serial.get_candidate_set_size(t, depth, v));
+  }
+
+  void simdTester(Mrpt_Simd::level level) {
+    Mrpt_Simd::current() = level;
+    for(int n : {1, 15, 16, 31, 32, 33, 100, 784}) {
+      squaredDistanceTester<uint8_t>(n);
+      squaredDistanceTester<int8_t>(n);
+
+      VectorXf a = VectorXf::Random(n), b = VectorXf::Random(n);
+      EXPECT_NEAR(Mrpt::squared_distance(a.data(), b.data(), n), (a - b).squaredNorm(), 1e-5 * n);
+    }
+
+    halfPrecisionTester<Mrpt_Float16>();
+    halfPrecisionTester<Mrpt_BFloat16>();
+    fixedDimTester(128, true);
+    signMatrixTester(100, 1000, 1.0 / std::sqrt(1000));
+    sellTester(93, 1000, 1.0 / std::sqrt(1000));
+    int8Tester(5, 6, 1.0 / std::sqrt(d), false);
+  }
+
+  void int8Tester(int n_trees, int depth, float density, bool seed_only) {
+    MatrixXf U = (X * 20).array().max(0).min(255).round().matrix();
+    Mrpt mrpt(U);
+    mrpt.grow(n_trees, depth, density, seed_mrpt, 0, Mrpt::int8_projection);
+    const Mrpt::Int8_Matrix &m = mrpt.int8_random_matrix;
+
+    // Test that the projections are the exact integer products scaled by the row scales
+    std::vector<uint8_t> u(m.stride);
+    Mrpt::Int8_Matrix::quantize(U.col(0).data(), d, m.stride, u.data());
+    VectorXf projected(m.rows);
+    m.multiply(U.col(0).data(), projected.data(), 0, m.rows);
+    for(int j = 0; j < m.rows; ++j) {
+      int sum = 0;
+      for(int i = 0; i < d; ++i) {
+        ASSERT_LE(std::abs(m.values[j * m.stride + i]), 63);
+        sum += u[i] * m.values[j * m.stride + i];
+      }
+      EXPECT_EQ(m.dot(j, u.data()), sum);
+      EXPECT_EQ(projected(j), sum * m.scales[j]);
+    }
+
+    // Test that each point is routed into the leaf given by the split points,
+    // unless its projection ties with a split point (integer products tie often)
+    int n_leaf = 1 << depth;
+    for(int tree = 0; tree < n_trees; ++tree) {
+      for(int j = 0; j < n_leaf; ++j) {
+        for(int i = 0; i < getLeafSize(mrpt, tree, j); ++i) {
+          int idx = getLeafPoint(mrpt, tree, j, i);
+          VectorXf p(depth);
+          m.multiply(U.col(idx).data(), p.data(), tree * depth, depth);
+          int idx_tree = 0;
+          bool tie = false;
+          for(int level = 0; level < depth; ++level) {
+            tie = tie || p(level) == getSplitPoint(mrpt, tree, idx_tree);
+            idx_tree = p(level) <= getSplitPoint(mrpt, tree, idx_tree) ? 2 * idx_tree + 1 : 2 * idx_tree + 2;
+          }
+          if(!tie) {
+            ASSERT_EQ(idx_tree - n_leaf + 1, j);
+          }
+        }
+      }
+    }
+
+    mrpt.save("save/mrpt_saved", seed_only);
+    Mrpt mrpt_reloaded(U);
+    mrpt_reloaded.load("save/mrpt_saved");
+
+    EXPECT_EQ(mrpt_reloaded.projection, Mrpt::int8_projection);
+    EXPECT_EQ(m.values, mrpt_reloaded.int8_random_matrix.values);
+    EXPECT_EQ(m.scales, mrpt_reloaded.int8_random_matrix.scales);
+    splitPointsEqual(mrpt, mrpt_reloaded);
+    leavesEqual(mrpt, mrpt_reloaded);
+    normalQueryEquals(mrpt, mrpt_reloaded, 5, 1);
+  }
+
+  void poolTester(int n_trees, int depth, float density, int pool_size, int sample_size,
+      Mrpt::ptype projection = Mrpt::gaussian_projection) {
+    Mrpt mrpt(M);
+    mrpt.grow(n_trees, depth, density, seed_mrpt, sample_size, projection, pool_size);
+
+    // Test that each tree uses depth distinct random vectors of the pool
+    ASSERT_EQ(mrpt.pool_directions.size(), n_trees * depth);
+    for(int tree = 0; tree < n_trees; ++tree) {
+      std::set<int> directions;
+      for(int level = 0; level < depth; ++level) {
+        int j = mrpt.pool_directions[tree * depth + level];
+        ASSERT_GE(j, 0);
+        ASSERT_LT(j, pool_size);
+        directions.insert(j);
+      }
+      EXPECT_EQ(directions.size(), depth);
+    }
+
+    // Test that each point is routed into the leaf given by the split points
+    // and the projections onto the pool, unless it lies at a split point
+    int n_leaf = 1 << depth;
+    VectorXf projected(n_trees * depth);
+    for(int tree = 0; tree < n_trees; ++tree) {
+      VectorXi leaves = VectorXi::Zero(n);
+      for(int j = 0; j < n_leaf; ++j) {
+        for(int i = 0; i < getLeafSize(mrpt, tree, j); ++i) {
+          int idx = getLeafPoint(mrpt, tree, j, i);
+          mrpt.project(M.col(idx).data(), projected);
+          int idx_tree = 0;
+          bool tie = false;
+          for(int level = 0; level < depth; ++level) {
+            float p = projected(tree * depth + level), split = getSplitPoint(mrpt, tree, idx_tree);
+            tie = tie || std::abs(p - split) < 1e-4 * (1 + std::abs(split));
+            idx_tree = p <= split ? 2 * idx_tree + 1 : 2 * idx_tree + 2;
+          }
+          if(!tie) {
+            ASSERT_EQ(idx_tree - n_leaf + 1, j);
+          }
+          leaves(idx)++;
+        }
+      }
+      EXPECT_EQ(leaves, VectorXi::Ones(n));
+    }
+  }
+
+  template <typename T>
+  void scalarDataTester(const MatrixXf &F, const MatrixXf &F_test, int n_trees, int depth, float density,
+      Mrpt::ptype projection = Mrpt::gaussian_projection) {
+    Matrix<T, Dynamic, Dynamic> D = F.cast<T>();
+    Mrpt mrpt(F);
+    Mrpt_Index<T> mrpt_scalar(D);
+    mrpt.grow(n_trees, depth, density, seed_mrpt, 0, projection);
+    mrpt_scalar.grow(n_trees, depth, density, seed_mrpt, 0, projection);
+
+    // Test that the index is identical to the one grown using the data converted to floats
+    for(int tree = 0; tree < n_trees; ++tree)
+      for(int j = 0; j < (1 << depth) - 1; ++j)
+        ASSERT_EQ(mrpt.split_points(j, tree), mrpt_scalar.split_points(j, tree));
+    EXPECT_EQ(mrpt.tree_leaves, mrpt_scalar.tree_leaves);
+
+    // Test that the queries give the same neighbors and distances both when the
+    // query is integer-valued and the distances are computed by integer arithmetic,
+    // and when it is not
+    int k = 5, v = 1;
+    std::vector<int> result(k), result_scalar(k);
+    std::vector<float> distances(k), distances_scalar(k);
+    for(int i = 0; i < n_test; ++i) {
+      VectorXf queries[] = {F_test.col(i).array().round(), F_test.col(i)};
+      for(const VectorXf &query : queries) {
+        mrpt.query(query, k, v, &result[0], &distances[0]);
+        mrpt_scalar.query(query, k, v, &result_scalar[0], &distances_scalar[0]);
+        ASSERT_EQ(result, result_scalar);
+        for(int j = 0; j < k; ++j)
+          ASSERT_NEAR(distances[j], distances_scalar[j], 1e-4 * distances[j]);
+
+        mrpt.exact_knn(query, k, &result[0], &distances[0]);
+        mrpt_scalar.exact_knn(query, k, &result_scalar[0], &distances_scalar[0]);
+        ASSERT_EQ(result, result_scalar);
+      }
+    }
+  }
+
+  template <typename T>
+  void squaredDistanceTester(int n) {
+    std::mt19937 mt(seed_data);
+    std::uniform_int_distribution<int> uni(std::numeric_limits<T>::lowest(), std::numeric_limits<T>::max());
+    std::vector<T> a(n), b(n);
+    for(int i = 0; i < n; ++i) {
+      a[i] = uni(mt);
+      b[i] = i % 3 ? uni(mt) : (a[i] < 0 ? std::numeric_limits<T>::max() : std::numeric_limits<T>::lowest());
+    }
+
+    int64_t expected = 0;
+    for(int i = 0; i < n; ++i)
+      expected += (a[i] - b[i]) * (a[i] - b[i]);
+    EXPECT_EQ(Mrpt_Index<T>::squared_distance(a.data(), b.data(), n), static_cast<float>(expected));
+  }
+
+  template <typename T>
+  void halfPrecisionTester() {
+    // Test that the conversions of all the representable numbers are exact
+    for(int bits = 0; bits < (1 << 16); ++bits) {
+      T h;
+      h.bits = bits;
+      float f = h;
+      if(f == f && f != 0) {
+        ASSERT_EQ(T(f).bits, bits);
+      }
+    }
+
+    // Test that floats are rounded to the nearest representable number
+    std::mt19937 mt(seed_data);
+    std::uniform_real_distribution<float> uni(-8, 8);
+    std::uniform_int_distribution<int> exponent(-26, 12);
+    for(int i = 0; i < 10000; ++i) {
+      float f = std::ldexp(uni(mt), exponent(mt));
+      T h(f);
+      for(int step : {-1, 1}) {
+        T neighbor;
+        neighbor.bits = h.bits + step;
+        if(neighbor == neighbor) {
+          ASSERT_LE(std::abs(f - h), std::abs(f - neighbor));
+        }
+      }
+    }
+
+    // Test that the distance kernel agrees with the distances of the converted vectors
+    for(int n : {1, 7, 8, 9, 100}) {
+      VectorXf a = VectorXf::Random(n), b = VectorXf::Random(n);
+      std::vector<T> b_half(n);
+      VectorXf b_float(n);
+      for(int i = 0; i < n; ++i)
+        b_float(i) = b_half[i] = T(b(i));
+      EXPECT_NEAR(Mrpt_Index<T>::squared_distance(a.data(), b_half.data(), n), (a - b_float).squaredNorm(), 1e-5 * n);
+    }
+  }
+
+  void hadamardTester(int n_trees, int depth, int n_col) {
+    Mrpt::Hadamard_Transform h1, h2;
+    int n_row = n_trees * depth;
+
+    omp_set_num_threads(1);
+    Mrpt::build_hadamard_transform(h1, n_row, n_col, seed_mrpt);
+    omp_set_num_threads(4);
+    Mrpt::build_hadamard_transform(h2, n_row, n_col, seed_mrpt);
+    omp_set_num_threads(1);
+
+    EXPECT_EQ(h1.signs, h2.signs);
+    EXPECT_EQ(h1.rows, h2.rows);
+
+    // Test that the fast transform agrees with the product of the random vectors
+    Matrix<float, Dynamic, Dynamic, RowMajor> dense = h1.dense_rows(0, n_row);
+    VectorXf x = VectorXf::Random(n_col), projected(n_row);
+    h1.multiply(x.data(), projected.data());
+    VectorXf expected = dense * x;
+    for(int j = 0; j < n_row; ++j)
+      EXPECT_NEAR(projected(j), expected(j), 1e-3 * (1 + std::abs(expected(j))));
+
+    // Test that the random vectors of a block are orthogonal if no padding is needed
+    for(int j = 1; j < (n_col == h1.size ? std::min(n_row, h1.size) : 0); ++j)
+      EXPECT_EQ(dense.row(0).dot(dense.row(j)), 0.0);
+
+    // Test that the rows of pruned trees are regenerated from the seed
+    int depth_new = depth - 1, n_trees_new = n_trees - 1;
+    Mrpt::Hadamard_Transform pruned = h1.tree_rows(n_trees_new, depth, depth_new), regenerated;
+    Mrpt::build_hadamard_transform(regenerated, n_trees_new * depth_new, n_col, seed_mrpt, depth_new, depth);
+    EXPECT_EQ(pruned.dense_rows(0, n_trees_new * depth_new), regenerated.dense_rows(0, n_trees_new * depth_new));
+  }
+
   void queryTester(int n_trees, int depth, float density, int votes, int k) {
 
     Mrpt mrpt(M);
@@ -352,11 +1510,13 @@ class MrptTest : public testing::Test {
     mrpt.query(q, k, votes, &result[0], &distances[0], &n_el);
 
     for(int i = 0; i < k; ++i)  {
-      if(i > 0) {
+      if(i > 0 && result[i] >= 0) {
         EXPECT_LE(distances[i-1], distances[i]);
       }
       if(result[i] >= 0) {
         EXPECT_FLOAT_EQ(distances[i], (X.col(result[i]) - q).norm());
+      } else {
+        EXPECT_FLOAT_EQ(distances[i], -1);
       }
     }
   }
@@ -846,6 +2006,331 @@ TEST_F(MrptTest, PrivateExactKnn) {
   privateExactKnnTester(n2);
 }
 
+// Test that when the split points are estimated from a sample, every data
+// point is stored exactly once in the leaf it is routed into, and that the
+// index is saved and loaded correctly.
+TEST_F(MrptTest, SampledSplitPoints) {
+  int n_trees = 5, depth = 6;
+  float density = 1.0 / std::sqrt(d);
+
+  sampledSplitsTester(n_trees, depth, density, 64);
+  sampledSplitsTester(n_trees, depth, density, 200);
+  sampledSplitsTester(n_trees, depth, 1.0, 200);
+  sampledSplitsTester(n_trees, 1, density, 2);
+}
+
+// Test that the random matrices do not depend on the number of threads
+// used to generate them, and that their components have the expected distribution.
+TEST_F(MrptTest, RandomMatrix) {
+  randomMatrixTester(500, 100, 0.1);
+  randomMatrixTester(100, 1000, 1.0 / std::sqrt(1000));
+  randomMatrixTester(50, 1000, 0.5);
+}
+
+// Test that the sign matrices do not depend on the number of threads used to
+// generate them, that their products are computed correctly, and that the
+// points of the trees grown using them are routed according to the split points.
+TEST_F(MrptTest, SignProjections) {
+  signMatrixTester(500, 100, 0.1);
+  signMatrixTester(100, 1000, 1.0 / std::sqrt(1000));
+  signMatrixTester(50, 37, 1.0);
+
+  int n_trees = 5, depth = 6;
+  float density = 1.0 / std::sqrt(d);
+  sampledSplitsTester(n_trees, depth, density, 0, Mrpt::sign_projection);
+  sampledSplitsTester(n_trees, depth, 1.0, 200, Mrpt::sign_projection);
+
+  saveTester(3, depth, density, seed_mrpt, false, Mrpt::sign_projection);
+  saveTester(3, depth, density, seed_mrpt, true, Mrpt::sign_projection);
+
+  int k = 5, trees_max = 5, depth_max = 6, depth_min = 4, votes_max = trees_max;
+  saveTesterAutotuningTargetRecall(0.9, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt,
+                                   true, Mrpt::sign_projection);
+}
+
+// Test that the quantized projections are exact integer products, that the
+// trees grown using them are correct, and that the index can be saved.
+TEST_F(MrptTest, Int8Projections) {
+  float density = 1.0 / std::sqrt(d);
+  int8Tester(5, 6, density, false);
+  int8Tester(5, 6, density, true);
+  int8Tester(3, 8, 1.0, false);
+  int8Tester(3, 8, 1.0, true);
+}
+
+// Test that the trees sharing a pool of random vectors use distinct vectors
+// on each level, that they are grown correctly, and that the index can be
+// saved and autotuned.
+TEST_F(MrptTest, PoolProjections) {
+  int n_trees = 10, depth = 6;
+  float density = 1.0 / std::sqrt(d);
+  poolTester(n_trees, depth, density, 12, 0);
+  poolTester(n_trees, depth, 1.0, depth, 200);
+  poolTester(n_trees, depth, density, 15, 0, Mrpt::sign_projection);
+  poolTester(n_trees, depth, 1.0, 20, 0, Mrpt::hadamard_projection);
+
+  saveTester(n_trees, depth, density, seed_mrpt, false, Mrpt::gaussian_projection, 12);
+  saveTester(n_trees, depth, density, seed_mrpt, true, Mrpt::gaussian_projection, 12);
+  saveTester(n_trees, depth, 1.0, seed_mrpt, true, Mrpt::hadamard_projection, 20);
+
+  int k = 5, trees_max = 10, depth_max = 6, depth_min = 4, votes_max = 5;
+  saveTesterAutotuningTargetRecall(0.5, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt,
+                                   true, Mrpt::gaussian_projection, 24);
+  saveTesterAutotuningTargetRecall(0.5, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt,
+                                   false, Mrpt::gaussian_projection, -1);
+}
+
+// Test that the indices of data sets stored as 8-bit integers are identical
+// to the indices of the same data sets stored as floats, and that the integer
+// distance kernels are exact.
+TEST_F(MrptTest, IntegerData) {
+  for(int n : {1, 15, 16, 31, 32, 33, 100, 784})  {
+    squaredDistanceTester<uint8_t>(n);
+    squaredDistanceTester<int8_t>(n);
+  }
+
+  MatrixXf U = (X * 20).array().max(0).min(255).round().matrix();
+  MatrixXf U_test = (Q * 20).array().max(0).min(255).matrix();
+  float density = 1.0 / std::sqrt(d);
+  scalarDataTester<uint8_t>(U, U_test, 5, 6, density);
+  scalarDataTester<uint8_t>(U, U_test, 5, 6, density, Mrpt::sign_projection);
+  scalarDataTester<uint8_t>(U, U_test, 5, 6, density, Mrpt::int8_projection);
+
+  MatrixXf S = ((X.array() - 5) * 20).max(-128).min(127).round().matrix();
+  MatrixXf S_test = ((Q.array() - 5) * 20).max(-128).min(127).matrix();
+  scalarDataTester<int8_t>(S, S_test, 5, 6, density);
+}
+
+// Test the conversions of the 16-bit floats, and that the indices of data
+// sets stored as 16-bit floats are identical to the indices of the same data
+// sets stored as floats.
+TEST_F(MrptTest, HalfPrecisionData) {
+  halfPrecisionTester<Mrpt_Float16>();
+  halfPrecisionTester<Mrpt_BFloat16>();
+
+  MatrixXf U = (X * 20).array().max(0).min(255).round().matrix();
+  MatrixXf U_test = (Q * 20).array().max(0).min(255).matrix();
+  float density = 1.0 / std::sqrt(d);
+  scalarDataTester<Mrpt_Float16>(U, U_test, 5, 6, density);
+  scalarDataTester<Mrpt_Float16>(U, U_test, 5, 6, density, Mrpt::sign_projection);
+  scalarDataTester<Mrpt_BFloat16>(U, U_test, 5, 6, density);
+  scalarDataTester<Mrpt_BFloat16>(U, U_test, 5, 6, density, Mrpt::hadamard_projection);
+}
+
+// Test that the ground truth of the autotuning computed by blocked matrix
+// products is the exact k nearest neighbors, also with several threads.
+TEST_F(MrptTest, GroundTruth) {
+  groundTruthTester(1, 1);
+  groundTruthTester(10, 1);
+  groundTruthTester(10, 4);
+  groundTruthTester(100, 3);
+}
+
+// Test that the votes of the test queries are counted correctly in the
+// autotuning, and that the counts do not depend on the number of threads.
+TEST_F(MrptTest, VoteCounting) {
+  voteCountTester(10, 6, 5, 1);
+  voteCountTester(10, 6, 5, 4);
+  voteCountTester(20, 8, 10, 3);
+}
+
+// Test that the autotuning can minimize a quantile of the query times.
+TEST_F(MrptTest, LatencyQuantile) {
+  latencyQuantileTester(10, 6, 0.5);
+  latencyQuantileTester(20, 7, 0.99);
+  latencyQuantileTester(20, 7, 1.0);
+  latencyQuantileTester(10, 6, 0.3, 600);
+  latencyQuantileTester(10, 6, 0.95, 600);
+
+  Mrpt::Autotuning options;
+  options.latency_quantile = 0.0;
+  Mrpt mrpt(M);
+  EXPECT_THROW(mrpt.grow(Q.data(), n_test, 5, 10, 6, 4, 5, 0.1, seed_mrpt, {}, Mrpt::gaussian_projection, 0, options),
+               std::out_of_range);
+  options.latency_quantile = 1.5;
+  EXPECT_THROW(mrpt.grow(Q.data(), n_test, 5, 10, 6, 4, 5, 0.1, seed_mrpt, {}, Mrpt::gaussian_projection, 0, options),
+               std::out_of_range);
+
+  // Test that the autotuning is rejected if the candidate set sizes kept for
+  // the quantile would take more than 1 GiB
+  options.latency_quantile = 0.5;
+  EXPECT_THROW(mrpt.grow(Q.data(), n_test, 5, 4000, 8, 4, 2000, 0.1, seed_mrpt, {}, Mrpt::gaussian_projection, 0,
+                         options), std::out_of_range);
+
+  // Test that the quantiles are not estimated when the mean is minimized
+  mrpt.grow(Q.data(), n_test, 5, 10, 6, 4, 5, 0.1, seed_mrpt);
+  for(const Mrpt_Parameters &par : mrpt.optimal_parameters())
+    EXPECT_EQ(par.estimated_qtime_quantile, 0.0);
+}
+
+// Test that the memory of the indices is estimated, and that the autotuning
+// chooses the fastest index which fits in a memory budget.
+TEST_F(MrptTest, MemoryBudget) {
+  memoryBudgetTester(10, 6, 1.0, Mrpt::gaussian_projection, 0);
+  memoryBudgetTester(20, 7, 1.0 / std::sqrt(d), Mrpt::gaussian_projection, 0.1);
+  memoryBudgetTester(20, 7, 1.0 / std::sqrt(d), Mrpt::sign_projection, 0.1);
+}
+
+// Test that the query times can be measured under the load of several
+// threads, and that the number of threads can be chosen by autotuning.
+TEST_F(MrptTest, Throughput) {
+  throughputTester(10, 6, 1);
+  throughputTester(10, 6, 4);
+  throughputTester(20, 7, -1);
+
+  Mrpt::Autotuning options;
+  options.load_threads = 0;
+  Mrpt mrpt(M);
+  EXPECT_THROW(mrpt.grow(Q.data(), n_test, 5, 10, 6, 4, 5, 0.1, seed_mrpt, {}, Mrpt::gaussian_projection, 0, options),
+               std::out_of_range);
+}
+
+// Test that the density of the random vectors can be chosen by autotuning.
+TEST_F(MrptTest, DensityTuning) {
+  densityTuningTester(10, 6, 0.2, Mrpt::gaussian_projection);
+  densityTuningTester(20, 7, 0.5, Mrpt::gaussian_projection);
+  densityTuningTester(20, 7, 0.5, Mrpt::sign_projection);
+
+  Mrpt mrpt(M);
+  mrpt.grow(0.5, Q.data(), n_test, 5, 10, 6, 4, 5, 0, seed_mrpt, {}, Mrpt::hadamard_projection);
+  EXPECT_FLOAT_EQ(mrpt.cost_model().density, 1.0 / std::sqrt(d));
+}
+
+// Test that trees can be added to an unpruned index, and that the autotuning
+// grows more trees if the target recall is not reached.
+TEST_F(MrptTest, AddTrees) {
+  addTreesTester(5, 6, Mrpt::gaussian_projection, 0, -1.0);
+  addTreesTester(8, 7, Mrpt::sign_projection, 0, 0.9);
+  addTreesTester(8, 7, Mrpt::hadamard_projection, 0, -1.0);
+  addTreesTester(8, 7, Mrpt::gaussian_projection, 20, 0.5);
+  treesLimitTester(4, 6, 0.9, 64);
+
+  Mrpt::Autotuning options;
+  options.trees_limit = 5;
+  Mrpt mrpt(M);
+  EXPECT_THROW(mrpt.grow(0.9, Q.data(), n_test, 5, 10, 6, 4, 5, 0.1, seed_mrpt, {}, Mrpt::gaussian_projection, 0,
+                         options), std::out_of_range);
+}
+
+// Test that an index can be autotuned for several values of k at once, and
+// that the value of k is chosen when the index is subsetted.
+TEST_F(MrptTest, MultiK) {
+  multiKTester(10, 6, {1, 5, 10});
+  multiKTester(20, 7, {1, 10});
+
+  Mrpt mrpt(M);
+  EXPECT_THROW(mrpt.grow(Q.data(), n_test, std::vector<int> {}), std::out_of_range);
+  EXPECT_THROW(mrpt.grow(Q.data(), n_test, {1, n + 1}), std::out_of_range);
+}
+
+// Test that the fastest parameters of the frontier can be validated by
+// querying the test queries, and that the measured times and recalls are stored.
+TEST_F(MrptTest, Validation) {
+  validationTester(10, 6, 0.5, 3, -1.0);
+  validationTester(20, 6, 0.7, 5, 0.9);
+  validationFallbackTester(10, 6, 5);
+
+  Mrpt::Autotuning options;
+  options.n_validated = -1;
+  Mrpt mrpt(M);
+  EXPECT_THROW(mrpt.grow(0.9, Q.data(), n_test, 5, 10, 6, 4, 5, 0.1, seed_mrpt, {}, Mrpt::gaussian_projection, 0,
+                         options), std::out_of_range);
+}
+
+// Test that the test set sampled from the training set grows until the
+// confidence interval of the recall is narrow enough or the time limit is reached.
+TEST_F(MrptTest, TestSetSize) {
+  testSetTester(10, 6, 1);
+  testSetTester(10, 6, 10);
+
+  Mrpt::Autotuning options;
+  options.recall_tolerance = -0.1;
+  Mrpt mrpt(M);
+  EXPECT_THROW(mrpt.grow_autotune(5, 10, 6, 4, 5, 0.1, seed_mrpt, 20, Mrpt::gaussian_projection, 0, options),
+               std::out_of_range);
+  options.recall_tolerance = 0.1;
+  options.test_time_limit = -1.0;
+  EXPECT_THROW(mrpt.grow_autotune(5, 10, 6, 4, 5, 0.1, seed_mrpt, 20, Mrpt::gaussian_projection, 0, options),
+               std::out_of_range);
+}
+
+// Test that the autotuning can use precomputed nearest neighbors of the test
+// queries instead of searching for them.
+TEST_F(MrptTest, PrecomputedExact) {
+  precomputedExactTester(10, 6, 1);
+  precomputedExactTester(10, 6, 10);
+
+  Mrpt mrpt(M);
+  MatrixXi exact = MatrixXi::Zero(5, n_test);
+  EXPECT_THROW(mrpt.grow(Q, exact.leftCols(n_test - 1), 5), std::invalid_argument);
+  EXPECT_THROW(mrpt.grow(Q, exact, 10), std::invalid_argument);
+  exact(0, 0) = n;
+  EXPECT_THROW(mrpt.grow(Q, exact, 5), std::out_of_range);
+}
+
+// Test that the cost model of the hardware can be saved and loaded, and that
+// autotuning with it gives the same estimates without timing the queries.
+TEST_F(MrptTest, CostModel) {
+  costModelTester(10, 6, Mrpt::gaussian_projection);
+  costModelTester(20, 7, Mrpt::sign_projection);
+  costModelTester(20, 7, Mrpt::hadamard_projection);
+}
+
+// Test the kernels of all the instruction set levels supported by the CPU,
+// and that the level can be lowered by the environment variable MRPT_SIMD.
+TEST_F(MrptTest, SimdLevels) {
+  Mrpt_Simd::level detected = Mrpt_Simd::current();
+  for(int level = Mrpt_Simd::scalar; level <= detected; ++level)
+    simdTester(static_cast<Mrpt_Simd::level>(level));
+  Mrpt_Simd::current() = detected;
+
+  setenv("MRPT_SIMD", "scalar", 1);
+  EXPECT_EQ(Mrpt_Simd::detect(), Mrpt_Simd::scalar);
+  setenv("MRPT_SIMD", "sse4", 1);
+  EXPECT_EQ(Mrpt_Simd::detect(), std::min(detected, Mrpt_Simd::sse4));
+  setenv("MRPT_SIMD", "avx512", 1);
+  EXPECT_EQ(Mrpt_Simd::detect(), detected);
+  unsetenv("MRPT_SIMD");
+}
+
+// Test the kernels specialized for the common dimensions of the data, and
+// that the other dimensions fall back to the dynamic kernels.
+TEST_F(MrptTest, FixedDimensions) {
+  for(int dim : {96, 128, 256, 384, 768, 784, 960})
+    fixedDimTester(dim, true);
+  fixedDimTester(100, false);
+  fixedDimTester(785, false);
+}
+
+// Test that the products of the sparse random matrices in the SELL format
+// agree with the products of the Eigen matrices.
+TEST_F(MrptTest, SellProjections) {
+  sellTester(500, 100, 0.1);
+  sellTester(93, 1000, 1.0 / std::sqrt(1000));
+  sellTester(3, 10, 0.5);
+  sellTester(64, 100, 1.0);
+}
+
+// Test that the structured random vectors do not depend on the number of
+// threads used to generate them, that the fast transform computes their
+// products, and that the trees grown using them and the saved indices are correct.
+TEST_F(MrptTest, HadamardProjections) {
+  hadamardTester(10, 6, 100);
+  hadamardTester(100, 8, 128);
+  hadamardTester(3, 2, 1);
+
+  int n_trees = 5, depth = 6;
+  sampledSplitsTester(n_trees, depth, 1.0, 0, Mrpt::hadamard_projection);
+  sampledSplitsTester(n_trees, depth, 1.0, 200, Mrpt::hadamard_projection);
+
+  saveTester(30, depth, 1.0, seed_mrpt, false, Mrpt::hadamard_projection);
+  saveTester(30, depth, 1.0, seed_mrpt, true, Mrpt::hadamard_projection);
+
+  int k = 5, trees_max = 30, depth_max = 6, depth_min = 4, votes_max = 5;
+  saveTesterAutotuningTargetRecall(0.5, k, trees_max, depth_max, depth_min, votes_max, 1.0, seed_mrpt,
+                                   true, Mrpt::hadamard_projection);
+}
+
 // Test that the loaded index is identical to the original one that was saved.
 TEST_F(MrptTest, Saving) {
   int n_trees = 3, depth = 6, seed_mrpt = 12345;
@@ -856,6 +2341,49 @@ TEST_F(MrptTest, Saving) {
   saveTester(1, depth, density, seed_mrpt);
 }
 
+// Test that the loaded index is identical to the original one when only the
+// seed of the random matrix is saved, also for the index pruned to the target
+// recall level (and to a smaller depth).
+TEST_F(MrptTest, SeedOnlySaving) {
+  int n_trees = 3, depth = 6, seed_mrpt = 12345;
+  float density = 1.0 / std::sqrt(d);
+
+  saveTester(n_trees, depth, density, seed_mrpt, true);
+  saveTester(n_trees, depth, 1.0, seed_mrpt, true);
+  saveTester(1, depth, density, 0, true);
+
+  seedChecksumTester(n_trees, depth, density);
+  seedChecksumTester(n_trees, depth, 1.0);
+
+  int k = 5, trees_max = 5, depth_max = 6, depth_min = 4, votes_max = trees_max;
+  saveTesterAutotuningTargetRecall(0.1, k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, true);
+  saveTesterAutotuningTargetRecall(0.9, k, trees_max, depth_max, depth_min, votes_max, 1.0, seed_mrpt, true);
+}
+
+// Test that the index files written without a format version are loaded, and
+// that the files of unknown versions and truncated files are rejected.
+TEST_F(MrptTest, LegacyLoading) {
+  legacyLoadTester(3, 6, 1.0 / std::sqrt(d));
+  legacyLoadTester(3, 6, 1.0);
+  legacyAutotunedLoadTester(5, 10, 6, 5, 3, 1.0 / std::sqrt(d));
+
+  FILE *fd = fopen("save/mrpt_unknown", "wb");
+  int header[] = {0x5450524d, 1000, 0};
+  fwrite(header, sizeof(int), 3, fd);
+  fclose(fd);
+  Mrpt mrpt(M2);
+  EXPECT_FALSE(mrpt.load("save/mrpt_unknown"));
+
+  Mrpt mrpt2(M2);
+  mrpt2.grow(3, 6, 1.0, seed_mrpt);
+  truncatedLoadTester(mrpt2, 0);
+
+  // cut inside the last non-zero component of the sparse random matrix
+  Mrpt mrpt3(M2);
+  mrpt3.grow(3, 6, 1.0 / std::sqrt(d), seed_mrpt);
+  truncatedLoadTester(mrpt3, 6);
+}
+
 // Test that the loaded autotuned index is identical to the original one that
 // was saved.
 TEST_F(MrptTest, AutotuningSaving) {
@@ -1267,6 +2795,31 @@ TEST_F(MrptTest, GrowThrows) {
   Mrpt mrpt4(M2);
   EXPECT_NO_THROW(mrpt4.grow(n_trees, depth));
   EXPECT_FALSE(mrpt4.empty());
+
+  Mrpt mrpt5(M2);
+  EXPECT_THROW(mrpt5.grow(n_trees, depth, density, 0, -1), std::out_of_range);
+  EXPECT_TRUE(mrpt5.empty());
+  EXPECT_THROW(mrpt5.grow(n_trees, depth, density, 0, (1 << depth) - 1), std::out_of_range);
+  EXPECT_TRUE(mrpt5.empty());
+
+  EXPECT_NO_THROW(mrpt5.grow(n_trees, depth, density, 0, 1 << depth));
+  EXPECT_FALSE(mrpt5.empty());
+
+  Mrpt mrpt6(M2);
+  EXPECT_THROW(mrpt6.grow(n_trees, depth, density, 0, 0, Mrpt::int8_projection), std::invalid_argument);
+  EXPECT_TRUE(mrpt6.empty());
+
+  Mrpt mrpt7(M2);
+  EXPECT_THROW(mrpt7.grow(n_trees, depth, density, 0, 0, Mrpt::gaussian_projection, -1), std::out_of_range);
+  EXPECT_TRUE(mrpt7.empty());
+  EXPECT_THROW(mrpt7.grow(n_trees, depth, density, 0, 0, Mrpt::gaussian_projection, depth - 1), std::out_of_range);
+  EXPECT_TRUE(mrpt7.empty());
+  EXPECT_THROW(mrpt7.grow(test_queries, 5, n_trees, depth, 5, -1, density, 0, Mrpt::gaussian_projection, -2),
+               std::out_of_range);
+  EXPECT_TRUE(mrpt7.empty());
+
+  EXPECT_NO_THROW(mrpt7.grow(n_trees, depth, density, 0, 0, Mrpt::gaussian_projection, depth));
+  EXPECT_FALSE(mrpt7.empty());
 }
 
 // Test that the autotuning throws an out-of-range exception, when called
@@ -12,11 +12,17 @@
 
 using namespace Eigen;
 
+// The reference implementation draws the random vectors from std::mt19937,
+// so the indices are grown using the legacy generator in these tests. The
+// projections are computed by the scalar kernels, which sum the products in
+// the same order as the reference implementation.
 class MrptTest : public testing::Test {
   protected:
 
   MrptTest() : d(100), n(1024), n2(155), n_test(100), seed_data(56789), seed_mrpt(12345),
     M(nullptr, 0, 0), M2(nullptr, 0, 0) {
+          Mrpt_Simd::current() = Mrpt_Simd::scalar;
+
           std::mt19937 mt(seed_data);
           std::normal_distribution<double> dist(5.0,2.0);
 
@@ -87,6 +93,7 @@ class MrptTest : public testing::Test {
     ASSERT_EQ(approximate_knn.size(), k);
 
     Mrpt index_dense(M);
+    index_dense.generator = Mrpt::legacy;
     index_dense.grow(n_trees, depth, density, seed_mrpt);
 
     std::vector<int> result(k);
@@ -133,6 +140,7 @@ class MrptTest : public testing::Test {
 
   void splitPointTester(int n_trees, int depth, float density) {
     Mrpt index(M2);
+    index.generator = Mrpt::legacy;
     index.grow(n_trees, depth, density, seed_mrpt);
     Mrpt_old index_old(M2_pointer, n_trees, depth, density);
     index_old.grow(seed_mrpt);
@@ -183,6 +191,7 @@ class MrptTest : public testing::Test {
 
   void leafTester(int n_trees, int depth, float density) {
     Mrpt index(M2);
+    index.generator = Mrpt::legacy;
     index.grow(n_trees, depth, density, seed_mrpt);
     Mrpt_old index_old(M2_pointer, n_trees, depth, density);
     index_old.grow(seed_mrpt);
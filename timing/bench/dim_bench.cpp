@@ -0,0 +1,121 @@
+#include <iostream>
+#include <omp.h>
+#include <hayai.hpp>
+#include "Mrpt.h"
+
+using namespace Eigen;
+
+// The index grants its friend MrptTest access to the kernels specialized for a
+// fixed dimension of the data.
+class MrptTest : public ::hayai::Fixture {
+public:
+    MrptTest() {
+      omp_set_num_threads(1);
+    }
+
+protected:
+    template <int Dim>
+    using Fixed_Kernels = Mrpt::Fixed_Kernels<Dim>;
+};
+
+// Compares the kernels specialized for a fixed dimension of the data with the
+// kernels for dynamic dimensions: the distances of a query to all the data
+// points, and the dense projections of a query onto the random vectors. The
+// data and the random matrix of the dimension Dim are generated when the
+// fixture is constructed, so that only the kernels are timed.
+template <int Dim>
+class DimTest : public MrptTest {
+public:
+    typedef Matrix<float, Dynamic, Dynamic, RowMajor> RowMatrixXf;
+
+    DimTest() : X(MatrixXf::Random(Dim, n_points)), q(VectorXf::Random(Dim)), distances(n_points),
+      random_matrix(RowMatrixXf::Random(n_rows, Dim)), projected(n_rows) {}
+
+    void distance_runner(bool fixed) {
+      if (fixed) {
+        for(int i = 0; i < n_points; ++i)
+          distances(i) = Fixed_Kernels<Dim>::squared_distance(q.data(), X.col(i).data());
+      } else {
+        for(int i = 0; i < n_points; ++i)
+          distances(i) = (X.col(i) - q).squaredNorm();
+      }
+      sink += distances.sum();
+    }
+
+    void projection_runner(bool fixed) {
+      for(int i = 0; i < n_queries; ++i) {
+        if (fixed)
+          Fixed_Kernels<Dim>::multiply(random_matrix.data(), X.col(i).data(), projected.data(), n_rows);
+        else
+          projected.noalias() = random_matrix * X.col(i);
+        sink += projected.sum();
+      }
+    }
+
+    static const int n_points = 100000, n_queries = 1000, n_rows = 500; // 50 trees of depth 10
+
+    MatrixXf X;
+    VectorXf q, distances;
+    RowMatrixXf random_matrix;
+    VectorXf projected;
+    float sink = 0;
+};
+
+typedef DimTest<128> MrptTest128;
+typedef DimTest<768> MrptTest768;
+typedef DimTest<960> MrptTest960;
+
+BENCHMARK_F(MrptTest128, Distance128Fixed, 5, 10) {
+  distance_runner(true);
+}
+
+BENCHMARK_F(MrptTest128, Distance128Dynamic, 5, 10) {
+  distance_runner(false);
+}
+
+BENCHMARK_F(MrptTest768, Distance768Fixed, 5, 10) {
+  distance_runner(true);
+}
+
+BENCHMARK_F(MrptTest768, Distance768Dynamic, 5, 10) {
+  distance_runner(false);
+}
+
+BENCHMARK_F(MrptTest960, Distance960Fixed, 5, 10) {
+  distance_runner(true);
+}
+
+BENCHMARK_F(MrptTest960, Distance960Dynamic, 5, 10) {
+  distance_runner(false);
+}
+
+BENCHMARK_F(MrptTest128, Projection128Fixed, 5, 10) {
+  projection_runner(true);
+}
+
+BENCHMARK_F(MrptTest128, Projection128Dynamic, 5, 10) {
+  projection_runner(false);
+}
+
+BENCHMARK_F(MrptTest768, Projection768Fixed, 5, 10) {
+  projection_runner(true);
+}
+
+BENCHMARK_F(MrptTest768, Projection768Dynamic, 5, 10) {
+  projection_runner(false);
+}
+
+BENCHMARK_F(MrptTest960, Projection960Fixed, 5, 10) {
+  projection_runner(true);
+}
+
+BENCHMARK_F(MrptTest960, Projection960Dynamic, 5, 10) {
+  projection_runner(false);
+}
+
+int main(int argc, char **argv) {
+    hayai::ConsoleOutputter consoleOutputter;
+
+    hayai::Benchmarker::AddOutputter(consoleOutputter);
+    hayai::Benchmarker::RunAllTests();
+}
@@ -28,6 +28,23 @@
 
 using namespace Eigen;
 
+class MrptTest {
+public:
+  typedef Mrpt::Sell_Matrix Sell_Matrix;
+
+  static void build_sparse_random_matrix(SparseMatrix<float, RowMajor> &spmat, int n_row, int n_col,
+                                         float density, int seed) {
+    Mrpt::build_sparse_random_matrix(spmat, n_row, n_col, density, seed);
+  }
+};
+
+static void print_times(std::vector<double> &times) {
+    std::sort(times.begin(), times.end());
+    std::cout << "mean projection time: " << mean(times) * 1000.0 << " ms. " << "\n";
+    std::cout << "median projection time: " << times[times.size() / 2] * 1000.0 << " ms. " << "\n";
+    std::cout << "standard deviation: " << std::sqrt(var(times)) << "\n";
+}
+
 int main(int argc, char **argv) {
     // for(auto &s : std::vector<char*>(argv, argv + argc))
     //   std::cout << s << '\n';
@@ -73,7 +90,8 @@ int main(int argc, char **argv) {
     int n_pool = trees_max * depth_max;
 
     SparseMatrix<float, RowMajor> spmat;
-    Mrpt::build_sparse_random_matrix(spmat, n_pool, dim, density, seed);
+    MrptTest::build_sparse_random_matrix(spmat, n_pool, dim, density, seed);
+    MrptTest::Sell_Matrix sell(spmat);
     double nsum = 0;
 
     std::vector<double> times;
@@ -88,11 +106,9 @@ int main(int argc, char **argv) {
     }
     std::cout << "sum of norms: " << nsum << "\n";
 
-    std::sort(times.begin(), times.end());
     std::cout << "\n\n\n";
-    std::cout << "mean projection time: " << Autotuning::mean(times) * 1000.0 << " ms. " << "\n";
-    std::cout << "median projection time: " << times[n_test / 2] * 1000.0 << " ms. " << "\n";
-    std::cout << "standard deviation: " << std::sqrt(Autotuning::var(times)) << "\n";
+    std::cout << "Eigen, whole matrix\n";
+    print_times(times);
 
     ////////////////////////////////////////////////////////////////////
     // Projection by loop
@@ -120,18 +136,78 @@ int main(int argc, char **argv) {
     }
     std::cout << "sum of norms: " << nsum2 << "\n";
 
-    std::sort(times2.begin(), times2.end());
     std::cout << "\n\n\n";
-    std::cout << "mean projection time: " << Autotuning::mean(times2) * 1000.0 << " ms. " << "\n";
-    std::cout << "median projection time: " << times2[n_test / 2] * 1000.0 << " ms. " << "\n";
-    std::cout << "standard deviation: " << std::sqrt(Autotuning::var(times2)) << "\n";
+    std::cout << "Eigen, per tree\n";
+    print_times(times2);
+
+    ////////////////////////////////////////////////////////////////////
+    // Projection by the vectorized SELL kernel
+
+    double nsum3 = 0;
+
+    std::vector<double> times3, times4;
+    for(int i = 0; i < n_test; ++i) {
+      const float *q = &test[i * dim];
+      double start = omp_get_wtime();
+      VectorXf projected_query(n_pool);
+      sell.multiply(q, projected_query.data(), 0, n_pool);
+      double end = omp_get_wtime();
+      times3.push_back(end - start);
+      nsum3 += projected_query.norm();
+
+      double qtime = 0.0;
+      for (int n_tree = 0; n_tree < trees_max; ++n_tree) {
+        double start2 = omp_get_wtime();
+        VectorXf projected_query2(depth_max);
+        sell.multiply(q, projected_query2.data(), n_tree * depth_max, depth_max);
+        double end2 = omp_get_wtime();
 
+        nsum3 += projected_query2.norm();
+        qtime += end2 - start2;
+      }
+      times4.push_back(qtime);
+    }
+    std::cout << "sum of norms: " << nsum3 << "\n";
 
+    std::cout << "\n\n\n";
+    std::cout << "SELL, whole matrix\n";
+    print_times(times3);
+    std::cout << "\n";
+    std::cout << "SELL, per tree\n";
+    print_times(times4);
 
+    ////////////////////////////////////////////////////////////////////
+    // Projection of the data set at tree growing time
 
+    std::vector<double> grow_times, grow_times_sell;
+    double nsum4 = 0;
+    for (int n_tree = 0; n_tree < std::min(trees_max, 10); ++n_tree) {
+      double start = omp_get_wtime();
+      MatrixXf tree_projections;
+      tree_projections.noalias() = spmat.middleRows(n_tree * depth_max, depth_max) * *M;
+      double end = omp_get_wtime();
+      grow_times.push_back(end - start);
+      nsum4 += tree_projections.norm();
+
+      start = omp_get_wtime();
+      MatrixXf tree_projections2(depth_max, n_points);
+      for (size_t i = 0; i < n_points; ++i)
+        sell.multiply(train + i * dim, tree_projections2.data() + i * depth_max, n_tree * depth_max, depth_max);
+      end = omp_get_wtime();
+      grow_times_sell.push_back(end - start);
+      nsum4 += tree_projections2.norm();
+    }
+    std::cout << "sum of norms: " << nsum4 << "\n";
+
+    std::cout << "\n\n\n";
+    std::cout << "Eigen, data set per tree\n";
+    print_times(grow_times);
+    std::cout << "\n";
+    std::cout << "SELL, data set per tree\n";
+    print_times(grow_times_sell);
 
     delete[] test;
-    if(!mmap) delete[] train;
+    delete[] train;
 
     return 0;
 }
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <fstream>
+#include <Eigen/Dense>
+#include <Eigen/SparseCore>
+
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <omp.h>
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <string>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Mrpt.h"
+#include "common.h"
+
+
+using namespace Eigen;
+
+// Compares the size and the loading time of an index file storing the whole
+// random matrix to an index file storing only the seed of the random matrix.
+int main(int argc, char **argv) {
+    size_t n = atoi(argv[1]);
+    size_t n_test = atoi(argv[2]);
+    size_t dim = atoi(argv[3]);
+    int n_trees = atoi(argv[4]);
+    int depth = atoi(argv[5]);
+    float density = atof(argv[6]);
+    bool parallel = atoi(argv[7]);
+
+    std::string infile_path(argv[8]);
+    if (!infile_path.empty() && infile_path.back() != '/')
+      infile_path += '/';
+
+    std::string index_path(argv[9]);
+    int n_sim = argc > 10 ? atoi(argv[10]) : 10;
+
+    size_t n_points = n - n_test;
+
+    float *train = read_memory((infile_path + "train.bin").c_str(), n_points, dim);
+    if(!train) {
+        std::cerr << "in save_load_tester: training data " << infile_path + "train.bin" << " could not be read\n";
+        return -1;
+    }
+
+    const Map<const MatrixXf> M(train, dim, n_points);
+
+    if(!parallel) omp_set_num_threads(1);
+    int seed = 12345;
+
+    Mrpt mrpt(M);
+    mrpt.grow(n_trees, depth, density, seed);
+
+    for (bool seed_only : {false, true}) {
+      std::string path(index_path + (seed_only ? "_seed" : "_full"));
+
+      double save_start = omp_get_wtime();
+      if (!mrpt.save(path.c_str(), seed_only)) {
+        std::cerr << path << " could not be opened for writing." << std::endl;
+        return -1;
+      }
+      double save_time = omp_get_wtime() - save_start;
+
+      struct stat sb;
+      stat(path.c_str(), &sb);
+
+      std::vector<double> load_times;
+      for (int i = 0; i < n_sim; ++i) {
+        Mrpt mrpt_reloaded(M);
+        double load_start = omp_get_wtime();
+        mrpt_reloaded.load(path.c_str());
+        load_times.push_back(omp_get_wtime() - load_start);
+      }
+
+      std::cout << n_trees << " " << depth << " " << density << " " << seed_only << " "
+                << sb.st_size << " " << save_time << " " << median(load_times) << std::endl;
+    }
+
+    delete[] train;
+    return 0;
+}
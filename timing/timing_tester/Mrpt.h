@@ -3,19 +3,32 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
+#include <limits>
 #include <map>
 #include <numeric>
 #include <random>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include <Eigen/Dense>
 #include <Eigen/SparseCore>
 
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define MRPT_SIMD_DISPATCH
+#define MRPT_TARGET(isa) __attribute__((target(isa)))
+#endif
+
 struct Mrpt_Parameters {
   int n_trees = 0; /**< Number of trees in the index. */
   int depth = 0; /**< Depth of the trees in the index. */
@@ -23,19 +36,463 @@ struct Mrpt_Parameters {
   int votes = 0; /**< Optimal vote threshold (if the index is autotuned and the target recall is set; otherwise 0). */
   double estimated_qtime = 0.0; /**< Estimated query time (if the index is autotuned and the target recall is set; otherwise 0.0). */
   double estimated_recall = 0.0; /**< Estimated recall (if the index is autotuned and the target recall is set; otherwise 0.0). */
+  double estimated_qtime_quantile = 0.0; /**< Estimated quantile of the query times (if the index is autotuned for a latency quantile and the target recall is set; otherwise 0.0). */
+  int64_t estimated_bytes = 0; /**< Estimated memory of the index in bytes, without the data set (if the index is autotuned and the target recall is set; otherwise 0). */
+  int n_threads = 0; /**< Number of threads querying concurrently for which the query time is estimated (if the index is autotuned; otherwise 0). */
+  double estimated_qps = 0.0; /**< Estimated number of queries per second of all the n_threads threads (if the index is autotuned and the target recall is set; otherwise 0.0). */
+  double measured_qtime = 0.0; /**< Query time measured on the test queries, or its latency quantile if the index is autotuned for one (if the parameters are validated by the autotuning; otherwise 0.0). */
+  double measured_recall = 0.0; /**< Recall measured on the test queries (if the parameters are validated by the autotuning; otherwise 0.0). */
+};
+
+/**
+* A half-precision (IEEE 754 binary16) number, for storing a data set such
+* as neural embeddings in half the memory of floats. The components are
+* converted to floats in blocks when the data is projected, and one by one
+* inside the kernel which computes the distances to a query.
+*/
+struct Mrpt_Float16 {
+  Mrpt_Float16() = default;
+
+  /** Rounds f to the nearest half-precision number. */
+  explicit Mrpt_Float16(float f) : bits(from_float(f)) {}
+
+  operator float() const {
+#ifdef __F16C__
+    return _cvtsh_ss(bits);
+#else
+    uint32_t sign = static_cast<uint32_t>(bits & 0x8000) << 16, exponent = (bits >> 10) & 0x1f,
+             mantissa = bits & 0x3ff, x = sign;
+    if (exponent == 0x1f) {
+      x |= 0x7f800000 | mantissa << 13;
+    } else if (exponent) {
+      x |= (exponent + 112) << 23 | mantissa << 13;
+    } else if (mantissa) {
+      float f = mantissa * 5.9604645e-8f; // subnormal: mantissa * 2^-24
+      return sign ? -f : f;
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof f);
+    return f;
+#endif
+  }
+
+  static uint16_t from_float(float f) {
+#ifdef __F16C__
+    return _cvtss_sh(f, 0);
+#else
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof x);
+    uint16_t sign = (x >> 16) & 0x8000;
+    x &= 0x7fffffff;
+    if (x > 0x7f800000)
+      return sign | 0x7e00; // NaN
+    if (x >= 0x477ff000)
+      return sign | 0x7c00; // rounds to infinity
+    if (x < 0x38800000) { // subnormal: round to a multiple of 2^-24
+      float a;
+      std::memcpy(&a, &x, sizeof a);
+      return sign | static_cast<uint16_t>(std::nearbyint(a * 16777216.0f));
+    }
+    x += 0xfff + ((x >> 13) & 1); // round to nearest even
+    return sign | static_cast<uint16_t>((x - 0x38000000) >> 13);
+#endif
+  }
+
+  uint16_t bits; /**< Sign, exponent and mantissa. */
+};
+
+/**
+* A bfloat16 number: a float whose mantissa is rounded to 7 bits, so that
+* it keeps the range of floats in half the memory.
+*/
+struct Mrpt_BFloat16 {
+  Mrpt_BFloat16() = default;
+
+  /** Rounds f to the nearest bfloat16 number. */
+  explicit Mrpt_BFloat16(float f) : bits(from_float(f)) {}
+
+  operator float() const {
+    uint32_t x = static_cast<uint32_t>(bits) << 16;
+    float f;
+    std::memcpy(&f, &x, sizeof f);
+    return f;
+  }
+
+  static uint16_t from_float(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof x);
+    if ((x & 0x7fffffff) > 0x7f800000)
+      return (x >> 16) | 0x40; // NaN
+    return (x + 0x7fff + ((x >> 16) & 1)) >> 16; // round to nearest even
+  }
+
+  uint16_t bits; /**< Upper half of the bits of the float. */
+};
+
+namespace Eigen {
+template <typename T>
+struct Mrpt_Half_Traits : GenericNumTraits<T> {
+  typedef float Real;
+  typedef float NonInteger;
+  typedef float Literal;
+  enum { IsComplex = 0, IsInteger = 0, IsSigned = 1, RequireInitialization = 0, ReadCost = 1, AddCost = 1,
+         MulCost = 1 };
+};
+
+template <> struct NumTraits<Mrpt_Float16> : Mrpt_Half_Traits<Mrpt_Float16> {};
+template <> struct NumTraits<Mrpt_BFloat16> : Mrpt_Half_Traits<Mrpt_BFloat16> {};
+}
+
+/**
+* Instruction set levels of the SIMD kernels. The level is selected at run
+* time, so that one binary uses the widest kernels supported by the CPU on
+* which it runs: SSE4.1, AVX2 (with FMA and F16C) or AVX-512 (F, BW and VL).
+*/
+struct Mrpt_Simd {
+  enum level {scalar, sse4, avx2, avx512};
+
+  /**
+  * Returns the highest level supported by the CPU, or the level given in the
+  * environment variable MRPT_SIMD (`scalar`, `sse4`, `avx2` or `avx512`) if
+  * it is lower, so that the kernels of different levels can be tested and
+  * benchmarked side by side on one machine.
+  */
+  static level detect() {
+    level supported = scalar;
+#ifdef MRPT_SIMD_DISPATCH
+    __builtin_cpu_init();
+    // the kernels of the avx2 level are also used at the avx512 level
+    const bool avx2_fma_f16c = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+                               __builtin_cpu_supports("f16c");
+    if (avx2_fma_f16c && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl"))
+      supported = avx512;
+    else if (avx2_fma_f16c)
+      supported = avx2;
+    else if (__builtin_cpu_supports("sse4.1"))
+      supported = sse4;
+#endif
+    const char *forced = std::getenv("MRPT_SIMD");
+    const char *names[] = {"scalar", "sse4", "avx2", "avx512"};
+    for (int l = scalar; forced && l < supported; ++l)
+      if (!std::strcmp(forced, names[l]))
+        return static_cast<level>(l);
+    return supported;
+  }
+
+  /**
+  * Returns the level of the kernels in use, which is detected on the first
+  * call; it can be set to a lower level than the detected one.
+  */
+  static level &current() {
+    static level l = detect();
+    return l;
+  }
+
+  /**
+  * Returns true if the CPU supports the AVX-512 integer dot products (VNNI).
+  */
+  static bool vnni() {
+#ifdef MRPT_SIMD_DISPATCH
+    static const bool supported = __builtin_cpu_supports("avx512vnni");
+    return supported;
+#else
+    return false;
+#endif
+  }
+};
+
+/**
+* Options shared by the indices of all the data types.
+*/
+struct Mrpt_Options {
+  /**
+  * Distributions of the non-zero components of the random vectors: the
+  * standard normal distribution (`gaussian_projection`), or +1 and -1
+  * with equal probabilities (`sign_projection`). Sign projections store
+  * only the column index and the sign of each non-zero component, and
+  * the projections are computed by additions and subtractions.
+  * Structured projections (`hadamard_projection`) flip the signs of the
+  * components of a vector at random, transform it by a fast Walsh-Hadamard
+  * transform and subsample the result, which gives all the projections of
+  * a query in \f$O(d \log d)\f$ time per block of \f$d\f$ random vectors;
+  * the density is then ignored. Quantized projections (`int8_projection`)
+  * round the Gaussian random vectors to 8-bit integers with a scale per
+  * vector, and compute the projections of data with integer components on
+  * [0, 255] (such as SIFT or MNIST) by integer dot products.
+  */
+  enum ptype {gaussian_projection, sign_projection, hadamard_projection, int8_projection};
+
+  struct Autotuning;
+};
+
+/**
+* A cost model of the hardware fitted by the autotuning: the linear models
+* of the projection, voting and exact search times of a query. The model of
+* an autotuned index (see Mrpt_Index::cost_model()) can be saved and passed
+* to grow() when an index of the same kind of data set is autotuned again on
+* the same CPU; the query times are then not measured, which makes the
+* autotuning faster and its results deterministic.
+*/
+struct Mrpt_Cost_Model {
+  int dim = 0; /**< Dimension of the data. */
+  float density = 0; /**< Expected proportion of non-zero components in the random vectors. */
+  Mrpt_Options::ptype projection = Mrpt_Options::gaussian_projection; /**< Distribution of the random vectors. */
+  int depth_min = 0; /**< Depth of the trees of the first voting model. */
+  std::string cpu; /**< CPU on which the model is fitted; see cpu_id(). */
+  int n_threads = 1; /**< Number of threads querying concurrently when the model is fitted. */
+  std::pair<double,double> projection_beta; /**< Projection time as a function of the number of random vectors. */
+  std::pair<double,double> exact_beta; /**< Exact search time as a function of the candidate set size. */
+  std::vector<std::map<int,std::pair<double,double>>> voting_betas; /**< Voting times as functions of the number of trees, per depth and vote threshold. */
+
+  /** Returns true if the model is not fitted. */
+  bool empty() const {
+    return voting_betas.empty();
+  }
+
+  /** Returns the maximum depth of the trees covered by the model. */
+  int depth_max() const {
+    return depth_min + static_cast<int>(voting_betas.size()) - 1;
+  }
+
+  /**
+  * Returns an identifier of the CPU: its brand string, if it can be read,
+  * and the level of the kernels in use; see Mrpt_Simd.
+  */
+  static std::string cpu_id() {
+    std::string id;
+#ifdef MRPT_SIMD_DISPATCH
+    unsigned int regs[12];
+    if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004) {
+      for (unsigned int i = 0; i < 3; ++i)
+        __get_cpuid(0x80000002 + i, &regs[4 * i], &regs[4 * i + 1], &regs[4 * i + 2], &regs[4 * i + 3]);
+      id.assign(reinterpret_cast<const char *>(regs), sizeof regs);
+      id.erase(std::find(id.begin(), id.end(), '\0'), id.end());
+      id.erase(0, id.find_first_not_of(' '));
+    }
+#endif
+    const char *levels[] = {"scalar", "sse4", "avx2", "avx512"};
+    return id + "/" + levels[Mrpt_Simd::current()];
+  }
+
+  /**
+  * Saves the model to a file.
+  *
+  * @param path filepath to the output file.
+  * @return true if saving succeeded, false otherwise (also if the CPU
+  * identifier is longer than 256 characters).
+  */
+  bool save(const char *path) const {
+    if (cpu.size() > static_cast<std::size_t>(cpu_length_max))
+      return false;
+
+    FILE *fd;
+    if ((fd = fopen(path, "wb")) == NULL)
+      return false;
+
+    int magic = file_magic, version = file_version;
+    int p = projection, cpu_length = cpu.size(), n_depths = voting_betas.size();
+    fwrite(&magic, sizeof(int), 1, fd);
+    fwrite(&version, sizeof(int), 1, fd);
+    fwrite(&dim, sizeof(int), 1, fd);
+    fwrite(&density, sizeof(float), 1, fd);
+    fwrite(&p, sizeof(int), 1, fd);
+    fwrite(&depth_min, sizeof(int), 1, fd);
+    fwrite(&cpu_length, sizeof(int), 1, fd);
+    fwrite(cpu.data(), sizeof(char), cpu_length, fd);
+    fwrite(&n_threads, sizeof(int), 1, fd);
+    write_beta(projection_beta, fd);
+    write_beta(exact_beta, fd);
+
+    fwrite(&n_depths, sizeof(int), 1, fd);
+    for (const auto &betas : voting_betas) {
+      int n_betas = betas.size();
+      fwrite(&n_betas, sizeof(int), 1, fd);
+      for (const auto &b : betas) {
+        fwrite(&b.first, sizeof(int), 1, fd);
+        write_beta(b.second, fd);
+      }
+    }
+
+    fclose(fd);
+    return true;
+  }
+
+  /**
+  * Loads a model from a file.
+  *
+  * @param path filepath to the model file.
+  * @return true if loading succeeded, false otherwise (also if the file is
+  * not a model file saved by save() or its format version is unknown).
+  */
+  bool load(const char *path) {
+    FILE *fd;
+    if ((fd = fopen(path, "rb")) == NULL)
+      return false;
+
+    int magic, version, p, cpu_length, n_depths;
+    bool ok = fread(&magic, sizeof(int), 1, fd) == 1 && magic == file_magic &&
+              fread(&version, sizeof(int), 1, fd) == 1 && version == file_version &&
+              fread(&dim, sizeof(int), 1, fd) == 1 && fread(&density, sizeof(float), 1, fd) == 1 &&
+              fread(&p, sizeof(int), 1, fd) == 1 && p >= Mrpt_Options::gaussian_projection &&
+              p <= Mrpt_Options::int8_projection && fread(&depth_min, sizeof(int), 1, fd) == 1 &&
+              fread(&cpu_length, sizeof(int), 1, fd) == 1 && cpu_length >= 0 && cpu_length <= cpu_length_max;
+    projection = ok ? static_cast<Mrpt_Options::ptype>(p) : Mrpt_Options::gaussian_projection;
+
+    cpu.assign(ok ? cpu_length : 0, '\0');
+    ok = ok && fread(&cpu[0], sizeof(char), cpu_length, fd) == static_cast<std::size_t>(cpu_length) &&
+         fread(&n_threads, sizeof(int), 1, fd) == 1 && read_beta(projection_beta, fd) && read_beta(exact_beta, fd) &&
+         fread(&n_depths, sizeof(int), 1, fd) == 1 && n_depths >= 0;
+
+    voting_betas.assign(ok ? n_depths : 0, std::map<int,std::pair<double,double>>());
+    for (auto &betas : voting_betas) {
+      int n_betas;
+      ok = ok && fread(&n_betas, sizeof(int), 1, fd) == 1 && n_betas >= 0;
+      for (int i = 0; ok && i < n_betas; ++i) {
+        int v;
+        ok = fread(&v, sizeof(int), 1, fd) == 1 && read_beta(betas[v], fd);
+      }
+    }
+
+    fclose(fd);
+    if (!ok)
+      voting_betas.clear();
+    return ok;
+  }
+
+ private:
+  static const int file_magic = 0x4350524d; // first bytes ("MRPC") of a cost model file
+  static const int file_version = 1; // format version of the cost model files written by save()
+  static const int cpu_length_max = 256; // maximum length of the CPU identifier in a cost model file
+
+  static void write_beta(const std::pair<double,double> &beta, FILE *fd) {
+    fwrite(&beta.first, sizeof(double), 1, fd);
+    fwrite(&beta.second, sizeof(double), 1, fd);
+  }
+
+  static bool read_beta(std::pair<double,double> &beta, FILE *fd) {
+    return fread(&beta.first, sizeof(double), 1, fd) == 1 && fread(&beta.second, sizeof(double), 1, fd) == 1;
+  }
+};
+
+/**
+* Options of the autotuning, passed as the last argument of the versions of
+* grow() and grow_autotune() which build an autotuned index. The default
+* values minimize the mean query time of single queries, and set no limit
+* on the memory of the index.
+*/
+struct Mrpt_Options::Autotuning {
+  /**
+  * Cost model of the hardware used to estimate the query times; an empty
+  * model (default) fits it by timing queries, and a model saved from an
+  * earlier autotuning on the same CPU skips the timing. See Mrpt_Cost_Model.
+  */
+  Mrpt_Cost_Model cost_model;
+
+  /**
+  * Quantile of the query times minimized by the autotuning, on the interval
+  * (0,1], for instance 0.99 for the 99th percentile. The query time of each
+  * test query is estimated from its own candidate set size, so that the
+  * parameters are chosen for the tail latency instead of the mean; the
+  * default value -1 minimizes the mean query time. The estimated quantile
+  * is reported in `estimated_qtime_quantile` of the parameters. For each
+  * depth, vote threshold and number of trees, the autotuning keeps the
+  * candidate set sizes of the test queries on the nearer side of the
+  * quantile (at most half of them, and only about 1% of them for 0.99);
+  * grow() throws std::out_of_range if they would take more than 1 GiB.
+  */
+  double latency_quantile = -1.0;
+
+  /**
+  * Maximum memory in bytes of the index, without the data set; only the
+  * parameters whose estimated memory (`estimated_bytes`) fits in the budget
+  * are considered, so that the index chosen for a recall level is the
+  * fastest one which fits. The default value 0 sets no limit.
+  */
+  int64_t memory_budget = 0;
+
+  /**
+  * Number of threads querying the index concurrently in production. The
+  * query times are measured while this many threads run the timed
+  * operations at the same time, so that the contention for the memory
+  * bandwidth is included, and minimizing them maximizes the throughput
+  * (`estimated_qps`) of all the threads. A value -1 chooses among 1, 2, 4,
+  * ... threads up to omp_get_max_threads() the number giving the highest
+  * throughput at the target recall level (or at 0.9 if it is not set). The
+  * default value 1 measures the latency of single queries.
+  */
+  int load_threads = 1;
+
+  /**
+  * Maximum number of trees if the target recall is not reached by the
+  * trees_max trees: the number of trees is then doubled (up to trees_limit)
+  * by growing more trees onto the index until the target is reached. Only
+  * the votes of the new trees are counted, and the fitted query times are
+  * reused. The default value 0 grows only trees_max trees. Used only if the
+  * target recall is set.
+  */
+  int trees_limit = 0;
+
+  /**
+  * Number of the fastest parameters of the frontier reaching the target
+  * recall that are validated by querying the test queries using each of
+  * them; the parameters of the smallest measured query time (or its
+  * latency_quantile quantile) are then chosen instead of those of the
+  * smallest estimated query time. If none of them reaches the target
+  * recall on the test queries, the parameters of the highest measured
+  * recall are chosen. The estimated and the measured query
+  * times and recalls are reported, and stored as `measured_qtime` and
+  * `measured_recall` of the chosen parameters. The default value 0
+  * validates no parameters. Used only if the target recall is set.
+  */
+  int n_validated = 0;
+
+  /**
+  * Maximum half-width of the 95% confidence interval of the estimated
+  * recall at the target recall level (at 0.9 if it is not set, of the
+  * largest value of k). If it is positive, the number of test queries
+  * given to grow_autotune() is the initial one, and the test set is doubled
+  * by sampling more queries from the training set until the half-width
+  * (computed from the recalls of the single test queries) is at most
+  * recall_tolerance or all the data points are test queries. The trees and
+  * the fitted query times are reused, and only the exact search and the
+  * vote counting are done for the new queries. The default value 0 uses
+  * the initial test queries. Used only by grow_autotune().
+  */
+  double recall_tolerance = 0.0;
+
+  /**
+  * Time limit in seconds for adding test queries: the test set is not
+  * doubled if the round doing it is estimated (as twice the time of the
+  * previous round) to end after the limit. The default value 0 sets no
+  * limit. Used only by grow_autotune().
+  */
+  double test_time_limit = 0.0;
 };
 
-class Mrpt {
+/**
+* An MRPT index for a data set whose components are stored as Scalar: float,
+* 8-bit integers (uint8_t or int8_t) such as SIFT descriptors or image
+* pixels, which are then indexed and searched without converting them to
+* floats, or 16-bit floats (Mrpt_Float16 or Mrpt_BFloat16) such as neural
+* embeddings, which halve the memory of the data set and the bandwidth of
+* the exact search. The queries are always given as floats, and the
+* distances are returned as floats; see Mrpt for the index of float data.
+*/
+template <typename Scalar = float>
+class Mrpt_Index : public Mrpt_Options {
  public:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Data_Matrix; /**< Type of the data matrix. */
+
     /** @name Constructors
     * The constructor does not actually build the index. The building is done
     * by the function grow() which has to be called before queries can be made.
     * There are two different versions of the constructor which differ only
     * by the type of the input data. The first version takes the data set
-    * as `Ref` to `MatrixXf`, which means that the argument
+    * as `Ref` to `Data_Matrix` (`MatrixXf` for float data), which means that the argument
     * can be either `MatrixXf` or `Map<MatrixXf>` (also certain blocks of `MatrixXf`
     * may be accepted, see [Eigen::Ref](https://eigen.tuxfamily.org/dox/TopicFunctionTakingEigenTypes.html)
-    * for more information). The second version takes a float
+    * for more information). The second version takes a
     * pointer to an array containing the data set, and the dimension and
     * the sample size of the data. There are also corresponding versions
     * of all the member functions which take input data. In all cases the data
@@ -46,19 +503,19 @@ class Mrpt {
     /**
     * @param X_ Eigen ref to the data set, stored as one data point per column
     */
-    Mrpt(const Eigen::Ref<const Eigen::MatrixXf> &X_) :
-        X(Eigen::Map<const Eigen::MatrixXf>(X_.data(), X_.rows(), X_.cols())),
+    Mrpt_Index(const Eigen::Ref<const Data_Matrix> &X_) :
+        X(Eigen::Map<const Data_Matrix>(X_.data(), X_.rows(), X_.cols())),
         n_samples(X_.cols()),
         dim(X_.rows()) {}
 
     /**
-    * @param X_ a float array containing the data set with each data point
+    * @param X_ an array containing the data set with each data point
     * stored contiguously in memory
     * @param dim_ dimension of the data
     * @param n_samples_ number of data points
     */
-    Mrpt(const float *X_, int dim_, int n_samples_) :
-        X(Eigen::Map<const Eigen::MatrixXf>(X_, dim_, n_samples_)),
+    Mrpt_Index(const Scalar *X_, int dim_, int n_samples_) :
+        X(Eigen::Map<const Data_Matrix>(X_, dim_, n_samples_)),
         n_samples(n_samples_),
         dim(dim_) {}
 
@@ -80,8 +537,25 @@ class Mrpt {
     * \f$ 1 / \sqrt{d} \f$, where \f$d\f$ is the dimension of the data
     * @param seed seed given to a rng when generating random vectors;
     * a default value 0 initializes the rng randomly with std::random_device
+    * @param sample_size number of data points sampled for each tree to
+    * estimate the split points; after the split points are estimated, all
+    * the data points are routed into the leaves in a single pass. Leaf sizes
+    * are then only approximately equal. A default value 0 computes exact
+    * medians using all the data points.
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; the default value draws them from the standard normal
+    * distribution, `sign_projection` sets them to +1 or -1,
+    * `hadamard_projection` uses structured random vectors, and
+    * `int8_projection` quantizes the Gaussian random vectors; the data must
+    * then have integer components on [0, 255].
+    * @param pool_size_ number of random vectors shared by all the trees; each
+    * tree draws the random vectors of its levels from this pool in a random
+    * order, so that a query is projected only onto the pool. A default value
+    * 0 draws separate random vectors for each tree; otherwise the pool size
+    * must be at least depth_.
     */
-    void grow(int n_trees_, int depth_, float density_ = -1.0, int seed = 0) {
+    void grow(int n_trees_, int depth_, float density_ = -1.0, int seed = 0, int sample_size = 0,
+              ptype projection_ = gaussian_projection, int pool_size_ = 0) {
 
       if (!empty()) {
         throw std::logic_error("The index has already been grown.");
@@ -99,6 +573,18 @@ class Mrpt {
         throw std::out_of_range("The density must be on the interval (0,1].");
       }
 
+      if (sample_size < 0 || (sample_size > 0 && sample_size < (1 << depth_))) {
+        throw std::out_of_range("The sample size must be either 0 or at least 2^depth.");
+      }
+
+      if (projection_ == int8_projection && !is_uint8_valued(X)) {
+        throw std::invalid_argument("Quantized projections require data with integer components on [0, 255].");
+      }
+
+      if (pool_size_ < 0 || (pool_size_ > 0 && pool_size_ < depth_)) {
+        throw std::out_of_range("The pool size must be either 0 or at least depth.");
+      }
+
       n_trees = n_trees_;
       depth = depth_;
       n_pool = n_trees_ * depth_;
@@ -110,8 +596,21 @@ class Mrpt {
         density = density_;
       }
 
-      density < 1 ? build_sparse_random_matrix(sparse_random_matrix, n_pool, dim, density, seed) :
-                    build_dense_random_matrix(dense_random_matrix, n_pool, dim, seed);
+      if (!seed) {
+        std::random_device rd;
+        while (!seed) seed = rd();
+      }
+      random_seed = seed;
+      matrix_depth = depth;
+      projection = projection_;
+      pool_size = pool_size_;
+
+      build_random_matrix();
+
+      if (pool_size)
+        build_pool_directions(pool_directions, n_trees, depth, pool_size, seed);
+      else
+        pool_directions.clear();
 
       split_points = Eigen::MatrixXf(n_array, n_trees);
       tree_leaves = std::vector<std::vector<int>>(n_trees);
@@ -119,21 +618,8 @@ class Mrpt {
       count_first_leaf_indices_all(leaf_first_indices_all, n_samples, depth);
       leaf_first_indices = leaf_first_indices_all[depth];
 
-      #pragma omp parallel for
-      for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
-        Eigen::MatrixXf tree_projections;
-
-        if (density < 1)
-          tree_projections.noalias() = sparse_random_matrix.middleRows(n_tree * depth, depth) * X;
-        else
-          tree_projections.noalias() = dense_random_matrix.middleRows(n_tree * depth, depth) * X;
-
-        tree_leaves[n_tree] = std::vector<int>(n_samples);
-        std::vector<int> &indices = tree_leaves[n_tree];
-        std::iota(indices.begin(), indices.end(), 0);
-
-        grow_subtree(indices.begin(), indices.end(), 0, 0, n_tree, tree_projections);
-      }
+      leaf_offsets.clear();
+      grow_trees(0, sample_size);
     }
 
     /**@}*/
@@ -170,19 +656,26 @@ class Mrpt {
     * \f$ \mathrm{max}(\lfloor \mathrm{trees\_max} / 10 \rfloor, 10) \f$
     * @param density expected proportion of non-zero components in the random vectors;
     * default value -1.0 sets this to \f$ 1 / \sqrt{d} \f$, where \f$ d\f$ is
-    * the dimension of data
+    * the dimension of data. A value 0 chooses it by
+    * autotuning; see grow().
     * @param seed seed given to a rng when generating random vectors;
     * a default value 0 initializes the rng randomly with std::random_device
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow(). A value -1 chooses it by autotuning; see grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
     */
     void grow(double target_recall, const Eigen::Ref<const Eigen::MatrixXf> &Q, int k_, int trees_max = -1,
               int depth_max = -1, int depth_min_ = -1, int votes_max_ = -1,
-              float density = -1.0, int seed = 0) {
-      if (target_recall < 0.0 - epsilon || target_recall > 1.0 + epsilon) {
-        throw std::out_of_range("Target recall must be on the interval [0,1].");
+              float density = -1.0, int seed = 0, ptype projection_ = gaussian_projection,
+              int pool_size_ = 0, const Autotuning &options = {}) {
+      if (Q.rows() != dim) {
+        throw std::invalid_argument("Dimensions of the data and the validation set do not match.");
       }
 
-      grow(Q, k_, trees_max, depth_max, depth_min_, votes_max_, density, seed);
-      prune(target_recall);
+      grow(target_recall, Q.data(), Q.cols(), k_, trees_max, depth_max, depth_min_, votes_max_, density,
+           seed, {}, projection_, pool_size_, options);
     }
 
     /** Build an autotuned index.
@@ -207,21 +700,73 @@ class Mrpt {
     * \f$ \mathrm{max}(\lfloor \mathrm{trees\_max} / 10 \rfloor, 10) \f$
     * @param density expected proportion of non-zero components in the random vectors;
     * default value -1.0 sets this to \f$ 1 / \sqrt{d} \f$, where \f$ d\f$ is
-    * the dimension of data
+    * the dimension of data. A value 0 chooses it by
+    * autotuning; see grow().
     * @param seed seed given to a rng when generating random vectors;
     * a default value 0 initializes the rng randomly with std::random_device
     * @param indices_test parameter used by the version which uses no
     * separate test set, leave empty.
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow(). A value -1 chooses it by autotuning; see grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
     */
     void grow(double target_recall, const float *Q, int n_test, int k_, int trees_max = -1,
               int depth_max = -1, int depth_min_ = -1, int votes_max_ = -1,
-              float density = -1.0, int seed = 0, const std::vector<int> &indices_test = {}) {
+              float density = -1.0, int seed = 0, const std::vector<int> &indices_test = {},
+              ptype projection_ = gaussian_projection, int pool_size_ = 0,
+              const Autotuning &options = {}) {
+      if (target_recall < 0.0 - epsilon || target_recall > 1.0 + epsilon) {
+        throw std::out_of_range("Target recall must be on the interval [0,1].");
+      }
+
+      grow_autotuned(target_recall, Q, n_test, {k_}, trees_max, depth_max, depth_min_, votes_max_, density,
+                     seed, indices_test, projection_, pool_size_, options, {});
+    }
+
+    /** Build an autotuned index using precomputed nearest neighbors of the
+    * test queries, so that the exact search of the autotuning is skipped.
+    *
+    * @param target_recall target recall level; on the range [0,1]
+    * @param Q Eigen ref to the test queries (col = data point)
+    * @param exact_ Eigen ref to the indices of the nearest neighbors of the
+    * test queries (col = test query), for example read from a ground truth
+    * file. The first k_ rows are the indices of the k_ nearest neighbors;
+    * the rest of the rows, if any, are ignored.
+    * @param k_ number of nearest neighbors searched for
+    * @param trees_max number of trees grown; see grow().
+    * @param depth_max maximum depth of trees considered when searching for
+    * optimal parameters; see grow().
+    * @param depth_min_ minimum depth of trees considered when searching for
+    * optimal parameters; see grow().
+    * @param votes_max_ maximum number of votes considered when searching for
+    * optimal parameters; see grow().
+    * @param density expected proportion of non-zero components in the random
+    * vectors; see grow().
+    * @param seed seed given to a rng when generating random vectors;
+    * see grow().
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
+    */
+    void grow(double target_recall, const Eigen::Ref<const Eigen::MatrixXf> &Q,
+              const Eigen::Ref<const Eigen::MatrixXi> &exact_, int k_, int trees_max = -1,
+              int depth_max = -1, int depth_min_ = -1, int votes_max_ = -1,
+              float density = -1.0, int seed = 0, ptype projection_ = gaussian_projection,
+              int pool_size_ = 0, const Autotuning &options = {}) {
       if (target_recall < 0.0 - epsilon || target_recall > 1.0 + epsilon) {
         throw std::out_of_range("Target recall must be on the interval [0,1].");
       }
 
-      grow(Q, n_test, k_, trees_max, depth_max, depth_min_, votes_max_, density, seed, indices_test);
-      prune(target_recall);
+      if (Q.rows() != dim) {
+        throw std::invalid_argument("Dimensions of the data and the validation set do not match.");
+      }
+
+      grow_autotuned(target_recall, Q.data(), Q.cols(), {k_}, trees_max, depth_max, depth_min_, votes_max_,
+                     density, seed, {}, projection_, pool_size_, options, exact_);
     }
 
     /** Build an autotuned index sampling test queries from the training set.
@@ -245,23 +790,35 @@ class Mrpt {
     * \f$ \mathrm{max}(\lfloor \mathrm{trees\_max} / 10 \rfloor, 10) \f$
     * @param density_ expected proportion of non-zero components in the random vectors;
     * default value -1.0 sets this to \f$ 1 / \sqrt{d} \f$, where \f$ d\f$ is
-    * the dimension of data
+    * the dimension of data. A value 0 chooses it by
+    * autotuning; see grow().
     * @param seed seed given to a rng when generating random vectors;
     * a default value 0 initializes the rng randomly with std::random_device
     * @param n_test number of test queries sampled from the training set.
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow(). A value -1 chooses it by autotuning; see grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
     */
     void grow_autotune(double target_recall, int k_, int trees_max = -1, int depth_max = -1, int depth_min_ = -1,
-                       int votes_max_ = -1, float density_ = -1.0, int seed = 0, int n_test = 100) {
+                       int votes_max_ = -1, float density_ = -1.0, int seed = 0, int n_test = 100,
+                       ptype projection_ = gaussian_projection, int pool_size_ = 0,
+                       const Autotuning &options = {}) {
+      if (target_recall < 0.0 - epsilon || target_recall > 1.0 + epsilon) {
+        throw std::out_of_range("Target recall must be on the interval [0,1].");
+      }
+
       if (n_test < 1) {
         throw std::out_of_range("Test set size must be > 0.");
       }
 
       n_test = n_test > n_samples ? n_samples : n_test;
-      std::vector<int> indices_test(sample_indices(n_test, seed));
-      const Eigen::MatrixXf Q(subset(indices_test));
+      std::vector<int> indices_test(sample_indices(options.recall_tolerance > 0 ? n_samples : n_test, seed));
+      const Eigen::MatrixXf Q(subset(std::vector<int>(indices_test.begin(), indices_test.begin() + n_test)));
 
-      grow(target_recall, Q.data(), Q.cols(), k_, trees_max,
-        depth_max, depth_min_, votes_max_, density_, seed, indices_test);
+      grow_autotuned(target_recall, Q.data(), n_test, {k_}, trees_max, depth_max, depth_min_, votes_max_, density_,
+                     seed, indices_test, projection_, pool_size_, options, {});
     }
 
     /**
@@ -296,6 +853,31 @@ class Mrpt {
       return index_type == autotuned;
     }
 
+    /**
+    * Get the cost model of the hardware fitted when the index was autotuned;
+    * it can be saved and passed to grow() to autotune later indices of the
+    * same kind of data set on the same CPU without timing the queries.
+    *
+    * @return the cost model of the index
+    */
+    Mrpt_Cost_Model cost_model() const {
+      if (beta_voting.empty()) {
+        throw std::logic_error("The index has not been autotuned in this process.");
+      }
+
+      Mrpt_Cost_Model model;
+      model.dim = dim;
+      model.density = density;
+      model.projection = projection;
+      model.depth_min = depth_min;
+      model.cpu = Mrpt_Cost_Model::cpu_id();
+      model.n_threads = load_threads;
+      model.projection_beta = beta_projection;
+      model.exact_beta = beta_exact;
+      model.voting_betas = beta_voting;
+      return model;
+    }
+
     /**@}*/
 
     /** @name Autotuned index building without preset recall level
@@ -331,147 +913,28 @@ class Mrpt {
     * \f$ \mathrm{max}(\lfloor \mathrm{trees\_max} / 10 \rfloor, 10) \f$
     * @param density_ expected proportion of non-zero components in the random vectors;
     * default value -1.0 sets this to \f$ 1 / \sqrt{d} \f$, where \f$ d\f$ is
-    * the dimension of data
+    * the dimension of data. A value 0 chooses it by autotuning an index for
+    * each of the densities \f$ 1 / (2 \sqrt{d}) \f$, \f$ 1 / \sqrt{d} \f$,
+    * \f$ 2 / \sqrt{d} \f$ and \f$ 4 / \sqrt{d} \f$ below 1 and for dense
+    * random vectors; the ground truth and the voting and exact search times
+    * are shared by the indices.
     * @param seed seed given to a rng when generating random vectors;
     * a default value 0 initializes the rng randomly with std::random_device
     * @param indices_test parameter used by the version which uses no
     * separate test set, leave empty.
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow(). A value -1 chooses it by autotuning an index for each of a few
+    * pool sizes (and without sharing), which multiplies the autotuning time.
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
     **/
     void grow(const float *data, int n_test, int k_, int trees_max = -1, int depth_max = -1,
               int depth_min_ = -1, int votes_max_ = -1, float density_ = -1.0, int seed = 0,
-              const std::vector<int> &indices_test = {}) {
-
-      if (!empty()) {
-        throw std::logic_error("The index has already been grown.");
-      }
-
-      if (k_ <= 0 || k_ > n_samples) {
-        throw std::out_of_range("k_ must belong to the set {1, ..., n}.");
-      }
-
-      if (trees_max < -1 || trees_max == 0) {
-        throw std::out_of_range("trees_max must be positive.");
-      }
-
-      if (depth_max < -1 || depth_max == 0 || depth_max > std::log2(n_samples)) {
-        throw std::out_of_range("depth_max must belong to the set {1, ... , log2(n)}.");
-      }
-
-      if (depth_min_ < -1 || depth_min_ == 0 || depth_min_ > depth_max) {
-        throw std::out_of_range("depth_min_ must belong to the set {1, ... , depth_max}");
-      }
-
-      if (votes_max_ < -1 || votes_max_ == 0 || votes_max_ > trees_max) {
-        throw std::out_of_range("votes_max_ must belong to the set {1, ... , trees_max}.");
-      }
-
-      if (density_ < -1.0001 || density_ > 1.0001 || (density_ > -0.9999 && density_ < -0.0001)) {
-        throw std::out_of_range("The density must be on the interval (0,1].");
-      }
-
-      if(n_samples < 101) {
-        throw std::out_of_range("Sample size must be at least 101 to autotune an index.");
-      }
-
-      if (trees_max == - 1) {
-        trees_max = std::min(std::sqrt(n_samples), 1000.0);
-      }
-
-      if (depth_min_ == -1) {
-        depth_min = std::max(static_cast<int>(std::log2(n_samples) - 11), 5);
-      } else {
-        depth_min = depth_min_;
-      }
-
-      if (depth_max == -1) {
-        depth_max = std::max(static_cast<int>(std::log2(n_samples) - 4), depth_min);
-      }
-
-      if (votes_max_ == -1) {
-        votes_max = std::max(trees_max / 10, std::min(trees_max, 10));
-      } else {
-        votes_max = votes_max_;
-      }
-
-      if (density_ < 0) {
-        density = 1.0 / std::sqrt(dim);
-      } else {
-        density = density_;
-      }
-
-      k = k_;
-      const Eigen::Map<const Eigen::MatrixXf> Q(data, dim, n_test);
-
-      double start_all = omp_get_wtime();
-      double start = omp_get_wtime();
-      grow(trees_max, depth_max, density, seed);
-      double end = omp_get_wtime();
-      std::cerr << "k: " << k << std::endl;
-      std::cerr << "trees_max: " << trees_max << std::endl;
-      std::cerr << "depth_min: " << depth_min << std::endl;
-      std::cerr << "depth_max: " << depth_max << std::endl;
-      std::cerr << "votes_max: " << votes_max << std::endl;
-      std::cerr << "density: " << density << std::endl;
-      std::cerr << std::endl;
-
-      std::cerr << "tree growing: " << end - start << " ";
-
-      start = omp_get_wtime();
-      Eigen::MatrixXi exact(k, n_test);
-      compute_exact(Q, exact, indices_test);
-      end = omp_get_wtime();
-      std::cerr << "exact search: " << end - start << " ";
-
-      start = omp_get_wtime();
-      std::vector<Eigen::MatrixXd> recalls(depth_max - depth_min + 1);
-      cs_sizes = std::vector<Eigen::MatrixXd>(depth_max - depth_min + 1);
-
-      for (int d = depth_min; d <= depth_max; ++d) {
-        recalls[d - depth_min] = Eigen::MatrixXd::Zero(votes_max, trees_max);
-        cs_sizes[d - depth_min] = Eigen::MatrixXd::Zero(votes_max, trees_max);
-      }
-
-      for (int i = 0; i < n_test; ++i) {
-        std::vector<Eigen::MatrixXd> recall_tmp(depth_max - depth_min + 1);
-        std::vector<Eigen::MatrixXd> cs_size_tmp(depth_max - depth_min + 1);
-
-        count_elected(Q.col(i), Eigen::Map<Eigen::VectorXi>(exact.data() + i * k, k),
-         votes_max, recall_tmp, cs_size_tmp);
-
-        for (int d = depth_min; d <= depth_max; ++d) {
-          recalls[d - depth_min] += recall_tmp[d - depth_min];
-          cs_sizes[d - depth_min] += cs_size_tmp[d - depth_min];
-        }
-      }
-
-      for (int d = depth_min; d <= depth_max; ++d) {
-        recalls[d - depth_min] /= (k * n_test);
-        cs_sizes[d - depth_min] /= n_test;
-      }
-      end = omp_get_wtime();
-      std::cerr << "vote counting: " << end - start << " ";
-
-      start = omp_get_wtime();
-      fit_times(Q);
-      end = omp_get_wtime();
-      std::cerr << "time fitting: " << end - start << " ";
-
-      start = omp_get_wtime();
-      std::set<Mrpt_Parameters,decltype(is_faster)*> pars = list_parameters(recalls);
-      end = omp_get_wtime();
-      std::cerr << "parameter finding: " << end - start << " ";
-
-      start = omp_get_wtime();
-      opt_pars = pareto_frontier(pars);
-      end = omp_get_wtime();
-      std::cerr << "pareto frontier: " << end - start << " ";
-      std::cerr << std::endl;
-
-      double end_all = omp_get_wtime();
-      std::cerr << "total autotuning time: " << end_all - start_all << std::endl << std::endl;
-
-      index_type = autotuned_unpruned;
-      par.k = k_;
+              const std::vector<int> &indices_test = {}, ptype projection_ = gaussian_projection,
+              int pool_size_ = 0, const Autotuning &options = {}) {
+      grow_autotuned(-1.0, data, n_test, {k_}, trees_max, depth_max, depth_min_, votes_max_, density_, seed,
+                     indices_test, projection_, pool_size_, options, {});
     }
 
     /** Build an autotuned index without prespecifying a recall level.
@@ -493,18 +956,62 @@ class Mrpt {
     * \f$ \mathrm{max}(\lfloor \mathrm{trees\_max} / 10 \rfloor, 10) \f$
     * @param density_ expected proportion of non-zero components of random vectors;
     * default value -1.0 sets this to \f$ 1 / \sqrt{d} \f$, where \f$ d\f$ is
-    * the dimension of data
+    * the dimension of data. A value 0 chooses it by
+    * autotuning; see grow().
     * @param seed seed given to a rng when generating random vectors;
     * a default value 0 initializes the rng randomly with std::random_device
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow(). A value -1 chooses it by autotuning; see grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
     */
     void grow(const Eigen::Ref<const Eigen::MatrixXf> &Q, int k_, int trees_max = -1, int depth_max = -1,
-              int depth_min_ = -1, int votes_max_ = -1, float density_ = -1.0, int seed = 0) {
+              int depth_min_ = -1, int votes_max_ = -1, float density_ = -1.0, int seed = 0,
+              ptype projection_ = gaussian_projection, int pool_size_ = 0,
+              const Autotuning &options = {}) {
+      if (Q.rows() != dim) {
+        throw std::invalid_argument("Dimensions of the data and the validation set do not match.");
+      }
+
+      grow(Q.data(), Q.cols(), k_, trees_max, depth_max, depth_min_, votes_max_, density_, seed, {},
+           projection_, pool_size_, options);
+    }
+
+    /** Build an autotuned index without prespecifying a recall level using
+    * precomputed nearest neighbors of the test queries, so that the exact
+    * search of the autotuning is skipped.
+    *
+    * @param Q Eigen ref to the test queries.
+    * @param exact_ Eigen ref to the indices of the nearest neighbors of the
+    * test queries; see grow().
+    * @param k_ number of nearest neighbors searched for
+    * @param trees_max number of trees grown; see grow().
+    * @param depth_max depth of trees grown; see grow().
+    * @param depth_min_ minimum depth of trees considered when searching for
+    * optimal parameters; see grow().
+    * @param votes_max_ maximum number of votes considered when searching for
+    * optimal parameters; see grow().
+    * @param density_ expected proportion of non-zero components of random
+    * vectors; see grow().
+    * @param seed seed given to a rng when generating random vectors;
+    * see grow().
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
+    */
+    void grow(const Eigen::Ref<const Eigen::MatrixXf> &Q, const Eigen::Ref<const Eigen::MatrixXi> &exact_,
+              int k_, int trees_max = -1, int depth_max = -1, int depth_min_ = -1, int votes_max_ = -1,
+              float density_ = -1.0, int seed = 0, ptype projection_ = gaussian_projection,
+              int pool_size_ = 0, const Autotuning &options = {}) {
       if (Q.rows() != dim) {
         throw std::invalid_argument("Dimensions of the data and the validation set do not match.");
       }
 
-      grow(Q.data(), Q.cols(), k_, trees_max,
-        depth_max, depth_min_, votes_max_, density_, seed);
+      grow_autotuned(-1.0, Q.data(), Q.cols(), {k_}, trees_max, depth_max, depth_min_, votes_max_, density_,
+                     seed, {}, projection_, pool_size_, options, exact_);
     }
 
     /** Build an autotuned index sampling test queries from the training set
@@ -526,23 +1033,184 @@ class Mrpt {
     * \f$ \mathrm{max}(\lfloor \mathrm{trees\_max} / 10 \rfloor, 10) \f$
     * @param density_ expected proportion of non-zero components of random vectors;
     * default value -1.0 sets this to \f$ 1 / \sqrt{d} \f$, where \f$ d\f$ is
-    * the dimension of data
+    * the dimension of data. A value 0 chooses it by
+    * autotuning; see grow().
     * @param seed seed given to a rng when generating random vectors;
     * a default value 0 initializes the rng randomly with std::random_device
     * @param n_test number of test queries sampled from the training set.
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow(). A value -1 chooses it by autotuning; see grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
     */
     void grow_autotune(int k_, int trees_max = -1, int depth_max = -1, int depth_min_ = -1,
-                    int votes_max_ = -1, float density_ = -1.0, int seed = 0, int n_test = 100) {
+                    int votes_max_ = -1, float density_ = -1.0, int seed = 0, int n_test = 100,
+                    ptype projection_ = gaussian_projection, int pool_size_ = 0,
+                    const Autotuning &options = {}) {
+      if (n_test < 1) {
+        throw std::out_of_range("Test set size must be > 0.");
+      }
+
+      n_test = n_test > n_samples ? n_samples : n_test;
+      std::vector<int> indices_test(sample_indices(options.recall_tolerance > 0 ? n_samples : n_test, seed));
+      const Eigen::MatrixXf Q(subset(std::vector<int>(indices_test.begin(), indices_test.begin() + n_test)));
+
+      grow_autotuned(-1.0, Q.data(), n_test, {k_}, trees_max, depth_max, depth_min_, votes_max_, density_, seed,
+                     indices_test, projection_, pool_size_, options, {});
+    }
+
+    /** Build an autotuned index for several values of k without
+    * prespecifying a recall level. The trees, the exact search of the test
+    * queries (done once for the largest value of k) and the query time
+    * models are shared by all the values of k, the recalls of all of them are
+    * counted in the same pass over the test queries, and a pareto frontier
+    * is found for each of them. The value of k is chosen when an index is
+    * created by subset(), and the frontiers are retrieved by
+    * optimal_parameters().
+    *
+    * @param data a float array containing the test queries.
+    * @param n_test number of test queries
+    * @param ks_ values of the number of nearest neighbors searched for; each
+    * in the set \f$\{1, \dots, n\}\f$, where \f$n \f$ is the number of
+    * data points
+    * @param trees_max number of trees grown; see grow().
+    * @param depth_max depth of trees grown; see grow().
+    * @param depth_min_ minimum depth of trees considered when searching for
+    * optimal parameters; see grow().
+    * @param votes_max_ maximum number of votes considered when searching for
+    * optimal parameters; see grow().
+    * @param density_ expected proportion of non-zero components of random
+    * vectors; see grow().
+    * @param seed seed given to a rng when generating random vectors;
+    * see grow().
+    * @param indices_test parameter used by the version which uses no
+    * separate test set, leave empty.
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
+    */
+    void grow(const float *data, int n_test, const std::vector<int> &ks_, int trees_max = -1,
+              int depth_max = -1, int depth_min_ = -1, int votes_max_ = -1, float density_ = -1.0,
+              int seed = 0, const std::vector<int> &indices_test = {}, ptype projection_ = gaussian_projection,
+              int pool_size_ = 0, const Autotuning &options = {}) {
+      grow_autotuned(-1.0, data, n_test, ks_, trees_max, depth_max, depth_min_, votes_max_, density_, seed,
+                     indices_test, projection_, pool_size_, options, {});
+    }
+
+    /** Build an autotuned index for several values of k without
+    * prespecifying a recall level; see grow().
+    *
+    * @param Q Eigen ref to the test queries.
+    * @param ks_ values of the number of nearest neighbors searched for; see
+    * grow().
+    * @param trees_max number of trees grown; see grow().
+    * @param depth_max depth of trees grown; see grow().
+    * @param depth_min_ minimum depth of trees considered when searching for
+    * optimal parameters; see grow().
+    * @param votes_max_ maximum number of votes considered when searching for
+    * optimal parameters; see grow().
+    * @param density_ expected proportion of non-zero components of random
+    * vectors; see grow().
+    * @param seed seed given to a rng when generating random vectors;
+    * see grow().
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
+    */
+    void grow(const Eigen::Ref<const Eigen::MatrixXf> &Q, const std::vector<int> &ks_, int trees_max = -1,
+              int depth_max = -1, int depth_min_ = -1, int votes_max_ = -1, float density_ = -1.0,
+              int seed = 0, ptype projection_ = gaussian_projection, int pool_size_ = 0,
+              const Autotuning &options = {}) {
+      if (Q.rows() != dim) {
+        throw std::invalid_argument("Dimensions of the data and the validation set do not match.");
+      }
+
+      grow(Q.data(), Q.cols(), ks_, trees_max, depth_max, depth_min_, votes_max_, density_, seed, {},
+           projection_, pool_size_, options);
+    }
+
+    /** Build an autotuned index for several values of k without
+    * prespecifying a recall level using precomputed nearest neighbors of the
+    * test queries; see grow().
+    *
+    * @param Q Eigen ref to the test queries.
+    * @param exact_ Eigen ref to the indices of the nearest neighbors of the
+    * test queries (col = test query). The first rows are the indices of the
+    * nearest neighbors in increasing order of distance, at least as many
+    * as the largest value of k.
+    * @param ks_ values of the number of nearest neighbors searched for; see
+    * grow().
+    * @param trees_max number of trees grown; see grow().
+    * @param depth_max depth of trees grown; see grow().
+    * @param depth_min_ minimum depth of trees considered when searching for
+    * optimal parameters; see grow().
+    * @param votes_max_ maximum number of votes considered when searching for
+    * optimal parameters; see grow().
+    * @param density_ expected proportion of non-zero components of random
+    * vectors; see grow().
+    * @param seed seed given to a rng when generating random vectors;
+    * see grow().
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
+    */
+    void grow(const Eigen::Ref<const Eigen::MatrixXf> &Q, const Eigen::Ref<const Eigen::MatrixXi> &exact_,
+              const std::vector<int> &ks_, int trees_max = -1, int depth_max = -1, int depth_min_ = -1,
+              int votes_max_ = -1, float density_ = -1.0, int seed = 0,
+              ptype projection_ = gaussian_projection, int pool_size_ = 0,
+              const Autotuning &options = {}) {
+      if (Q.rows() != dim) {
+        throw std::invalid_argument("Dimensions of the data and the validation set do not match.");
+      }
+
+      grow_autotuned(-1.0, Q.data(), Q.cols(), ks_, trees_max, depth_max, depth_min_, votes_max_, density_,
+                     seed, {}, projection_, pool_size_, options, exact_);
+    }
+
+    /** Build an autotuned index for several values of k sampling test
+    * queries from the training set and without prespecifying a recall
+    * level; see grow().
+    *
+    * @param ks_ values of the number of nearest neighbors searched for; see
+    * grow().
+    * @param trees_max number of trees grown; see grow().
+    * @param depth_max depth of trees grown; see grow().
+    * @param depth_min_ minimum depth of trees considered when searching for
+    * optimal parameters; see grow().
+    * @param votes_max_ maximum number of votes considered when searching for
+    * optimal parameters; see grow().
+    * @param density_ expected proportion of non-zero components of random
+    * vectors; see grow().
+    * @param seed seed given to a rng when generating random vectors;
+    * see grow().
+    * @param n_test number of test queries sampled from the training set.
+    * @param projection_ distribution of the non-zero components of the random
+    * vectors; see grow().
+    * @param pool_size_ number of random vectors shared by the trees; see
+    * grow().
+    * @param options options of the autotuning; see Mrpt_Options::Autotuning.
+    */
+    void grow_autotune(const std::vector<int> &ks_, int trees_max = -1, int depth_max = -1, int depth_min_ = -1,
+                       int votes_max_ = -1, float density_ = -1.0, int seed = 0, int n_test = 100,
+                       ptype projection_ = gaussian_projection, int pool_size_ = 0,
+                       const Autotuning &options = {}) {
       if (n_test < 1) {
         throw std::out_of_range("Test set size must be > 0.");
       }
 
       n_test = n_test > n_samples ? n_samples : n_test;
-      std::vector<int> indices_test(sample_indices(n_test, seed));
-      const Eigen::MatrixXf Q(subset(indices_test));
+      std::vector<int> indices_test(sample_indices(options.recall_tolerance > 0 ? n_samples : n_test, seed));
+      const Eigen::MatrixXf Q(subset(std::vector<int>(indices_test.begin(), indices_test.begin() + n_test)));
 
-      grow(Q.data(), Q.cols(), k_, trees_max,
-        depth_max, depth_min_, votes_max_, density_, seed, indices_test);
+      grow_autotuned(-1.0, Q.data(), n_test, ks_, trees_max, depth_max, depth_min_, votes_max_, density_, seed,
+                     indices_test, projection_, pool_size_, options, {});
     }
 
     /** Create a new index by copying trees from an autotuned index grown
@@ -552,43 +1220,27 @@ class Mrpt {
     * highest possible recall level.
     *
     * @param target_recall target recall level; on the range [0,1]
+    * @param memory_budget maximum estimated memory of the index in bytes; the
+    * fastest index fitting in the budget is created. The default value 0 sets
+    * no limit.
+    * @param k_ number of nearest neighbors searched for by the new index; one
+    * of the values the index is autotuned for (see grow()). The default
+    * value 0 sets this to the (largest) value the index is autotuned for.
     * @return an autotuned Mrpt index with a recall level at least as high as
     * target_recall
     */
-    Mrpt subset(double target_recall) const {
+    Mrpt_Index subset(double target_recall, int64_t memory_budget = 0, int k_ = 0) const {
       if (target_recall < 0.0 - epsilon || target_recall > 1.0 + epsilon) {
         throw std::out_of_range("Target recall must be on the interval [0,1].");
       }
 
-      Mrpt index2(X);
-      index2.par = parameters(target_recall);
+      Mrpt_Index index2(X);
+      index2.par = parameters(target_recall, memory_budget, k_);
+      if (memory_budget && !index2.par.n_trees) {
+        throw std::out_of_range("No index on the frontier fits in the memory budget.");
+      }
 
-      int depth_max = depth;
-
-      index2.n_trees = index2.par.n_trees;
-      index2.depth = index2.par.depth;
-      index2.votes = index2.par.votes;
-      index2.n_pool = index2.depth * index2.n_trees;
-      index2.n_array = 1 << (index2.depth + 1);
-      index2.tree_leaves.assign(tree_leaves.begin(), tree_leaves.begin() + index2.n_trees);
-      index2.leaf_first_indices_all = leaf_first_indices_all;
-      index2.density = density;
-      index2.k = k;
-
-      index2.split_points = split_points.topLeftCorner(index2.n_array, index2.n_trees);
-      index2.leaf_first_indices = leaf_first_indices_all[index2.depth];
-      if (index2.density < 1) {
-        index2.sparse_random_matrix = Eigen::SparseMatrix<float, Eigen::RowMajor>(index2.n_pool, index2.dim);
-        for (int n_tree = 0; n_tree < index2.n_trees; ++n_tree)
-          index2.sparse_random_matrix.middleRows(n_tree * index2.depth, index2.depth) =
-            sparse_random_matrix.middleRows(n_tree * depth_max, index2.depth);
-      } else {
-        index2.dense_random_matrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>(index2.n_pool, index2.dim);
-        for (int n_tree = 0; n_tree < index2.n_trees; ++n_tree)
-          index2.dense_random_matrix.middleRows(n_tree * index2.depth, index2.depth) =
-            dense_random_matrix.middleRows(n_tree * depth_max, index2.depth);
-      }
-      index2.index_type = autotuned;
+      copy_pruned(index2);
 
       return index2;
     }
@@ -602,43 +1254,26 @@ class Mrpt {
     * by the return value.
     *
     * @param target_recall target recall level; on the range [0,1]
+    * @param memory_budget maximum estimated memory of the index in bytes;
+    * see subset().
+    * @param k_ number of nearest neighbors searched for; see subset().
     * @return pointer to a dynamically allocated autotuned Mrpt index with
     * a recall level at least as high as target_recall
     */
-    Mrpt *subset_pointer(double target_recall) const {
+    Mrpt_Index *subset_pointer(double target_recall, int64_t memory_budget = 0, int k_ = 0) const {
       if (target_recall < 0.0 - epsilon || target_recall > 1.0 + epsilon) {
         throw std::out_of_range("Target recall must be on the interval [0,1].");
       }
 
-      Mrpt *index2 = new Mrpt(X);
-      index2->par = parameters(target_recall);
+      Mrpt_Parameters par2 = parameters(target_recall, memory_budget, k_);
+      if (memory_budget && !par2.n_trees) {
+        throw std::out_of_range("No index on the frontier fits in the memory budget.");
+      }
 
-      int depth_max = depth;
+      Mrpt_Index *index2 = new Mrpt_Index(X);
+      index2->par = par2;
 
-      index2->n_trees = index2->par.n_trees;
-      index2->depth = index2->par.depth;
-      index2->votes = index2->par.votes;
-      index2->n_pool = index2->depth * index2->n_trees;
-      index2->n_array = 1 << (index2->depth + 1);
-      index2->tree_leaves.assign(tree_leaves.begin(), tree_leaves.begin() + index2->n_trees);
-      index2->leaf_first_indices_all = leaf_first_indices_all;
-      index2->density = density;
-      index2->k = k;
-
-      index2->split_points = split_points.topLeftCorner(index2->n_array, index2->n_trees);
-      index2->leaf_first_indices = leaf_first_indices_all[index2->depth];
-      if (index2->density < 1) {
-        index2->sparse_random_matrix = Eigen::SparseMatrix<float, Eigen::RowMajor>(index2->n_pool, index2->dim);
-        for (int n_tree = 0; n_tree < index2->n_trees; ++n_tree)
-          index2->sparse_random_matrix.middleRows(n_tree * index2->depth, index2->depth) =
-            sparse_random_matrix.middleRows(n_tree * depth_max, index2->depth);
-      } else {
-        index2->dense_random_matrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>(index2->n_pool, index2->dim);
-        for (int n_tree = 0; n_tree < index2->n_trees; ++n_tree)
-          index2->dense_random_matrix.middleRows(n_tree * index2->depth, index2->depth) =
-            dense_random_matrix.middleRows(n_tree * depth_max, index2->depth);
-      }
-      index2->index_type = autotuned;
+      copy_pruned(*index2);
 
       return index2;
     }
@@ -651,9 +1286,12 @@ class Mrpt {
     * that it is a fastest (measured by query time) parameter combination
     * to obtain as least as high recall level that it has.
     *
+    * @param k_ number of nearest neighbors searched for; one of the values
+    * the index is autotuned for. The default value 0 sets this to the
+    * (largest) value the index is autotuned for.
     * @return vector of optimal parameters
     */
-    std::vector<Mrpt_Parameters> optimal_parameters() const {
+    std::vector<Mrpt_Parameters> optimal_parameters(int k_ = 0) const {
       if (index_type == normal) {
         throw std::logic_error("The list of optimal parameters cannot be retrieved for the non-autotuned index.");
       }
@@ -662,10 +1300,38 @@ class Mrpt {
       }
 
       std::vector<Mrpt_Parameters> new_pars;
-      std::copy(opt_pars.begin(), opt_pars.end(), std::back_inserter(new_pars));
+      double best_recall = -1.0;
+      for (const auto &p : frontier(k_)) {
+        if (p.estimated_recall > best_recall) {
+          new_pars.push_back(p);
+          best_recall = p.estimated_recall;
+        }
+      }
       return new_pars;
     }
 
+    /**
+    * Return the pareto frontier of optimal parameters over the query time,
+    * the recall and the memory of the index for an index which is autotuned
+    * without setting a recall level: a parameter combination is returned if
+    * no other one is at least as fast, has at least as high a recall and
+    * takes at most as much memory (`estimated_bytes`). The parameters are
+    * ordered by the query time. An index for a combination can be created by
+    * subset() with a memory budget.
+    *
+    * @param k_ number of nearest neighbors searched for; see
+    * optimal_parameters().
+    * @return vector of optimal parameters
+    */
+    std::vector<Mrpt_Parameters> optimal_parameters_memory(int k_ = 0) const {
+      if (index_type != autotuned_unpruned) {
+        throw std::logic_error("The list of optimal parameters can be retrieved only for the index which is autotuned without a target recall level.");
+      }
+
+      const std::set<Mrpt_Parameters,decltype(is_faster)*> &pars = frontier(k_);
+      return std::vector<Mrpt_Parameters>(pars.begin(), pars.end());
+    }
+
     /**@}*/
 
     /** @name Approximate k-nn search
@@ -710,10 +1376,7 @@ class Mrpt {
 
         double start = omp_get_wtime();
         Eigen::VectorXf projected_query(n_pool);
-        if (density < 1)
-            projected_query.noalias() = sparse_random_matrix * q;
-        else
-            projected_query.noalias() = dense_random_matrix * q;
+        project(q.data(), projected_query);
         double end = omp_get_wtime();
         projection_time = end - start;
 
@@ -741,13 +1404,16 @@ class Mrpt {
           found_leaves[n_tree] = idx_tree - (1 << depth) + 1;
         }
 
-        int n_elected = 0, max_leaf_size = n_samples / (1 << depth) + 1;
-        Eigen::VectorXi elected(n_trees * max_leaf_size);
+        int n_elected = 0, n_found = 0;
+        for (int n_tree = 0; n_tree < n_trees; ++n_tree)
+          n_found += leaf_first_index(n_tree, found_leaves[n_tree] + 1, depth) -
+                     leaf_first_index(n_tree, found_leaves[n_tree], depth);
+        Eigen::VectorXi elected(n_found);
 
         // count votes
         for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
-          int leaf_begin = leaf_first_indices[found_leaves[n_tree]];
-          int leaf_end = leaf_first_indices[found_leaves[n_tree] + 1];
+          int leaf_begin = leaf_first_index(n_tree, found_leaves[n_tree], depth);
+          int leaf_end = leaf_first_index(n_tree, found_leaves[n_tree] + 1, depth);
           const std::vector<int> &indices = tree_leaves[n_tree];
           for (int i = leaf_begin; i < leaf_end; ++i) {
             int idx = indices[i];
@@ -786,6 +1452,41 @@ class Mrpt {
             exact_time, votes, out_distances, out_n_elected);
     }
 
+    /**
+    * Approximate k-nn search using a normal index, without measuring the
+    * times of the phases of the query.
+    *
+    * @param data pointer to an array containing the query point
+    * @param k number of nearest neighbors searched for
+    * @param vote_threshold number of votes required for a query point to be included in the candidate set
+    * @param out output buffer (size = k) for the indices of k approximate nearest neighbors
+    * @param out_distances optional output buffer (size = k) for distances to k approximate nearest neighbors
+    * @param out_n_elected optional output parameter (size = 1) for the candidate set size
+    */
+    void query(const float *data, int k, int vote_threshold, int *out,
+               float *out_distances = nullptr, int *out_n_elected = nullptr) const {
+      double projection_time, voting_time, exact_time;
+      Eigen::VectorXi votes = Eigen::VectorXi::Zero(n_samples);
+      query(data, k, vote_threshold, out, projection_time, voting_time, exact_time, votes,
+            out_distances, out_n_elected);
+    }
+
+    /**
+    * Approximate k-nn search using a normal index, without measuring the
+    * times of the phases of the query.
+    *
+    * @param q Eigen ref to the query point
+    * @param k number of nearest neighbors searched for
+    * @param vote_threshold number of votes required for a query point to be included in the candidate set
+    * @param out output buffer (size = k) for the indices of k approximate nearest neighbors
+    * @param out_distances optional output buffer (size = k) for distances to k approximate nearest neighbors
+    * @param out_n_elected optional output parameter (size = 1) for the candidate set size
+    */
+    void query(const Eigen::Ref<const Eigen::VectorXf> &q, int k, int vote_threshold, int *out,
+               float *out_distances = nullptr, int *out_n_elected = nullptr) const {
+      query(q.data(), k, vote_threshold, out, out_distances, out_n_elected);
+    }
+
     /**@}*/
 
     /** @name Approximate k-nn search using autotuned index
@@ -839,6 +1540,35 @@ class Mrpt {
             out_distances, out_n_elected);
     }
 
+    /**
+    * Approximate k-nn search using an autotuned index, without measuring the
+    * times of the phases of the query.
+    *
+    * @param q pointer to an array containing the query point
+    * @param out output buffer (size = k) for the indices of k approximate nearest neighbors
+    * @param out_distances optional output buffer (size = k) for distances to k approximate nearest neighbors
+    * @param out_n_elected optional output parameter (size = 1) for the candidate set size
+    */
+    void query(const float *q, int *out, float *out_distances = nullptr, int *out_n_elected = nullptr) const {
+      double projection_time, voting_time, exact_time;
+      Eigen::VectorXi votes = Eigen::VectorXi::Zero(n_samples);
+      query(q, out, projection_time, voting_time, exact_time, votes, out_distances, out_n_elected);
+    }
+
+    /**
+    * Approximate k-nn search using an autotuned index, without measuring the
+    * times of the phases of the query.
+    *
+    * @param q Eigen ref to the query point
+    * @param out output buffer (size = k) for the indices of k approximate nearest neighbors
+    * @param out_distances optional output buffer (size = k) for distances to k approximate nearest neighbors
+    * @param out_n_elected optional output parameter (size = 1) for the candidate set size
+    */
+    void query(const Eigen::Ref<const Eigen::VectorXf> &q, int *out, float *out_distances = nullptr,
+               int *out_n_elected = nullptr) const {
+      query(q.data(), out, out_distances, out_n_elected);
+    }
+
     /**@}*/
 
 
@@ -872,9 +1602,15 @@ class Mrpt {
 
       Eigen::VectorXf distances(n_samples);
 
-      #pragma omp parallel for
-      for (int i = 0; i < n_samples; ++i)
-        distances(i) = (X.col(i) - q).squaredNorm();
+      if (!with_fixed_dim(dim, [&](auto kernels) {
+            #pragma omp parallel for
+            for (int i = 0; i < n_samples; ++i)
+              distances(i) = kernels.squared_distance(q_data, X_data + static_cast<std::ptrdiff_t>(i) * dim);
+          })) {
+        #pragma omp parallel for
+        for (int i = 0; i < n_samples; ++i)
+          distances(i) = squared_distance(q_data, X_data + static_cast<std::ptrdiff_t>(i) * dim, dim);
+      }
 
       if (k == 1) {
         Eigen::MatrixXf::Index index;
@@ -911,7 +1647,7 @@ class Mrpt {
     static void exact_knn(const Eigen::Ref<const Eigen::VectorXf> &q,
                           const Eigen::Ref<const Eigen::MatrixXf> &X,
                           int k, int *out, float *out_distances = nullptr) {
-      Mrpt::exact_knn(q.data(), X.data(), X.rows(), X.cols(), k, out, out_distances);
+      Mrpt_Index::exact_knn(q.data(), X.data(), X.rows(), X.cols(), k, out, out_distances);
     }
 
     /**
@@ -921,7 +1657,13 @@ class Mrpt {
     * @param out_distances optional output buffer (size = k) for the distances to k nearest neighbors
     */
     void exact_knn(const float *q, int k, int *out, float *out_distances = nullptr) const {
-      Mrpt::exact_knn(q, X.data(), dim, n_samples, k, out, out_distances);
+      if (k < 1 || k > n_samples) {
+        throw std::out_of_range("k must be positive and no greater than the sample size of data X.");
+      }
+
+      Eigen::VectorXi idx(n_samples);
+      std::iota(idx.data(), idx.data() + n_samples, 0);
+      exact_knn(Eigen::Map<const Eigen::VectorXf>(q, dim), k, idx, n_samples, out, out_distances);
     }
 
     /**
@@ -932,7 +1674,7 @@ class Mrpt {
     */
     void exact_knn(const Eigen::Ref<const Eigen::VectorXf> &q, int k, int *out,
         float *out_distances = nullptr) const {
-      Mrpt::exact_knn(q.data(), X.data(), dim, n_samples, k, out, out_distances);
+      exact_knn(q.data(), k, out, out_distances);
     }
 
     /**@}*/
@@ -949,18 +1691,39 @@ class Mrpt {
     * Saves the index to a file.
     *
     * @param path - filepath to the output file.
+    * @param seed_only - if true, only the seed and the version of the generator
+    * of the random vectors are saved, and the random matrix is regenerated when
+    * the index is loaded. This makes the index files much smaller at the cost of
+    * a longer loading time. Ignored (the whole matrix is saved) if the index is
+    * grown using Gaussian projections and the legacy generator, whose output
+    * is not reproducible across platforms. A checksum of the random matrix is
+    * saved with the seed, and load() fails if the regenerated matrix differs
+    * from it, for instance because the math library of another platform
+    * rounds the Gaussian or the sparse random vectors differently.
     * @return true if saving succeeded, false otherwise.
     */
-    bool save(const char *path) const {
+    bool save(const char *path, bool seed_only = false) const {
       FILE *fd;
       if ((fd = fopen(path, "wb")) == NULL)
         return false;
 
+      int magic = file_magic, version = file_version;
+      fwrite(&magic, sizeof(int), 1, fd);
+      fwrite(&version, sizeof(int), 1, fd);
+
       int i = index_type;
       fwrite(&i, sizeof(int), 1, fd);
 
       if (index_type == 2) {
         write_parameter_list(opt_pars, fd);
+
+        // the frontiers of the other values of k of an index autotuned for several
+        int n_frontiers = k_opt_pars.size();
+        fwrite(&n_frontiers, sizeof(int), 1, fd);
+        for (const auto &f : k_opt_pars) {
+          fwrite(&f.first, sizeof(int), 1, fd);
+          write_parameter_list(f.second, fd);
+        }
       }
 
       write_parameters(&par, fd);
@@ -977,8 +1740,44 @@ class Mrpt {
         fwrite(&tree_leaves[i][0], sizeof(int), sz, fd);
       }
 
+      // save leaf offsets of an index grown using sampled split points
+      int n_offsets = leaf_offsets.empty() ? 0 : (1 << depth) + 1;
+      fwrite(&n_offsets, sizeof(int), 1, fd);
+      for (int i = 0; i < (n_offsets ? n_trees : 0); ++i)
+        fwrite(&leaf_offsets[i][0], sizeof(int), n_offsets, fd);
+
       // save random matrix
-      if (density < 1) {
+      int matrix_format = seed_only && (generator == philox || projection == sign_projection ||
+                                        projection == hadamard_projection) ? seed_format : full_format;
+      int g = generator, p = projection;
+      fwrite(&matrix_format, sizeof(int), 1, fd);
+      fwrite(&g, sizeof(int), 1, fd);
+      fwrite(&random_seed, sizeof(int), 1, fd);
+      fwrite(&matrix_depth, sizeof(int), 1, fd);
+      fwrite(&p, sizeof(int), 1, fd);
+
+      // save the pool indices of the random vectors if the trees share them
+      fwrite(&pool_size, sizeof(int), 1, fd);
+      if (pool_size)
+        fwrite(pool_directions.data(), sizeof(int), n_pool, fd);
+
+      const int n_rows = matrix_rows();
+      if (matrix_format == full_format && projection == int8_projection) {
+        fwrite(&int8_random_matrix.stride, sizeof(int), 1, fd);
+        fwrite(int8_random_matrix.values.data(), sizeof(int8_t), int8_random_matrix.values.size(), fd);
+        fwrite(int8_random_matrix.scales.data(), sizeof(float), n_rows, fd);
+      } else if (matrix_format == full_format && projection == hadamard_projection) {
+        int size = hadamard_transform.size, n_blocks = hadamard_transform.n_blocks();
+        fwrite(&size, sizeof(int), 1, fd);
+        fwrite(&n_blocks, sizeof(int), 1, fd);
+        fwrite(hadamard_transform.signs.data(), sizeof(float), n_blocks * size, fd);
+        fwrite(hadamard_transform.rows.data(), sizeof(int), n_rows, fd);
+      } else if (matrix_format == full_format && projection == sign_projection) {
+        int non_zeros = sign_random_matrix.nonZeros();
+        fwrite(&non_zeros, sizeof(int), 1, fd);
+        fwrite(&sign_random_matrix.outer[0], sizeof(int), n_rows + 1, fd);
+        fwrite(sign_random_matrix.inner.data(), sizeof(uint32_t), non_zeros, fd);
+      } else if (matrix_format == full_format && density < 1) {
         int non_zeros = sparse_random_matrix.nonZeros();
         fwrite(&non_zeros, sizeof(int), 1, fd);
         for (int k = 0; k < sparse_random_matrix.outerSize(); ++k) {
@@ -990,8 +1789,11 @@ class Mrpt {
             fwrite(&val, sizeof(float), 1, fd);
           }
         }
+      } else if (matrix_format == full_format) {
+        fwrite(dense_random_matrix.data(), sizeof(float), n_rows * dim, fd);
       } else {
-        fwrite(dense_random_matrix.data(), sizeof(float), n_pool * dim, fd);
+        uint64_t checksum = random_matrix_checksum();
+        fwrite(&checksum, sizeof(uint64_t), 1, fd);
       }
 
       fclose(fd);
@@ -999,27 +1801,50 @@ class Mrpt {
     }
 
     /**
-    * Loads an index from a file.
+    * Loads an index from a file. Index files written by the versions of
+    * save() which did not write the format version are also loaded.
     *
     * @param path filepath to the index file.
-    * @return true if loading succeeded, false otherwise.
+    * @return true if loading succeeded, false otherwise (also if the file is
+    * truncated or of an unknown format version).
     */
     bool load(const char *path) {
       FILE *fd;
       if ((fd = fopen(path, "rb")) == NULL)
         return false;
 
-      int i;
-      fread(&i, sizeof(int), 1, fd);
-      index_type = static_cast<itype>(i);
-      if (index_type == autotuned_unpruned) {
-        read_parameter_list(fd);
+      // an index file without the format version starts with the index type
+      int i, version = 0;
+      bool ok = fread(&i, sizeof(int), 1, fd) == 1;
+      if (ok && i == file_magic) {
+        ok = fread(&version, sizeof(int), 1, fd) == 1 && version >= 1 && version <= file_version &&
+             fread(&i, sizeof(int), 1, fd) == 1;
+      }
+      ok = ok && i >= normal && i <= autotuned_unpruned;
+      index_type = static_cast<itype>(ok ? i : normal);
+
+      k_opt_pars.clear();
+      if (ok && index_type == autotuned_unpruned) {
+        ok = read_parameter_list(fd, version);
+        std::set<Mrpt_Parameters,decltype(is_faster)*> pars = opt_pars;
+
+        // an index file without the format version has no frontiers of other values of k
+        int n_frontiers = 0, k_;
+        ok = ok && (version < 1 || fread(&n_frontiers, sizeof(int), 1, fd) == 1);
+        for (int i = 0; ok && i < n_frontiers; ++i) {
+          ok = fread(&k_, sizeof(int), 1, fd) == 1 && read_parameter_list(fd, version);
+          if (ok)
+            k_opt_pars.emplace(k_, opt_pars);
+        }
+        opt_pars = pars;
       }
 
-      read_parameters(&par, fd);
-      fread(&n_trees, sizeof(int), 1, fd);
-      fread(&depth, sizeof(int), 1, fd);
-      fread(&density, sizeof(float), 1, fd);
+      ok = ok && read_parameters(&par, fd, version) && fread(&n_trees, sizeof(int), 1, fd) == 1 &&
+           fread(&depth, sizeof(int), 1, fd) == 1 && fread(&density, sizeof(float), 1, fd) == 1 &&
+           n_trees >= 0 && depth >= 0 && depth <= std::log2(n_samples);
+      if (!ok) {
+        return load_failed(fd);
+      }
 
       n_pool = n_trees * depth;
       n_array = 1 << (depth + 1);
@@ -1028,42 +1853,131 @@ class Mrpt {
       leaf_first_indices = leaf_first_indices_all[depth];
 
       split_points = Eigen::MatrixXf(n_array, n_trees);
-      fread(split_points.data(), sizeof(float), n_array * n_trees, fd);
+      ok = fread(split_points.data(), sizeof(float), split_points.size(), fd) == static_cast<std::size_t>(split_points.size());
 
       // load tree leaves
       tree_leaves = std::vector<std::vector<int>>(n_trees);
-      for (int i = 0; i < n_trees; ++i) {
+      for (int i = 0; ok && i < n_trees; ++i) {
         int sz;
-        fread(&sz, sizeof(int), 1, fd);
-        std::vector<int> leaves(sz);
-        fread(&leaves[0], sizeof(int), sz, fd);
-        tree_leaves[i] = leaves;
+        ok = fread(&sz, sizeof(int), 1, fd) == 1 && sz >= 0 && sz <= n_samples;
+        tree_leaves[i].resize(ok ? sz : 0);
+        ok = ok && fread(tree_leaves[i].data(), sizeof(int), sz, fd) == static_cast<std::size_t>(sz);
       }
 
-      // load random matrix
-      if (density < 1) {
+      // an index file without the format version has the full random matrix
+      // of the legacy generator of the trees of depth depth, and no leaf offsets
+      int matrix_format = full_format, g = legacy, p = gaussian_projection, n_offsets = 0;
+      random_seed = 0;
+      matrix_depth = depth;
+      pool_size = 0;
+      leaf_offsets.clear();
+      if (version >= 1) {
+        // load leaf offsets of an index grown using sampled split points
+        ok = ok && fread(&n_offsets, sizeof(int), 1, fd) == 1 && (!n_offsets || n_offsets == (1 << depth) + 1);
+        for (int i = 0; ok && i < (n_offsets ? n_trees : 0); ++i) {
+          std::vector<int> offsets(n_offsets);
+          ok = fread(&offsets[0], sizeof(int), n_offsets, fd) == static_cast<std::size_t>(n_offsets);
+          leaf_offsets.push_back(offsets);
+        }
+
+        ok = ok && fread(&matrix_format, sizeof(int), 1, fd) == 1 && fread(&g, sizeof(int), 1, fd) == 1 &&
+             fread(&random_seed, sizeof(int), 1, fd) == 1 && fread(&matrix_depth, sizeof(int), 1, fd) == 1 &&
+             fread(&p, sizeof(int), 1, fd) == 1 && fread(&pool_size, sizeof(int), 1, fd) == 1 && pool_size >= 0;
+      }
+      generator = static_cast<gtype>(g);
+      projection = static_cast<ptype>(p);
+
+      pool_directions.resize(ok && pool_size ? n_pool : 0);
+      ok = ok && fread(pool_directions.data(), sizeof(int), pool_directions.size(), fd) == pool_directions.size();
+      if (!ok) {
+        return load_failed(fd);
+      }
+
+      // the rows of a shared pool are not pruned with the trees
+      const int n_rows = matrix_rows();
+      const int tree_depth = pool_size ? 1 : depth, row_stride = pool_size ? 1 : matrix_depth;
+
+      if (matrix_format == seed_format) {
+        if (projection == int8_projection)
+          build_int8_random_matrix(int8_random_matrix, n_rows, dim, density, random_seed,
+                                   generator, tree_depth, row_stride);
+        else if (projection == hadamard_projection)
+          build_hadamard_transform(hadamard_transform, n_rows, dim, random_seed, tree_depth, row_stride);
+        else if (projection == sign_projection)
+          build_sign_random_matrix(sign_random_matrix, n_rows, dim, density, random_seed,
+                                   tree_depth, row_stride);
+        else if (density < 1)
+          build_sparse_random_matrix(sparse_random_matrix, n_rows, dim, density, random_seed,
+                                     generator, tree_depth, row_stride);
+        else
+          build_dense_random_matrix(dense_random_matrix, n_rows, dim, random_seed,
+                                    generator, tree_depth, row_stride);
+
+        // the regenerated matrix has to be the one the trees were grown with
+        uint64_t checksum;
+        ok = version < 2 || (fread(&checksum, sizeof(uint64_t), 1, fd) == 1 &&
+                             checksum == random_matrix_checksum());
+      } else if (projection == int8_projection) {
+        int8_random_matrix = Int8_Matrix(n_rows, dim);
+        ok = fread(&int8_random_matrix.stride, sizeof(int), 1, fd) == 1 && int8_random_matrix.stride >= dim;
+        int8_random_matrix.values.resize(ok ? static_cast<std::size_t>(n_rows) * int8_random_matrix.stride : 0);
+        ok = ok && fread(int8_random_matrix.values.data(), sizeof(int8_t), int8_random_matrix.values.size(), fd) ==
+                   int8_random_matrix.values.size() &&
+             fread(int8_random_matrix.scales.data(), sizeof(float), n_rows, fd) == static_cast<std::size_t>(n_rows);
+      } else if (projection == hadamard_projection) {
+        int size, n_blocks;
+        ok = fread(&size, sizeof(int), 1, fd) == 1 && fread(&n_blocks, sizeof(int), 1, fd) == 1 &&
+             size > 0 && n_blocks >= 0;
+
+        hadamard_transform = Hadamard_Transform();
+        hadamard_transform.dim = dim;
+        hadamard_transform.size = size;
+        hadamard_transform.signs.resize(ok ? static_cast<std::size_t>(n_blocks) * size : 0);
+        hadamard_transform.rows.resize(n_rows);
+        ok = ok && fread(hadamard_transform.signs.data(), sizeof(float), hadamard_transform.signs.size(), fd) ==
+                   hadamard_transform.signs.size() &&
+             fread(hadamard_transform.rows.data(), sizeof(int), n_rows, fd) == static_cast<std::size_t>(n_rows);
+      } else if (projection == sign_projection) {
+        int non_zeros;
+        ok = fread(&non_zeros, sizeof(int), 1, fd) == 1 && non_zeros >= 0;
+
+        sign_random_matrix = Sign_Matrix();
+        sign_random_matrix.rows = n_rows;
+        sign_random_matrix.cols = dim;
+        sign_random_matrix.outer.resize(n_rows + 1);
+        sign_random_matrix.inner.resize(ok ? non_zeros : 0);
+        ok = ok && fread(&sign_random_matrix.outer[0], sizeof(int), n_rows + 1, fd) == static_cast<std::size_t>(n_rows + 1) &&
+             fread(sign_random_matrix.inner.data(), sizeof(uint32_t), non_zeros, fd) == static_cast<std::size_t>(non_zeros);
+      } else if (density < 1) {
         int non_zeros;
-        fread(&non_zeros, sizeof(int), 1, fd);
+        ok = fread(&non_zeros, sizeof(int), 1, fd) == 1 && non_zeros >= 0;
 
-        sparse_random_matrix = Eigen::SparseMatrix<float>(n_pool, dim);
+        sparse_random_matrix = Eigen::SparseMatrix<float>(n_rows, dim);
         std::vector<Eigen::Triplet<float>> triplets;
-        for (int k = 0; k < non_zeros; ++k) {
+        for (int k = 0; ok && k < non_zeros; ++k) {
           int row, col;
           float val;
-          fread(&row, sizeof(int), 1, fd);
-          fread(&col, sizeof(int), 1, fd);
-          fread(&val, sizeof(float), 1, fd);
-          triplets.push_back(Eigen::Triplet<float>(row, col, val));
+          ok = fread(&row, sizeof(int), 1, fd) == 1 && fread(&col, sizeof(int), 1, fd) == 1 &&
+               fread(&val, sizeof(float), 1, fd) == 1 && row >= 0 && row < n_rows && col >= 0 && col < dim;
+          if (ok)
+            triplets.push_back(Eigen::Triplet<float>(row, col, val));
         }
 
-        sparse_random_matrix.setFromTriplets(triplets.begin(), triplets.end());
-        sparse_random_matrix.makeCompressed();
+        if (ok) {
+          sparse_random_matrix.setFromTriplets(triplets.begin(), triplets.end());
+          sparse_random_matrix.makeCompressed();
+        }
       } else {
-        dense_random_matrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>(n_pool, dim);
-        fread(dense_random_matrix.data(), sizeof(float), n_pool * dim, fd);
+        dense_random_matrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>(n_rows, dim);
+        ok = fread(dense_random_matrix.data(), sizeof(float), dense_random_matrix.size(), fd) ==
+             static_cast<std::size_t>(dense_random_matrix.size());
       }
 
+      if (!ok) {
+        return load_failed(fd);
+      }
       fclose(fd);
+      pack_random_matrix();
 
       k = par.k;
       votes = par.votes;
@@ -1093,263 +2007,2636 @@ class Mrpt {
 
  private:
 
+    /*
+    * Copies the trees and the random vectors of the parameters index2.par
+    * into index2, which is then an autotuned index of these parameters.
+    */
+    void copy_pruned(Mrpt_Index &index2) const {
+      int depth_max = depth;
+
+      index2.n_trees = index2.par.n_trees;
+      index2.depth = index2.par.depth;
+      index2.votes = index2.par.votes;
+      index2.n_pool = index2.depth * index2.n_trees;
+      index2.n_array = 1 << (index2.depth + 1);
+      index2.tree_leaves.assign(tree_leaves.begin(), tree_leaves.begin() + index2.n_trees);
+      index2.leaf_first_indices_all = leaf_first_indices_all;
+      index2.density = density;
+      index2.generator = generator;
+      index2.random_seed = random_seed;
+      index2.matrix_depth = matrix_depth;
+      index2.projection = projection;
+      index2.pool_size = pool_size;
+      index2.k = index2.par.k;
+
+      index2.split_points = split_points.topLeftCorner(index2.n_array, index2.n_trees);
+      index2.leaf_first_indices = leaf_first_indices_all[index2.depth];
+      if (!leaf_offsets.empty())
+        index2.leaf_offsets = prune_leaf_offsets(index2.n_trees, depth_max, index2.depth);
+      if (pool_size) {
+        index2.pool_directions = prune_pool_directions(index2.n_trees, depth_max, index2.depth);
+        index2.int8_random_matrix = int8_random_matrix;
+        index2.hadamard_transform = hadamard_transform;
+        index2.sign_random_matrix = sign_random_matrix;
+        index2.sparse_random_matrix = sparse_random_matrix;
+        index2.dense_random_matrix = dense_random_matrix;
+      } else if (index2.projection == int8_projection) {
+        index2.int8_random_matrix = int8_random_matrix.tree_rows(index2.n_trees, depth_max, index2.depth);
+      } else if (index2.projection == hadamard_projection) {
+        index2.hadamard_transform = hadamard_transform.tree_rows(index2.n_trees, depth_max, index2.depth);
+      } else if (index2.projection == sign_projection) {
+        index2.sign_random_matrix = sign_random_matrix.tree_rows(index2.n_trees, depth_max, index2.depth);
+      } else if (index2.density < 1) {
+        index2.sparse_random_matrix = Eigen::SparseMatrix<float, Eigen::RowMajor>(index2.n_pool, index2.dim);
+        for (int n_tree = 0; n_tree < index2.n_trees; ++n_tree)
+          index2.sparse_random_matrix.middleRows(n_tree * index2.depth, index2.depth) =
+            sparse_random_matrix.middleRows(n_tree * depth_max, index2.depth);
+      } else {
+        index2.dense_random_matrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>(index2.n_pool, index2.dim);
+        for (int n_tree = 0; n_tree < index2.n_trees; ++n_tree)
+          index2.dense_random_matrix.middleRows(n_tree * index2.depth, index2.depth) =
+            dense_random_matrix.middleRows(n_tree * depth_max, index2.depth);
+      }
+      index2.pack_random_matrix();
+      index2.index_type = autotuned;
+    }
+
+    /*
+    * Returns a checksum (64-bit FNV-1a) of the random matrix, which is saved
+    * with the seed of the matrix to verify that the matrix regenerated when
+    * the index is loaded is the one the split points were computed with.
+    */
+    uint64_t random_matrix_checksum() const {
+      uint64_t checksum = 14695981039346656037ULL;
+      auto add = [&checksum](const void *data, std::size_t n_bytes) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (std::size_t i = 0; i < n_bytes; ++i)
+          checksum = (checksum ^ bytes[i]) * 1099511628211ULL;
+      };
+
+      if (projection == int8_projection) {
+        add(int8_random_matrix.values.data(), int8_random_matrix.values.size());
+        add(int8_random_matrix.scales.data(), int8_random_matrix.scales.size() * sizeof(float));
+      } else if (projection == hadamard_projection) {
+        add(hadamard_transform.signs.data(), hadamard_transform.signs.size() * sizeof(float));
+        add(hadamard_transform.rows.data(), hadamard_transform.rows.size() * sizeof(int));
+      } else if (projection == sign_projection) {
+        add(sign_random_matrix.outer.data(), sign_random_matrix.outer.size() * sizeof(int));
+        add(sign_random_matrix.inner.data(), sign_random_matrix.inner.size() * sizeof(uint32_t));
+      } else if (density < 1) {
+        for (int k = 0; k < sparse_random_matrix.outerSize(); ++k) {
+          for (Eigen::SparseMatrix<float, Eigen::RowMajor>::InnerIterator it(sparse_random_matrix, k); it; ++it) {
+            float val = it.value();
+            int row = it.row(), col = it.col();
+            add(&row, sizeof(int));
+            add(&col, sizeof(int));
+            add(&val, sizeof(float));
+          }
+        }
+      } else {
+        add(dense_random_matrix.data(), dense_random_matrix.size() * sizeof(float));
+      }
+      return checksum;
+    }
+
+    /*
+    * Generates the random matrix from the seed random_seed: the rows of the
+    * shared pool, or the random vectors of all the levels of all the trees.
+    * The rows of each tree are drawn from their own streams (or in order,
+    * by the legacy generator), so the rows of the trees already grown are
+    * regenerated unchanged when the number of trees grows.
+    */
+    void build_random_matrix() {
+      const int n_rows = matrix_rows();
+      if (projection == hadamard_projection)
+        build_hadamard_transform(hadamard_transform, n_rows, dim, random_seed);
+      else if (projection == sign_projection)
+        build_sign_random_matrix(sign_random_matrix, n_rows, dim, density, random_seed);
+      else if (projection == int8_projection)
+        build_int8_random_matrix(int8_random_matrix, n_rows, dim, density, random_seed, generator);
+      else if (density < 1)
+        build_sparse_random_matrix(sparse_random_matrix, n_rows, dim, density, random_seed, generator);
+      else
+        build_dense_random_matrix(dense_random_matrix, n_rows, dim, random_seed, generator);
+      pack_random_matrix();
+    }
+
+    /*
+    * Grows the trees tree_begin, ..., n_trees - 1, whose random vectors,
+    * split points and leaves have been allocated; the split points are
+    * computed from samples of sample_size points if it is positive.
+    */
+    void grow_trees(int tree_begin, int sample_size) {
+      bool sampled = sample_size > 0 && sample_size < n_samples;
+      std::vector<unsigned> tree_seeds;
+      if (sampled) {
+        std::mt19937 gen(random_seed);
+        for (int n_tree = 0; n_tree < n_trees; ++n_tree)
+          tree_seeds.push_back(gen());
+        leaf_offsets.resize(n_trees);
+      }
+
+      std::vector<uint8_t> data_uint8;
+      if (projection == int8_projection) {
+        const int stride = int8_random_matrix.stride;
+        data_uint8.resize(static_cast<std::size_t>(n_samples) * stride);
+        #pragma omp parallel for
+        for (int i = 0; i < n_samples; ++i)
+          Int8_Matrix::quantize(X.data() + static_cast<std::ptrdiff_t>(i) * dim, dim, stride,
+                                data_uint8.data() + static_cast<std::ptrdiff_t>(i) * stride);
+      }
+
+      // the projections of all the data points onto the shared pool are computed once
+      Eigen::MatrixXf pool_projections;
+      if (pool_size) {
+        pool_projections.resize(pool_size, n_samples);
+        const int block_size = 256;
+        #pragma omp parallel for
+        for (int i = 0; i < n_samples; i += block_size)
+          project_data(0, pool_size, i, std::min(block_size, n_samples - i), data_uint8.data(),
+                       pool_projections.data() + static_cast<std::ptrdiff_t>(i) * pool_size);
+      }
+
+      #pragma omp parallel for
+      for (int n_tree = tree_begin; n_tree < n_trees; ++n_tree) {
+        Eigen::MatrixXf tree_projections(depth, n_samples);
+
+        if (pool_size) {
+          const int *directions = pool_directions.data() + n_tree * depth;
+          for (int i = 0; i < n_samples; ++i)
+            for (int d = 0; d < depth; ++d)
+              tree_projections(d, i) = pool_projections(directions[d], i);
+        } else {
+          // the data points not stored as floats are converted in blocks
+          const int block_size = std::is_same<Scalar, float>::value ? n_samples : 256;
+          for (int i = 0; i < n_samples; i += block_size)
+            project_data(n_tree * depth, depth, i, std::min(block_size, n_samples - i), data_uint8.data(),
+                         tree_projections.data() + static_cast<std::ptrdiff_t>(i) * depth);
+        }
+
+        if (sampled) {
+          std::vector<int> sample(sample_indices_sorted(sample_size, tree_seeds[n_tree]));
+          std::vector<std::pair<float,int>> buffer(sample.size());
+          grow_subtree(sample.begin(), sample.end(), 0, 0, n_tree, tree_projections, buffer);
+          route_points(n_tree, tree_projections);
+          continue;
+        }
+
+        tree_leaves[n_tree] = std::vector<int>(n_samples);
+        std::vector<int> &indices = tree_leaves[n_tree];
+        std::iota(indices.begin(), indices.end(), 0);
+
+        std::vector<std::pair<float,int>> buffer(n_samples);
+        grow_subtree(indices.begin(), indices.end(), 0, 0, n_tree, tree_projections, buffer);
+      }
+    }
+
+    /*
+    * Grows n_new more trees onto an index which is not pruned. The random
+    * vectors of the trees already grown are not changed, so the new trees
+    * are the trees which the index would have if it had been grown with
+    * n_trees + n_new trees in the first place.
+    */
+    void add_trees(int n_new) {
+      const int tree_begin = n_trees;
+      n_trees += n_new;
+      n_pool = n_trees * depth;
+
+      if (pool_size)
+        build_pool_directions(pool_directions, n_trees, depth, pool_size, random_seed);
+      else
+        build_random_matrix();
+
+      split_points.conservativeResize(n_array, n_trees);
+      tree_leaves.resize(n_trees);
+      grow_trees(tree_begin, 0);
+    }
+
     /**
     * Builds a single random projection tree. The tree is constructed by recursively
     * projecting the data on a random vector and splitting into two by the median.
+    * At each node the projections of the points on the current level are
+    * gathered once into a contiguous buffer of (projection, index) pairs, so
+    * that the median is found without indirect loads.
     */
     void grow_subtree(std::vector<int>::iterator begin, std::vector<int>::iterator end,
-          int tree_level, int i, int n_tree, const Eigen::MatrixXf &tree_projections) {
+          int tree_level, int i, int n_tree, const Eigen::MatrixXf &tree_projections,
+          std::vector<std::pair<float,int>> &buffer) {
       int n = end - begin;
       int idx_left = 2 * i + 1;
       int idx_right = idx_left + 1;
 
       if (tree_level == depth) return;
 
-      std::nth_element(begin, begin + n / 2, end,
-          [&tree_projections, tree_level] (int i1, int i2) {
-            return tree_projections(tree_level, i1) < tree_projections(tree_level, i2);
-          });
+      std::pair<float,int> *kv = buffer.data();
+      for (int j = 0; j < n; ++j)
+        kv[j] = std::make_pair(tree_projections(tree_level, begin[j]), begin[j]);
+
+      select_kv(kv, kv + n / 2, kv + n);
       auto mid = end - n / 2;
 
       if (n % 2) {
-        split_points(i, n_tree) = tree_projections(tree_level, *(mid - 1));
+        split_points(i, n_tree) = kv[n / 2].first;
       } else {
-        auto left_it = std::max_element(begin, mid,
-            [&tree_projections, tree_level] (int i1, int i2) {
-              return tree_projections(tree_level, i1) < tree_projections(tree_level, i2);
-            });
-        split_points(i, n_tree) = (tree_projections(tree_level, *mid) +
-          tree_projections(tree_level, *left_it)) / 2.0;
+        float left_max = kv[0].first;
+        for (int j = 1; j < n / 2; ++j)
+          left_max = std::max(left_max, kv[j].first);
+        split_points(i, n_tree) = (kv[n / 2].first + left_max) / 2.0;
+      }
+
+      for (int j = 0; j < n; ++j)
+        begin[j] = kv[j].second;
+
+      grow_subtree(begin, mid, tree_level + 1, idx_left, n_tree, tree_projections, buffer);
+      grow_subtree(mid, end, tree_level + 1, idx_right, n_tree, tree_projections, buffer);
+    }
+
+    /**
+    * Partially sorts (projection, index) pairs by projection such that the
+    * pair at nth is the one that would be there if the range was sorted,
+    * no pair before it is greater and no pair after it is smaller. This is a
+    * quickselect with a median-of-three pivot and a branchless three-way
+    * partition; it falls back to std::nth_element on small ranges and when
+    * the partitions stay unbalanced.
+    */
+    static void select_kv(std::pair<float,int> *first, std::pair<float,int> *nth,
+                          std::pair<float,int> *last) {
+      auto by_key = [](const std::pair<float,int> &a, const std::pair<float,int> &b) {
+        return a.first < b.first;
+      };
+      int budget = 2 * static_cast<int>(std::log2(last - first + 1)) + 4;
+
+      while (last - first > 32) {
+        if (--budget < 0) {
+          std::nth_element(first, nth, last, by_key);
+          return;
+        }
+
+        float a = first->first, b = first[(last - first) / 2].first, c = (last - 1)->first;
+        float pivot = std::max(std::min(a, b), std::min(std::max(a, b), c));
+
+        // [first, lt) < pivot
+        std::pair<float,int> *lt = first;
+        for (std::pair<float,int> *it = first; it < last; ++it) {
+          std::pair<float,int> x = *it;
+          *it = *lt;
+          *lt = x;
+          lt += x.first < pivot;
+        }
+
+        // [lt, eq) == pivot
+        std::pair<float,int> *eq = lt;
+        for (std::pair<float,int> *it = lt; it < last; ++it) {
+          std::pair<float,int> x = *it;
+          *it = *eq;
+          *eq = x;
+          eq += !(pivot < x.first);
+        }
+
+        if (nth < lt) {
+          last = lt;
+        } else if (nth >= eq) {
+          first = eq;
+        } else {
+          return;
+        }
+      }
+
+      std::nth_element(first, nth, last, by_key);
+    }
+
+    /**
+    * Routes all the data points into the leaves of a tree whose split points
+    * have already been computed, and stores the points ordered by leaf into
+    * tree_leaves together with the first index of each leaf. The points are
+    * processed sequentially, so that the projections are read contiguously.
+    */
+    void route_points(int n_tree, const Eigen::MatrixXf &tree_projections) {
+      int n_leaves = 1 << depth;
+      std::vector<int> point_leaves(n_samples);
+      std::vector<int> offsets(n_leaves + 1, 0);
+
+      for (int i = 0; i < n_samples; ++i) {
+        const float *proj = tree_projections.data() + static_cast<std::ptrdiff_t>(i) * depth;
+        int idx_tree = 0;
+        for (int d = 0; d < depth; ++d)
+          idx_tree = 2 * idx_tree + 1 + (proj[d] > split_points(idx_tree, n_tree));
+        point_leaves[i] = idx_tree - n_leaves + 1;
+        ++offsets[point_leaves[i] + 1];
+      }
+
+      for (int l = 0; l < n_leaves; ++l)
+        offsets[l + 1] += offsets[l];
+
+      std::vector<int> &indices = tree_leaves[n_tree];
+      indices = std::vector<int>(n_samples);
+      std::vector<int> pos(offsets.begin(), offsets.end() - 1);
+      for (int i = 0; i < n_samples; ++i)
+        indices[pos[point_leaves[i]]++] = i;
+
+      leaf_offsets[n_tree] = offsets;
+    }
+
+    /**
+    * Returns the index of the first element of a leaf on a level tree_depth
+    * of a tree in tree_leaves[n_tree]; leaf = 2^tree_depth gives the end of
+    * the last leaf.
+    */
+    int leaf_first_index(int n_tree, int leaf, int tree_depth) const {
+      if (leaf_offsets.empty())
+        return leaf_first_indices_all[tree_depth][leaf];
+      return leaf_offsets[n_tree][leaf << (depth - tree_depth)];
+    }
+
+    /**
+    * Returns the leaf offsets of the first n_trees_new trees, when the trees
+    * grown to the depth depth_old are pruned to the depth depth_new.
+    */
+    std::vector<std::vector<int>> prune_leaf_offsets(int n_trees_new, int depth_old, int depth_new) const {
+      std::vector<std::vector<int>> offsets(n_trees_new);
+      for (int n_tree = 0; n_tree < n_trees_new; ++n_tree) {
+        for (int l = 0; l <= (1 << depth_new); ++l)
+          offsets[n_tree].push_back(leaf_offsets[n_tree][l << (depth_old - depth_new)]);
+      }
+      return offsets;
+    }
+
+    /**
+    * Find k nearest neighbors from data for the query point
+    */
+    void exact_knn(const Eigen::Map<const Eigen::VectorXf> &q, int k, const Eigen::VectorXi &indices,
+                   int n_elected, int *out, float *out_distances = nullptr) const {
+
+      if (!n_elected) {
+        for (int i = 0; i < k; ++i)
+          out[i] = -1;
+
+        if (out_distances) {
+          for (int i = 0; i < k; ++i)
+            out_distances[i] = -1;
+        }
+
+        return;
+      }
+
+      Eigen::VectorXf distances(n_elected);
+
+      std::vector<Scalar> q_scalar;
+      if (std::is_integral<Scalar>::value && to_scalar(q.data(), q_scalar)) {
+        #pragma omp parallel for
+        for (int i = 0; i < n_elected; ++i)
+          distances(i) = squared_distance(q_scalar.data(), X.data() + static_cast<std::ptrdiff_t>(indices(i)) * dim,
+                                          dim);
+      } else if (!std::is_integral<Scalar>::value) {
+        if (!std::is_same<Scalar, float>::value || !fixed_squared_distances(q.data(), indices, n_elected,
+                                                                             distances.data())) {
+          #pragma omp parallel for
+          for (int i = 0; i < n_elected; ++i)
+            distances(i) = squared_distance(q.data(), X.data() + static_cast<std::ptrdiff_t>(indices(i)) * dim,
+                                            dim);
+        }
+      } else {
+        #pragma omp parallel for
+        for (int i = 0; i < n_elected; ++i)
+          distances(i) = (X.col(indices(i)).template cast<float>() - q).squaredNorm();
+      }
+
+      if (k == 1) {
+        Eigen::MatrixXf::Index index;
+        distances.minCoeff(&index);
+        out[0] = n_elected ? indices(index) : -1;
+
+        if (out_distances)
+          out_distances[0] = n_elected ? std::sqrt(distances(index)) : -1;
+
+        return;
+      }
+
+      int n_to_sort = n_elected > k ? k : n_elected;
+      Eigen::VectorXi idx(n_elected);
+      std::iota(idx.data(), idx.data() + n_elected, 0);
+      std::partial_sort(idx.data(), idx.data() + n_to_sort, idx.data() + n_elected,
+                       [&distances](int i1, int i2) { return distances(i1) < distances(i2); });
+
+      for (int i = 0; i < k; ++i)
+        out[i] = i < n_elected ? indices(idx(i)) : -1;
+
+      if (out_distances) {
+        for (int i = 0; i < k; ++i)
+          out_distances[i] = i < n_elected ? std::sqrt(distances(idx(i))) : -1;
+      }
+    }
+
+    /*
+    * Converts the query q into the type of the data if all its components
+    * are integers representable in it, so that its distances to the data
+    * points can be computed by integer arithmetic; returns false otherwise.
+    */
+    bool to_scalar(const float *q, std::vector<Scalar> &out) const {
+      out.resize(dim);
+      for (int i = 0; i < dim; ++i) {
+        if (!(q[i] >= std::numeric_limits<Scalar>::lowest() && q[i] <= std::numeric_limits<Scalar>::max() &&
+              q[i] == std::floor(q[i])))
+          return false;
+        out[i] = static_cast<Scalar>(q[i]);
+      }
+      return true;
+    }
+
+    /*
+    * Squared Euclidean distances between two vectors of length n. The
+    * distances between vectors of 8-bit integers are computed exactly: the
+    * differences are widened to 16 bits and squared and summed by 32-bit
+    * multiply-adds, whose sums are flushed into a 64-bit total before they
+    * can overflow. The 16-bit floats are converted to floats eight at a
+    * time inside the loop.
+    */
+    static float squared_distance(const float *a, const float *b, int n) {
+#ifdef MRPT_SIMD_DISPATCH
+      if (Mrpt_Simd::current() >= Mrpt_Simd::avx512)
+        return squared_distance_avx512(a, b, n);
+      if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+        return squared_distance_avx2(a, b, n);
+#endif
+      return (Eigen::Map<const Eigen::VectorXf>(a, n) - Eigen::Map<const Eigen::VectorXf>(b, n)).squaredNorm();
+    }
+
+    template <typename T, typename U>
+    static float squared_distance(const T *a, const U *b, int n) {
+      float sum = 0;
+      for (int i = 0; i < n; ++i) {
+        float d = static_cast<float>(a[i]) - static_cast<float>(b[i]);
+        sum += d * d;
+      }
+      return sum;
+    }
+
+    static float squared_distance(const float *a, const Mrpt_Float16 *b, int n) {
+#ifdef MRPT_SIMD_DISPATCH
+      if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+        return half_squared_distance_avx2(a, b, n);
+#endif
+      return squared_distance<float, Mrpt_Float16>(a, b, n);
+    }
+
+    static float squared_distance(const float *a, const Mrpt_BFloat16 *b, int n) {
+#ifdef MRPT_SIMD_DISPATCH
+      if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+        return half_squared_distance_avx2(a, b, n);
+#endif
+      return squared_distance<float, Mrpt_BFloat16>(a, b, n);
+    }
+
+    static float squared_distance(const uint8_t *a, const uint8_t *b, int n) {
+      int64_t sum = 0;
+      int i = 0;
+#ifdef MRPT_SIMD_DISPATCH
+      if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+        sum = squared_distance_avx2(a, b, n, i);
+      else if (Mrpt_Simd::current() >= Mrpt_Simd::sse4)
+        sum = squared_distance_sse4(a, b, n, i);
+#endif
+      for (; i < n; ++i) {
+        int d = a[i] - b[i];
+        sum += d * d;
+      }
+      return sum;
+    }
+
+    static float squared_distance(const int8_t *a, const int8_t *b, int n) {
+      int64_t sum = 0;
+      int i = 0;
+#ifdef MRPT_SIMD_DISPATCH
+      if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+        sum = squared_distance_avx2(a, b, n, i);
+      else if (Mrpt_Simd::current() >= Mrpt_Simd::sse4)
+        sum = squared_distance_sse4(a, b, n, i);
+#endif
+      for (; i < n; ++i) {
+        int d = a[i] - b[i];
+        sum += d * d;
+      }
+      return sum;
+    }
+
+#ifdef MRPT_SIMD_DISPATCH
+    /*
+    * Variants of the distance kernels for each instruction set level. The
+    * kernels of 8-bit integers process the full vectors of components from
+    * the beginning and advance i past them, and the callers sum the rest.
+    */
+    MRPT_TARGET("avx512f")
+    static float squared_distance_avx512(const float *a, const float *b, int n) {
+      __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+      int i = 0;
+      for (; i + 32 <= n; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+      }
+      for (; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? 0xffff : (1u << (n - i)) - 1;
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+      }
+      return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    }
+
+    MRPT_TARGET("avx2,fma")
+    static float squared_distance_avx2(const float *a, const float *b, int n) {
+      __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+      int i = 0;
+      for (; i + 16 <= n; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        acc0 = mul_add(d0, d0, acc0);
+        acc1 = mul_add(d1, d1, acc1);
+      }
+      for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = mul_add(d, d, acc0);
+      }
+      float sum = hsum(_mm256_add_ps(acc0, acc1));
+      for (; i < n; ++i)
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+      return sum;
+    }
+
+    template <typename T>
+    MRPT_TARGET("avx2,fma,f16c")
+    static float half_squared_distance_avx2(const float *a, const T *b, int n) {
+      __m256 acc = _mm256_setzero_ps();
+      int i = 0;
+      for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), load_float(b + i));
+        acc = mul_add(d, d, acc);
+      }
+      float sum = hsum(acc);
+      for (; i < n; ++i) {
+        float d = a[i] - b[i];
+        sum += d * d;
+      }
+      return sum;
+    }
+
+    MRPT_TARGET("avx2")
+    static int64_t squared_distance_avx2(const uint8_t *a, const uint8_t *b, int n, int &i) {
+      int64_t sum = 0;
+      const __m256i zero = _mm256_setzero_si256();
+      while (i + 32 <= n) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int end = std::min(n - 31, i + 32 * 4096); i < end; i += 32) {
+          __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+          __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+          __m256i d = _mm256_or_si256(_mm256_subs_epu8(x, y), _mm256_subs_epu8(y, x));
+          __m256i lo = _mm256_unpacklo_epi8(d, zero), hi = _mm256_unpackhi_epi8(d, zero);
+          acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+        }
+        sum += hsum64(acc);
+      }
+      return sum;
+    }
+
+    MRPT_TARGET("sse4.1")
+    static int64_t squared_distance_sse4(const uint8_t *a, const uint8_t *b, int n, int &i) {
+      int64_t sum = 0;
+      const __m128i zero = _mm_setzero_si128();
+      while (i + 16 <= n) {
+        __m128i acc = _mm_setzero_si128();
+        for (int end = std::min(n - 15, i + 16 * 4096); i < end; i += 16) {
+          __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+          __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+          __m128i d = _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+          __m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+          acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        sum += hsum64(acc);
+      }
+      return sum;
+    }
+
+    MRPT_TARGET("avx2")
+    static int64_t squared_distance_avx2(const int8_t *a, const int8_t *b, int n, int &i) {
+      int64_t sum = 0;
+      while (i + 16 <= n) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int end = std::min(n - 15, i + 16 * 8192); i < end; i += 16) {
+          __m256i x = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+          __m256i y = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+          __m256i d = _mm256_sub_epi16(x, y);
+          acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d, d));
+        }
+        sum += hsum64(acc);
+      }
+      return sum;
+    }
+
+    MRPT_TARGET("sse4.1")
+    static int64_t squared_distance_sse4(const int8_t *a, const int8_t *b, int n, int &i) {
+      int64_t sum = 0;
+      while (i + 8 <= n) {
+        __m128i acc = _mm_setzero_si128();
+        for (int end = std::min(n - 7, i + 8 * 8192); i < end; i += 8) {
+          __m128i x = _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(a + i)));
+          __m128i y = _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(b + i)));
+          __m128i d = _mm_sub_epi16(x, y);
+          acc = _mm_add_epi32(acc, _mm_madd_epi16(d, d));
+        }
+        sum += hsum64(acc);
+      }
+      return sum;
+    }
+#endif
+
+    /*
+    * Computes the squared distances between q and the data points
+    * indices(0), ..., indices(n - 1) of float data by the kernel specialized
+    * for the dimension of the data; returns false if there is no such kernel.
+    */
+    bool fixed_squared_distances(const float *q, const Eigen::VectorXi &indices, int n, float *out) const {
+      const float *x = reinterpret_cast<const float *>(X.data());
+      const int d = dim;
+      return with_fixed_dim(d, [&](auto kernels) {
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i)
+          out[i] = kernels.squared_distance(q, x + static_cast<std::ptrdiff_t>(indices(i)) * d);
+      });
+    }
+
+    /*
+    * Calls f with the kernels specialized for the dimension n and returns
+    * true if n is one of the common dimensions of descriptors and
+    * embeddings; returns false otherwise, and the callers then use the
+    * kernels for dynamic dimensions.
+    */
+    template <typename F>
+    static bool with_fixed_dim(int n, F f) {
+      switch (n) {
+        case 96: f(Fixed_Kernels<96>()); return true;
+        case 128: f(Fixed_Kernels<128>()); return true;
+        case 256: f(Fixed_Kernels<256>()); return true;
+        case 384: f(Fixed_Kernels<384>()); return true;
+        case 768: f(Fixed_Kernels<768>()); return true;
+        case 784: f(Fixed_Kernels<784>()); return true;
+        case 960: f(Fixed_Kernels<960>()); return true;
+        default: return false;
+      }
+    }
+
+    /*
+    * Kernels for vectors whose length Dim is known at compile time. The
+    * loops over the components have constant trip counts, so that they are
+    * fully unrolled, and the distances are accumulated in four registers
+    * and the products of four rows of a matrix are computed per load of
+    * the vector.
+    */
+    template <int Dim>
+    struct Fixed_Kernels {
+      // squared Euclidean distance between the vectors a and b
+      static float squared_distance(const float *a, const float *b) {
+#ifdef MRPT_SIMD_DISPATCH
+        if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+          return squared_distance_avx2(a, b);
+#endif
+        return (Eigen::Map<const Eigen::Matrix<float, Dim, 1>>(a) -
+                Eigen::Map<const Eigen::Matrix<float, Dim, 1>>(b)).squaredNorm();
+      }
+
+      // products of the n_rows rows of the row-major matrix m and the vector q
+      static void multiply(const float *m, const float *q, float *out, int n_rows) {
+        int j = 0;
+#ifdef MRPT_SIMD_DISPATCH
+        if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+          j = multiply_avx2(m, q, out, n_rows);
+#endif
+        const Eigen::Map<const Eigen::Matrix<float, Dim, 1>> x(q);
+        for (; j < n_rows; ++j)
+          out[j] = Eigen::Map<const Eigen::Matrix<float, Dim, 1>>(m + static_cast<std::ptrdiff_t>(j) * Dim).dot(x);
+      }
+
+#ifdef MRPT_SIMD_DISPATCH
+      MRPT_TARGET("avx2,fma")
+      static float squared_distance_avx2(const float *a, const float *b) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(),
+               acc3 = _mm256_setzero_ps();
+        int i = 0;
+        for (; i + 32 <= Dim; i += 32) {
+          __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+          __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+          __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+          __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+          acc0 = mul_add(d0, d0, acc0);
+          acc1 = mul_add(d1, d1, acc1);
+          acc2 = mul_add(d2, d2, acc2);
+          acc3 = mul_add(d3, d3, acc3);
+        }
+        for (; i + 8 <= Dim; i += 8) {
+          __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+          acc0 = mul_add(d, d, acc0);
+        }
+        float sum = hsum(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+        for (; i < Dim; ++i)
+          sum += (a[i] - b[i]) * (a[i] - b[i]);
+        return sum;
+      }
+
+      // computes the products of the rows in blocks of four, and returns the number of rows done
+      MRPT_TARGET("avx2,fma")
+      static int multiply_avx2(const float *m, const float *q, float *out, int n_rows) {
+        int j = 0;
+        for (; j + 4 <= n_rows; j += 4) {
+          const float *row = m + static_cast<std::ptrdiff_t>(j) * Dim;
+          __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(),
+                 acc3 = _mm256_setzero_ps();
+          int i = 0;
+          for (; i + 8 <= Dim; i += 8) {
+            __m256 x = _mm256_loadu_ps(q + i);
+            acc0 = mul_add(_mm256_loadu_ps(row + i), x, acc0);
+            acc1 = mul_add(_mm256_loadu_ps(row + Dim + i), x, acc1);
+            acc2 = mul_add(_mm256_loadu_ps(row + 2 * Dim + i), x, acc2);
+            acc3 = mul_add(_mm256_loadu_ps(row + 3 * Dim + i), x, acc3);
+          }
+          out[j] = hsum(acc0);
+          out[j + 1] = hsum(acc1);
+          out[j + 2] = hsum(acc2);
+          out[j + 3] = hsum(acc3);
+          for (; i < Dim; ++i)
+            for (int r = 0; r < 4; ++r)
+              out[j + r] += row[r * Dim + i] * q[i];
+        }
+        return j;
+      }
+#endif
+    };
+
+    /*
+    * Converts the n components at x into floats.
+    */
+    template <typename T>
+    static void to_float(const T *x, std::ptrdiff_t n, float *out) {
+      for (std::ptrdiff_t i = 0; i < n; ++i)
+        out[i] = static_cast<float>(x[i]);
+    }
+
+    static void to_float(const Mrpt_Float16 *x, std::ptrdiff_t n, float *out) {
+#ifdef MRPT_SIMD_DISPATCH
+      if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+        return half_to_float_avx2(x, n, out);
+#endif
+      to_float<Mrpt_Float16>(x, n, out);
+    }
+
+    static void to_float(const Mrpt_BFloat16 *x, std::ptrdiff_t n, float *out) {
+#ifdef MRPT_SIMD_DISPATCH
+      if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+        return half_to_float_avx2(x, n, out);
+#endif
+      to_float<Mrpt_BFloat16>(x, n, out);
+    }
+
+#ifdef MRPT_SIMD_DISPATCH
+    template <typename T>
+    MRPT_TARGET("avx2,f16c")
+    static void half_to_float_avx2(const T *x, std::ptrdiff_t n, float *out) {
+      std::ptrdiff_t i = 0;
+      for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(out + i, load_float(x + i));
+      for (; i < n; ++i)
+        out[i] = x[i];
+    }
+
+    MRPT_TARGET("avx,f16c")
+    static __m256 load_float(const Mrpt_Float16 *x) {
+      return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x)));
+    }
+
+    MRPT_TARGET("avx2")
+    static __m256 load_float(const Mrpt_BFloat16 *x) {
+      __m256i widened = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x)));
+      return _mm256_castsi256_ps(_mm256_slli_epi32(widened, 16));
+    }
+
+    MRPT_TARGET("avx2,fma")
+    static __m256 mul_add(__m256 a, __m256 b, __m256 c) {
+      return _mm256_fmadd_ps(a, b, c);
+    }
+
+    MRPT_TARGET("avx")
+    static float hsum(__m256 x) {
+      __m128 s = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+      s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+      s = _mm_add_ss(s, _mm_movehdup_ps(s));
+      return _mm_cvtss_f32(s);
+    }
+
+    MRPT_TARGET("avx2")
+    static int64_t hsum64(__m256i x) {
+      __m256i s = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(x)),
+                                   _mm256_cvtepu32_epi64(_mm256_extracti128_si256(x, 1)));
+      __m128i t = _mm_add_epi64(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+      return _mm_cvtsi128_si64(t) + _mm_extract_epi64(t, 1);
+    }
+
+    MRPT_TARGET("sse4.1")
+    static int64_t hsum64(__m128i x) {
+      __m128i s = _mm_add_epi64(_mm_cvtepu32_epi64(x), _mm_cvtepu32_epi64(_mm_unpackhi_epi64(x, x)));
+      return _mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1);
+    }
+#endif
+
+    /*
+    * Builds an autotuned index, and prunes it to the target recall level
+    * unless target_recall is negative; the pool size is tuned for the target
+    * recall level, or for pool_reference_recall if target_recall is
+    * negative. The test queries sampled from the training set are the
+    * first n_test of indices_test, and the rest of it are added to the test
+    * set if options.recall_tolerance is positive. The nearest neighbors of the test
+    * queries are searched for unless they are given as exact_. See the
+    * public versions of grow().
+    */
+    void grow_autotuned(double target_recall, const float *data, int n_test, const std::vector<int> &ks_, int trees_max,
+                        int depth_max, int depth_min_, int votes_max_, float density_, int seed,
+                        const std::vector<int> &indices_test, ptype projection_, int pool_size_,
+                        const Autotuning &options, const Eigen::MatrixXi &exact_) {
+      const Mrpt_Cost_Model &cost_model = options.cost_model;
+
+      if (!empty()) {
+        throw std::logic_error("The index has already been grown.");
+      }
+
+      if (ks_.empty()) {
+        throw std::out_of_range("At least one value of k_ must be given.");
+      }
+
+      for (int k_ : ks_) {
+        if (k_ <= 0 || k_ > n_samples) {
+          throw std::out_of_range("k_ must belong to the set {1, ..., n}.");
+        }
+      }
+
+      if (trees_max < -1 || trees_max == 0) {
+        throw std::out_of_range("trees_max must be positive.");
+      }
+
+      if (depth_max < -1 || depth_max == 0 || depth_max > std::log2(n_samples)) {
+        throw std::out_of_range("depth_max must belong to the set {1, ... , log2(n)}.");
+      }
+
+      if (depth_min_ < -1 || depth_min_ == 0 || depth_min_ > depth_max) {
+        throw std::out_of_range("depth_min_ must belong to the set {1, ... , depth_max}");
+      }
+
+      if (votes_max_ < -1 || votes_max_ == 0 || votes_max_ > trees_max) {
+        throw std::out_of_range("votes_max_ must belong to the set {1, ... , trees_max}.");
+      }
+
+      if (density_ < -1.0001 || density_ > 1.0001 || (density_ > -0.9999 && density_ < -0.0001)) {
+        throw std::out_of_range("The density must be on the interval (0,1].");
+      }
+
+      if(n_samples < 101) {
+        throw std::out_of_range("Sample size must be at least 101 to autotune an index.");
+      }
+
+      if (trees_max == - 1) {
+        trees_max = std::min(std::sqrt(n_samples), 1000.0);
+      }
+
+      if (options.trees_limit < 0 || (options.trees_limit > 0 && options.trees_limit < trees_max)) {
+        throw std::out_of_range("trees_limit must be 0 or at least trees_max.");
+      }
+
+      if (options.n_validated < 0) {
+        throw std::out_of_range("n_validated must be non-negative.");
+      }
+
+      if (options.recall_tolerance < 0 || options.test_time_limit < 0) {
+        throw std::out_of_range("recall_tolerance and test_time_limit must be non-negative.");
+      }
+
+      if (depth_min_ == -1) {
+        depth_min = std::max(static_cast<int>(std::log2(n_samples) - 11), 5);
+      } else {
+        depth_min = depth_min_;
+      }
+
+      if (depth_max == -1) {
+        depth_max = std::max(static_cast<int>(std::log2(n_samples) - 4), depth_min);
+      }
+
+      if (votes_max_ == -1) {
+        votes_max = std::max(trees_max / 10, std::min(trees_max, 10));
+      } else {
+        votes_max = votes_max_;
+      }
+
+      if (density_ < 0 || (density_ == 0 && projection_ == hadamard_projection)) {
+        density = 1.0 / std::sqrt(dim);
+      } else if (density_ == 0) {
+        density = density_grid().front();
+      } else {
+        density = density_;
+      }
+      const bool tune_density_ = density_ == 0 && projection_ != hadamard_projection;
+
+      if (pool_size_ < -1 || (pool_size_ > 0 && pool_size_ < depth_max)) {
+        throw std::out_of_range("pool_size_ must be -1, 0 or at least depth_max.");
+      }
+
+      if (!cost_model.empty() && (cost_model.dim != dim || cost_model.projection != projection_ ||
+          (!tune_density_ && std::abs(cost_model.density - density) > 0.0001) ||
+          cost_model.cpu != Mrpt_Cost_Model::cpu_id())) {
+        throw std::invalid_argument("The cost model is fitted for another data dimension, projection, density or CPU.");
+      }
+
+      if (!cost_model.empty() && (depth_min < cost_model.depth_min || depth_max > cost_model.depth_max())) {
+        throw std::out_of_range("The cost model does not cover the depths {depth_min, ..., depth_max}.");
+      }
+
+      if (options.latency_quantile != -1.0 && (options.latency_quantile <= 0.0 || options.latency_quantile > 1.0)) {
+        throw std::out_of_range("latency_quantile must be -1 or on the interval (0,1].");
+      }
+      latency_quantile = options.latency_quantile;
+
+      if (latency_quantile > 0) {
+        const int n_test_max = options.recall_tolerance > 0 ? std::max(n_test, static_cast<int>(indices_test.size()))
+                                                            : n_test;
+        const int n_cols_max = std::max(trees_max, options.trees_limit / 2 + 1);
+        if (static_cast<int64_t>(depth_max - depth_min + 1) * votes_max * n_cols_max *
+            quantile_kept(latency_quantile, n_test_max) * sizeof(int) > quantile_bytes_max) {
+          throw std::out_of_range("The candidate set sizes kept for latency_quantile would take more than 1 GiB.");
+        }
+      }
+
+      if (options.memory_budget < 0) {
+        throw std::out_of_range("memory_budget must be non-negative.");
+      }
+
+      if (options.memory_budget &&
+          index_bytes(1, depth_min, std::max(pool_size_, 0), projection_, density, depth_max) > options.memory_budget) {
+        throw std::out_of_range("The memory budget is smaller than the smallest index.");
+      }
+      memory_budget = options.memory_budget;
+
+      if (options.load_threads < -1 || options.load_threads == 0) {
+        throw std::out_of_range("load_threads must be -1 or positive.");
+      }
+
+      if (!cost_model.empty() && options.load_threads != -1 && options.load_threads != cost_model.n_threads) {
+        throw std::invalid_argument("The cost model is fitted for another number of threads.");
+      }
+      load_threads = cost_model.empty() ? options.load_threads : cost_model.n_threads;
+
+      ks = ks_;
+      std::sort(ks.begin(), ks.end());
+      ks.erase(std::unique(ks.begin(), ks.end()), ks.end());
+      k = ks.back();
+      Eigen::Map<const Eigen::MatrixXf> Q(data, dim, n_test);
+
+      // the neighbors are ordered by distance, so that the neighbors of the
+      // smaller values of k are the first ones
+      double start_all = omp_get_wtime();
+      double start = omp_get_wtime();
+      Eigen::MatrixXi exact(k, n_test);
+      if (exact_.size()) {
+        if (exact_.rows() < k || exact_.cols() != n_test) {
+          throw std::invalid_argument("The nearest neighbors must have at least k rows and one column per test query.");
+        }
+        exact = exact_.topRows(k);
+        if ((exact.array() < 0).any() || (exact.array() >= n_samples).any()) {
+          throw std::out_of_range("The nearest neighbors must belong to the set {0, ..., n - 1}.");
+        }
+      } else {
+        compute_exact(Q, exact, indices_test, ks.size() > 1);
+      }
+      double end = omp_get_wtime();
+      std::cerr << "exact search: " << end - start << std::endl;
+
+      const double reference_recall = target_recall < 0 ? pool_reference_recall : target_recall;
+      Mrpt_Cost_Model tuned_model;
+      if (tune_density_) {
+        start = omp_get_wtime();
+        density = tune_density(Q, exact, reference_recall, trees_max, depth_max, seed, projection_,
+                               std::max(pool_size_, 0), cost_model, tuned_model);
+        load_threads = tuned_model.n_threads;
+        end = omp_get_wtime();
+        std::cerr << "density tuning: " << end - start << std::endl;
+      }
+      const Mrpt_Cost_Model &model = tuned_model.empty() ? cost_model : tuned_model;
+
+      if (pool_size_ == -1) {
+        start = omp_get_wtime();
+        pool_size_ = tune_pool_size(Q, exact, reference_recall, trees_max, depth_max, seed, projection_, model);
+        end = omp_get_wtime();
+        std::cerr << "pool size tuning: " << end - start << std::endl;
+      }
+
+      autotune(Q, exact, trees_max, depth_max, seed, projection_, pool_size_, model, reference_recall);
+
+      // the test set is doubled with the next queries of indices_test until
+      // the confidence interval of the recall at the frontier point of the
+      // reference recall level is narrow enough, or the next round would end
+      // after the time limit; a round handles twice the queries of the last one
+      Eigen::MatrixXf test_queries;
+      start = omp_get_wtime();
+      double round_time = 0;
+      while (options.recall_tolerance > 0 && n_test < static_cast<int>(indices_test.size()) &&
+             (!options.test_time_limit || omp_get_wtime() - start + 2 * round_time < options.test_time_limit)) {
+        const double round_start = omp_get_wtime();
+        const Mrpt_Parameters p = parameters(reference_recall);
+        if (!p.n_trees) {
+          break;
+        }
+
+        const Eigen::VectorXd r = test_recalls(Q, exact, p);
+        const double half_width = n_test < 2 ? 1.0 :
+          1.96 * std::sqrt((r.array() - r.mean()).square().sum() / (n_test - 1) / n_test);
+        std::cerr << "recall with " << n_test << " test queries: " << p.estimated_recall
+                  << " +- " << half_width << std::endl;
+        if (half_width <= options.recall_tolerance) {
+          break;
+        }
+
+        const int n_new = std::min(n_test, static_cast<int>(indices_test.size()) - n_test);
+        const std::vector<int> indices_new(indices_test.begin() + n_test, indices_test.begin() + n_test + n_new);
+        if (test_queries.size() == 0)
+          test_queries = Q;
+        test_queries.conservativeResize(dim, n_test + n_new);
+        test_queries.rightCols(n_new) = subset(indices_new);
+
+        Eigen::MatrixXi exact_new(k, n_new);
+        const Eigen::Map<const Eigen::MatrixXf> Q_new(test_queries.data() + static_cast<std::size_t>(n_test) * dim,
+                                                      dim, n_new);
+        compute_exact(Q_new, exact_new, indices_new, ks.size() > 1);
+        exact.conservativeResize(k, n_test + n_new);
+        exact.rightCols(n_new) = exact_new;
+
+        n_test += n_new;
+        new (&Q) Eigen::Map<const Eigen::MatrixXf>(test_queries.data(), dim, n_test);
+        count_votes(Q, exact);
+        update_frontiers();
+        round_time = omp_get_wtime() - round_start;
+      }
+      if (options.recall_tolerance > 0) {
+        end = omp_get_wtime();
+        std::cerr << "test set sizing to " << n_test << " queries: " << end - start << std::endl;
+      }
+
+      // if the target recall is missed, the number of trees is doubled by
+      // growing more trees onto the index until the target or the limit is reached
+      while (target_recall >= 0 && n_trees < options.trees_limit &&
+             parameters(target_recall).estimated_recall < target_recall - epsilon &&
+             (!memory_budget || get_index_bytes(n_trees + 1, depth_min) <= memory_budget)) {
+        start = omp_get_wtime();
+        const int tree_offset = n_trees - 1;
+        add_trees(std::min(n_trees, options.trees_limit - n_trees));
+        count_votes(Q, exact, tree_offset);
+        update_frontiers();
+        end = omp_get_wtime();
+        std::cerr << "growing to " << n_trees << " trees: " << end - start << std::endl;
+      }
+
+      if (target_recall >= 0) {
+        prune(options.n_validated ? validate(Q, exact, target_recall, options.n_validated, indices_test)
+                                  : parameters(target_recall));
+      }
+
+      double end_all = omp_get_wtime();
+      std::cerr << "total autotuning time: " << end_all - start_all << std::endl << std::endl;
+    }
+
+    /*
+    * Grows trees_max trees of depth depth_max, estimates the recalls and the
+    * query times of all the parameter combinations using the test queries Q
+    * and their true nearest neighbors exact, and finds the pareto frontier.
+    * The query times are measured unless a cost model is given (only the
+    * projection times are measured if the model is of another density); if
+    * the number of threads is tuned, it is chosen for the recall level recall.
+    */
+    void autotune(const Eigen::Map<const Eigen::MatrixXf> &Q, const Eigen::MatrixXi &exact, int trees_max,
+                  int depth_max, int seed, ptype projection_, int pool_size_,
+                  const Mrpt_Cost_Model &cost_model, double recall) {
+      double start = omp_get_wtime();
+      grow(trees_max, depth_max, density, seed, 0, projection_, pool_size_);
+      double end = omp_get_wtime();
+      std::cerr << "k: " << k << std::endl;
+      std::cerr << "trees_max: " << trees_max << std::endl;
+      std::cerr << "depth_min: " << depth_min << std::endl;
+      std::cerr << "depth_max: " << depth_max << std::endl;
+      std::cerr << "votes_max: " << votes_max << std::endl;
+      std::cerr << "density: " << density << std::endl;
+      std::cerr << "projection: " << (projection == hadamard_projection ? "hadamard" :
+                                      projection == sign_projection ? "sign" :
+                                      projection == int8_projection ? "int8" : "gaussian") << std::endl;
+      std::cerr << "pool size: " << pool_size << std::endl;
+      std::cerr << std::endl;
+
+      std::cerr << "tree growing: " << end - start << " ";
+
+      start = omp_get_wtime();
+      count_votes(Q, exact);
+      end = omp_get_wtime();
+      std::cerr << "vote counting: " << end - start << " ";
+
+      start = omp_get_wtime();
+      if (cost_model.empty() && load_threads == -1) {
+        tune_threads(Q, recalls, recall);
+      } else if (cost_model.empty()) {
+        fit_times(Q);
+      } else {
+        // the models shared by the indices of tune_density() have another density
+        std::vector<int> exact_x;
+        beta_projection = std::abs(cost_model.density - density) > 0.0001 ? fit_projection_times(Q, exact_x) :
+                                                                              cost_model.projection_beta;
+        beta_exact = cost_model.exact_beta;
+        beta_voting.assign(cost_model.voting_betas.begin() + (depth_min - cost_model.depth_min),
+                           cost_model.voting_betas.begin() + (depth - cost_model.depth_min + 1));
+      }
+      end = omp_get_wtime();
+      std::cerr << "time fitting: " << end - start << " ";
+
+      start = omp_get_wtime();
+      update_frontiers();
+      end = omp_get_wtime();
+      std::cerr << "pareto frontier: " << end - start << " ";
+      std::cerr << std::endl;
+
+      index_type = autotuned_unpruned;
+      par.k = k;
+    }
+
+    /*
+    * Returns the nearest rank (counted from zero) of the quantile q of n
+    * values, i.e. the index of the quantile in the sorted values.
+    */
+    static int quantile_rank(double q, int n) {
+      return std::min(std::max(static_cast<int>(std::ceil(q * n)) - 1, 0), n - 1);
+    }
+
+    /*
+    * Returns the number of the values kept to find the quantile q of n
+    * values: the values on the nearer side of its rank, the quantile included.
+    */
+    static int quantile_kept(double q, int n) {
+      const int rank = quantile_rank(q, n);
+      return std::min(rank + 1, n - rank);
+    }
+
+    /*
+    * Estimates the recalls for each value of ks and the candidate set sizes
+    * (and their quantiles, if a latency quantile is tuned) of the indices of tree_offset + 1, ...,
+    * n_trees trees using the test queries Q and their true nearest neighbors
+    * exact. The estimates of the smaller indices are kept, so that only the
+    * votes of the trees added after tree_offset + 1 trees are counted into
+    * the estimates of the indices of more trees.
+    */
+    void count_votes(const Eigen::Map<const Eigen::MatrixXf> &Q, const Eigen::MatrixXi &exact,
+                     int tree_offset = 0) {
+      const int n_test = Q.cols(), n_depths = depth - depth_min + 1, n_cols = n_trees - tree_offset;
+      const int n_recalls = ks.size() * n_depths;
+      std::vector<Eigen::MatrixXd> new_recalls(n_recalls, Eigen::MatrixXd::Zero(votes_max, n_cols));
+      std::vector<Eigen::MatrixXd> new_cs_sizes(n_depths, Eigen::MatrixXd::Zero(votes_max, n_cols)), new_quantiles;
+
+      // if a latency quantile is tuned, a heap of each cell keeps the n_kept
+      // largest candidate set sizes of the test queries (or the smallest ones,
+      // if the quantile is below the median), so that the quantile is at its
+      // top; the sizes of a block of queries are counted before they are pushed
+      const int n_cells = votes_max * n_cols;
+      const int rank = latency_quantile < 0 ? 0 : quantile_rank(latency_quantile, n_test);
+      const int n_kept = latency_quantile < 0 ? 0 : quantile_kept(latency_quantile, n_test);
+      const bool keep_largest = n_test - rank == n_kept;
+      const auto before = [keep_largest](int a, int b) { return keep_largest ? a > b : a < b; };
+      std::vector<int> cs_heaps(static_cast<std::size_t>(n_depths) * n_cells * n_kept);
+      const int block_size = cs_heaps.empty() ? n_test : std::min(n_test, 256);
+      std::vector<int> block_cs(cs_heaps.empty() ? 0 : static_cast<std::size_t>(n_depths) * n_cells * block_size);
+
+      #pragma omp parallel
+      {
+        std::vector<Eigen::MatrixXd> thread_recalls(n_recalls, Eigen::MatrixXd::Zero(votes_max, n_cols));
+        std::vector<Eigen::MatrixXd> thread_cs_sizes(n_depths, Eigen::MatrixXd::Zero(votes_max, n_cols));
+        std::vector<Eigen::MatrixXd> query_recalls(thread_recalls), query_cs(thread_cs_sizes);
+        std::vector<int> votes(n_samples);
+        std::vector<char> is_exact(n_samples);
+
+        for (int first = 0; first < n_test; first += block_size) {
+          const int n_block = std::min(block_size, n_test - first);
+
+          #pragma omp for schedule(dynamic)
+          for (int i = first; i < first + n_block; ++i) {
+            const float *q = Q.data() + static_cast<std::ptrdiff_t>(i) * dim;
+            if (cs_heaps.empty()) {
+              count_elected(q, exact.data() + i * k, votes_max, thread_recalls, thread_cs_sizes, votes, is_exact,
+                            tree_offset);
+              continue;
+            }
+
+            for (int r = 0; r < n_recalls; ++r)
+              query_recalls[r].setZero();
+            for (int d = 0; d < n_depths; ++d)
+              query_cs[d].setZero();
+            count_elected(q, exact.data() + i * k, votes_max, query_recalls, query_cs, votes, is_exact, tree_offset);
+
+            for (int r = 0; r < n_recalls; ++r)
+              thread_recalls[r] += query_recalls[r];
+            for (int d = 0; d < n_depths; ++d) {
+              thread_cs_sizes[d] += query_cs[d];
+
+              Eigen::MatrixXd &cs = query_cs[d];
+              for (int t = 1; t < n_cols; ++t)
+                cs.col(t) += cs.col(t - 1);
+              int *out = &block_cs[static_cast<std::size_t>(d) * n_cells * block_size + (i - first)];
+              for (int c = 0; c < n_cells; ++c)
+                out[static_cast<std::size_t>(c) * block_size] = static_cast<int>(cs(c));
+            }
+          }
+
+          if (cs_heaps.empty())
+            continue;
+
+          #pragma omp for
+          for (int cell = 0; cell < n_depths * n_cells; ++cell) {
+            int *heap = &cs_heaps[static_cast<std::size_t>(cell) * n_kept];
+            const int *sizes = &block_cs[static_cast<std::size_t>(cell) * block_size];
+            for (int j = 0; j < n_block; ++j) {
+              const int n_pushed = first + j;
+              if (n_pushed < n_kept) {
+                heap[n_pushed] = sizes[j];
+                std::push_heap(heap, heap + n_pushed + 1, before);
+              } else if (before(sizes[j], heap[0])) {
+                std::pop_heap(heap, heap + n_kept, before);
+                heap[n_kept - 1] = sizes[j];
+                std::push_heap(heap, heap + n_kept, before);
+              }
+            }
+          }
+        }
+
+        #pragma omp critical
+        {
+          for (int r = 0; r < n_recalls; ++r)
+            new_recalls[r] += thread_recalls[r];
+          for (int d = 0; d < n_depths; ++d)
+            new_cs_sizes[d] += thread_cs_sizes[d];
+        }
+      }
+
+      for (int r = 0; r < n_recalls; ++r) {
+        for (int t = 1; t < n_cols; ++t)
+          new_recalls[r].col(t) += new_recalls[r].col(t - 1);
+        new_recalls[r] /= (ks[r / n_depths] * n_test);
+      }
+
+      for (int d = 0; d < n_depths; ++d) {
+        for (int t = 1; t < n_cols; ++t)
+          new_cs_sizes[d].col(t) += new_cs_sizes[d].col(t - 1);
+        new_cs_sizes[d] /= n_test;
+      }
+
+      if (!cs_heaps.empty()) {
+        for (int d = 0; d < n_depths; ++d) {
+          Eigen::MatrixXd cs_quantile(votes_max, n_cols);
+          for (int c = 0; c < n_cells; ++c)
+            cs_quantile(c) = cs_heaps[(static_cast<std::size_t>(d) * n_cells + c) * n_kept];
+          new_quantiles.push_back(cs_quantile);
+        }
+      }
+
+      recalls.resize(n_recalls);
+      for (int r = 0; r < n_recalls; ++r) {
+        recalls[r].conservativeResize(votes_max, n_trees);
+        recalls[r].rightCols(n_cols) = new_recalls[r];
+      }
+
+      cs_sizes.resize(n_depths);
+      cs_quantiles.resize(new_quantiles.size());
+      for (int d = 0; d < n_depths; ++d) {
+        cs_sizes[d].conservativeResize(votes_max, n_trees);
+        cs_sizes[d].rightCols(n_cols) = new_cs_sizes[d];
+        if (!new_quantiles.empty()) {
+          cs_quantiles[d].conservativeResize(votes_max, n_trees);
+          cs_quantiles[d].rightCols(n_cols) = new_quantiles[d];
+        }
+      }
+    }
+
+    /*
+    * Returns the densities of the random vectors compared by tune_density().
+    */
+    std::vector<float> density_grid() const {
+      std::vector<float> densities;
+      for (float f : {0.5f, 1.0f, 2.0f, 4.0f})
+        if (f / std::sqrt(dim) < 1)
+          densities.push_back(f / std::sqrt(dim));
+      densities.push_back(1);
+      return densities;
+    }
+
+    /*
+    * Returns true if the parameters candidate of a tuned index should replace
+    * best, the parameters of the best index so far (first is true for the
+    * first index): an index reaching the recall level recall is preferred
+    * and faster (as ordered on the frontier) among those reaching it; the one
+    * giving a higher recall is preferred among those not reaching it.
+    */
+    bool is_better_candidate(const Mrpt_Parameters &candidate, const Mrpt_Parameters &best,
+                             double recall, bool first) const {
+      bool reached = candidate.estimated_recall > recall - epsilon;
+      bool best_reached = best.estimated_recall > recall - epsilon;
+      auto faster = latency_quantile < 0 ? is_faster : is_faster_quantile;
+      return first || (reached && !best_reached) || (reached && faster(candidate, best)) ||
+             (!best_reached && candidate.estimated_recall > best.estimated_recall);
+    }
+
+    /*
+    * Chooses the density of the random vectors: an index is autotuned with
+    * each density of density_grid(), and the density whose index is estimated
+    * to be the fastest at the recall level recall is returned; if none of the
+    * indices reaches it, the density giving the highest recall is returned.
+    * The voting and exact search times do not depend on the density, so they
+    * are measured only for the first index (or taken from cost_model, if it
+    * is not empty) and only the projection times are measured for the
+    * others. The cost model of the chosen index is returned in model.
+    */
+    float tune_density(const Eigen::Map<const Eigen::MatrixXf> &Q, const Eigen::MatrixXi &exact, double recall,
+                       int trees_max, int depth_max, int seed, ptype projection_, int pool_size_,
+                       const Mrpt_Cost_Model &cost_model, Mrpt_Cost_Model &model) const {
+      std::vector<float> densities = density_grid();
+      Mrpt_Cost_Model shared = cost_model;
+
+      float best_density = densities[0];
+      Mrpt_Parameters best;
+      for (float d : densities) {
+        Mrpt_Index index(X);
+        index.k = k;
+        index.ks = {k};
+        index.depth_min = depth_min;
+        index.votes_max = votes_max;
+        index.density = d;
+        index.latency_quantile = latency_quantile;
+        index.memory_budget = memory_budget;
+        index.load_threads = shared.empty() ? load_threads : shared.n_threads;
+        index.autotune(Q, exact, trees_max, depth_max, seed, projection_, pool_size_, shared, recall);
+        if (shared.empty())
+          shared = index.cost_model();
+
+        Mrpt_Parameters candidate = index.parameters(recall);
+        if (is_better_candidate(candidate, best, recall, d == densities[0])) {
+          best = candidate;
+          best_density = d;
+          model = index.cost_model();
+        }
+      }
+
+      return best_density;
+    }
+
+    /*
+    * Chooses the number of random vectors shared by the trees: an index is
+    * autotuned without a shared pool and with pools of 2, 4, 8, ... times
+    * depth_max random vectors (fewer than trees_max * depth_max), and the
+    * pool size whose index is estimated to be the fastest at the recall level
+    * recall is returned; if none of the indices reaches it, the pool size
+    * giving the highest recall is returned. A pool size 0 means that the
+    * trees do not share random vectors.
+    */
+    int tune_pool_size(const Eigen::Map<const Eigen::MatrixXf> &Q, const Eigen::MatrixXi &exact,
+                       double recall, int trees_max, int depth_max, int seed, ptype projection_,
+                       const Mrpt_Cost_Model &cost_model) const {
+      std::vector<int> pool_sizes {0};
+      for (int p = 2 * depth_max; p < trees_max * depth_max; p *= 2)
+        pool_sizes.push_back(p);
+
+      int best_size = 0;
+      Mrpt_Parameters best;
+      for (int p : pool_sizes) {
+        Mrpt_Index index(X);
+        index.k = k;
+        index.ks = {k};
+        index.depth_min = depth_min;
+        index.votes_max = votes_max;
+        index.density = density;
+        index.latency_quantile = latency_quantile;
+        index.memory_budget = memory_budget;
+        index.load_threads = load_threads;
+        index.autotune(Q, exact, trees_max, depth_max, seed, projection_, p, cost_model, recall);
+
+        Mrpt_Parameters candidate = index.parameters(recall);
+        if (is_better_candidate(candidate, best, recall, p == pool_sizes[0])) {
+          best = candidate;
+          best_size = p;
+        }
+      }
+
+      return best_size;
+    }
+
+    /*
+    * Chooses the number of threads querying concurrently: the query times
+    * are fitted under the load of 1, 2, 4, ... threads up to
+    * omp_get_max_threads(), and the number giving the highest throughput at
+    * the recall level recall (or at the highest recall level if it is not
+    * reached) is kept together with its fitted times.
+    */
+    void tune_threads(const Eigen::Map<const Eigen::MatrixXf> &Q, const std::vector<Eigen::MatrixXd> &recalls,
+                      double recall) {
+      const int max_threads = omp_get_max_threads();
+      int best_threads = 1;
+      double best_qps = -1.0;
+      std::pair<double,double> best_projection, best_exact;
+      std::vector<std::map<int,std::pair<double,double>>> best_voting;
+
+      for (int t = 1; ; t = std::min(2 * t, max_threads)) {
+        load_threads = t;
+        fit_times(Q);
+        pareto_frontier(list_parameters(recalls));
+        double qps = parameters(recall).estimated_qps;
+        if (qps > best_qps) {
+          best_qps = qps;
+          best_threads = t;
+          best_projection = beta_projection;
+          best_exact = beta_exact;
+          best_voting = beta_voting;
+        }
+        if (t == max_threads)
+          break;
+      }
+
+      load_threads = best_threads;
+      beta_projection = best_projection;
+      beta_exact = best_exact;
+      beta_voting = best_voting;
+    }
+
+    void prune(double target_recall) {
+      if (target_recall < 0.0 - epsilon || target_recall > 1.0 + epsilon) {
+        throw std::out_of_range("Target recall must be on the interval [0,1].");
+      }
+
+      prune(parameters(target_recall));
+    }
+
+    /*
+    * Returns the recall of each test query of Q when the first p.n_trees
+    * trees are pruned to the depth p.depth and the vote threshold is
+    * p.votes; the spread of these gives the confidence interval of the
+    * estimated recall of the parameters p.
+    */
+    Eigen::VectorXd test_recalls(const Eigen::Map<const Eigen::MatrixXf> &Q, const Eigen::MatrixXi &exact,
+                                 const Mrpt_Parameters &p) const {
+      const int n_test = Q.cols();
+      Eigen::VectorXd out(n_test);
+
+      #pragma omp parallel
+      {
+        Eigen::VectorXf projected_query(n_pool);
+        Eigen::VectorXi elected;
+
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < n_test; ++i) {
+          project(Q.data() + static_cast<std::ptrdiff_t>(i) * dim, projected_query);
+          int n_elected = 0;
+          vote(projected_query, p.votes, elected, n_elected, p.n_trees, p.depth);
+          std::sort(elected.data(), elected.data() + n_elected);
+
+          int n_found = 0;
+          for (int l = 0; l < p.k; ++l)
+            if (exact(l, i) >= 0 && std::binary_search(elected.data(), elected.data() + n_elected, exact(l, i)))
+              ++n_found;
+          out(i) = n_found / static_cast<double>(p.k);
+        }
+      }
+
+      return out;
+    }
+
+    /*
+    * Validates the n_validated_ fastest parameters of the frontier whose
+    * estimated recall reaches the target recall: each pruned index answers
+    * the test queries Q on load_threads threads, and the parameters of the
+    * smallest measured query time (or its latency_quantile quantile) are
+    * returned. Measured recalls below the target disqualify the parameters;
+    * if all of them fall below it, the parameters of the highest measured
+    * recall are returned instead. A test query sampled from the data set
+    * (indices_test) is skipped in its own results, as in exact.
+    */
+    Mrpt_Parameters validate(const Eigen::Map<const Eigen::MatrixXf> &Q, const Eigen::MatrixXi &exact,
+                             double target_recall, int n_validated_, const std::vector<int> &indices_test) const {
+      std::vector<Mrpt_Parameters> candidates;
+      for (const auto &p : opt_pars) {
+        if (static_cast<int>(candidates.size()) == n_validated_)
+          break;
+        if (p.estimated_recall > target_recall - epsilon)
+          candidates.push_back(p);
+      }
+
+      if (candidates.empty()) {
+        return parameters(target_recall);
+      }
+
+      const int n_test = Q.cols(), n_out = k + !indices_test.empty();
+      int best = -1;
+      bool best_reaches = false;
+      for (int c = 0; c < static_cast<int>(candidates.size()); ++c) {
+        Mrpt_Parameters &p = candidates[c];
+        Mrpt_Index index2(X);
+        index2.par = p;
+        copy_pruned(index2);
+
+        std::vector<std::vector<double>> times(load_threads, std::vector<double>(n_test));
+        std::vector<std::vector<int>> results(load_threads, std::vector<int>(static_cast<std::size_t>(n_out) * n_test));
+        time_under_load([&](int thread) {
+          Eigen::VectorXi votes = Eigen::VectorXi::Zero(n_samples);
+          double projection_time, voting_time, exact_time;
+          for (int i = 0; i < n_test; ++i) {
+            votes.setZero();
+            double start = omp_get_wtime();
+            index2.query(Q.data() + static_cast<std::size_t>(i) * dim, n_out, p.votes,
+                         &results[thread][static_cast<std::size_t>(i) * n_out],
+                         projection_time, voting_time, exact_time, votes);
+            times[thread][i] = omp_get_wtime() - start;
+          }
+        });
+
+        std::vector<double> all_times;
+        for (const auto &t : times)
+          all_times.insert(all_times.end(), t.begin(), t.end());
+        if (latency_quantile > 0) {
+          const int q = quantile_rank(latency_quantile, all_times.size());
+          std::nth_element(all_times.begin(), all_times.begin() + q, all_times.end());
+          p.measured_qtime = all_times[q];
+        } else {
+          p.measured_qtime = std::accumulate(all_times.begin(), all_times.end(), 0.0) / all_times.size();
+        }
+
+        int n_correct = 0;
+        for (int i = 0; i < n_test; ++i) {
+          const int *out = &results[0][static_cast<std::size_t>(i) * n_out];
+          const int excluded = indices_test.empty() ? -1 : indices_test[i];
+          for (int j = 0, n_found = 0; j < n_out && n_found < k; ++j) {
+            if (out[j] == excluded)
+              continue;
+            ++n_found;
+            for (int l = 0; l < k; ++l) {
+              if (out[j] == exact(l, i)) {
+                ++n_correct;
+                break;
+              }
+            }
+          }
+        }
+        p.measured_recall = n_correct / static_cast<double>(k * n_test);
+
+        std::cerr << "validation: " << p.n_trees << " trees, depth " << p.depth << ", " << p.votes
+                  << " votes: estimated qtime " << (latency_quantile > 0 ? p.estimated_qtime_quantile : p.estimated_qtime)
+                  << " measured " << p.measured_qtime << ", estimated recall " << p.estimated_recall
+                  << " measured " << p.measured_recall << std::endl;
+
+        const bool reaches = p.measured_recall > target_recall - epsilon;
+        if (best < 0 || (reaches && !best_reaches) ||
+            (reaches && best_reaches && p.measured_qtime < candidates[best].measured_qtime) ||
+            (!reaches && !best_reaches && p.measured_recall > candidates[best].measured_recall)) {
+          best = c;
+          best_reaches = reaches;
+        }
+      }
+
+      return candidates[best];
+    }
+
+    /*
+    * Prunes the index in place to the trees and the depth of the parameters
+    * p of the frontier, and sets them as the parameters of the index.
+    */
+    void prune(const Mrpt_Parameters &p) {
+      par = p;
+      if (!par.n_trees) {
+        return;
+      }
+
+      int depth_max = depth;
+
+      n_trees = par.n_trees;
+      depth = par.depth;
+      votes = par.votes;
+      n_pool = depth * n_trees;
+      n_array = 1 << (depth + 1);
+
+      tree_leaves.resize(n_trees);
+      tree_leaves.shrink_to_fit();
+      split_points.conservativeResize(n_array, n_trees);
+      leaf_first_indices = leaf_first_indices_all[depth];
+      if (!leaf_offsets.empty())
+        leaf_offsets = prune_leaf_offsets(n_trees, depth_max, depth);
+
+      if (pool_size) {
+        pool_directions = prune_pool_directions(n_trees, depth_max, depth);
+      } else if (projection == int8_projection) {
+        int8_random_matrix = int8_random_matrix.tree_rows(n_trees, depth_max, depth);
+      } else if (projection == hadamard_projection) {
+        hadamard_transform = hadamard_transform.tree_rows(n_trees, depth_max, depth);
+      } else if (projection == sign_projection) {
+        sign_random_matrix = sign_random_matrix.tree_rows(n_trees, depth_max, depth);
+      } else if (density < 1) {
+        Eigen::SparseMatrix<float, Eigen::RowMajor> srm_new(n_pool, dim);
+        for (int n_tree = 0; n_tree < n_trees; ++n_tree)
+          srm_new.middleRows(n_tree * depth, depth) = sparse_random_matrix.middleRows(n_tree * depth_max, depth);
+        sparse_random_matrix = srm_new;
+      } else {
+        Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> drm_new(n_pool, dim);
+        for (int n_tree = 0; n_tree < n_trees; ++n_tree)
+          drm_new.middleRows(n_tree * depth, depth) = dense_random_matrix.middleRows(n_tree * depth_max, depth);
+        dense_random_matrix = drm_new;
+      }
+      pack_random_matrix();
+
+      index_type = autotuned;
+    }
+
+    /*
+    * Projects the vector q onto the random vectors of all the levels of all
+    * the trees. If the trees share a pool of random vectors, q is projected
+    * onto the pool, and the projections are gathered by level.
+    */
+    void project(const float *q, Eigen::VectorXf &projected_query) const {
+      if (!pool_size) {
+        project_random_vectors(q, projected_query);
+        return;
+      }
+
+      Eigen::VectorXf pool_query(pool_size);
+      project_random_vectors(q, pool_query);
+      for (int j = 0; j < n_pool; ++j)
+        projected_query(j) = pool_query(pool_directions[j]);
+    }
+
+    /*
+    * Projects the vector q onto all the rows of the random matrix.
+    */
+    void project_random_vectors(const float *q, Eigen::VectorXf &projected_query) const {
+      const int n_rows = matrix_rows();
+      if (projection == int8_projection)
+        int8_random_matrix.multiply(q, projected_query.data(), 0, n_rows);
+      else if (projection == hadamard_projection)
+        hadamard_transform.multiply(q, projected_query.data());
+      else if (projection == sign_projection)
+        sign_random_matrix.multiply(q, projected_query.data(), 0, n_rows);
+      else if (!sell_random_matrix.empty())
+        sell_random_matrix.multiply(q, projected_query.data(), 0, n_rows);
+      else if (density < 1)
+        projected_query.noalias() = sparse_random_matrix * Eigen::Map<const Eigen::VectorXf>(q, dim);
+      else if (!with_fixed_dim(dim, [&](auto kernels) {
+                 kernels.multiply(dense_random_matrix.data(), q, projected_query.data(), n_rows);
+               }))
+        projected_query.noalias() = dense_random_matrix * Eigen::Map<const Eigen::VectorXf>(q, dim);
+    }
+
+    /*
+    * Projects the data points col_begin, ..., col_begin + n_cols - 1 onto the
+    * rows row_begin, ..., row_begin + n_rows - 1 of the random matrix, and
+    * writes the projections of each point contiguously into out. The
+    * quantized data points are given in data_uint8 if the projections are
+    * quantized.
+    */
+    void project_data(int row_begin, int n_rows, int col_begin, int n_cols, const uint8_t *data_uint8,
+                      float *out) const {
+      Eigen::Map<Eigen::MatrixXf> projections(out, n_rows, n_cols);
+      Eigen::MatrixXf buffer;
+      const float *x = projection == int8_projection ? nullptr : float_data(col_begin, n_cols, buffer);
+      const Eigen::Map<const Eigen::MatrixXf> points(x, dim, n_cols);
+
+      if (projection == sign_projection) {
+        for (int i = 0; i < n_cols; ++i)
+          sign_random_matrix.multiply(x + static_cast<std::ptrdiff_t>(i) * dim,
+                                      out + static_cast<std::ptrdiff_t>(i) * n_rows, row_begin, n_rows);
+      } else if (projection == int8_projection) {
+        const int stride = int8_random_matrix.stride;
+        for (int i = 0; i < n_cols; ++i)
+          int8_random_matrix.multiply(data_uint8 + static_cast<std::ptrdiff_t>(col_begin + i) * stride,
+                                      out + static_cast<std::ptrdiff_t>(i) * n_rows, row_begin, n_rows);
+      } else if (projection == hadamard_projection) {
+        projections.noalias() = hadamard_transform.dense_rows(row_begin, n_rows) * points;
+      } else if (!sell_random_matrix.empty()) {
+        for (int i = 0; i < n_cols; ++i)
+          sell_random_matrix.multiply(x + static_cast<std::ptrdiff_t>(i) * dim,
+                                      out + static_cast<std::ptrdiff_t>(i) * n_rows, row_begin, n_rows);
+      } else if (density < 1) {
+        projections.noalias() = sparse_random_matrix.middleRows(row_begin, n_rows) * points;
+      } else {
+        projections.noalias() = dense_random_matrix.middleRows(row_begin, n_rows) * points;
+      }
+    }
+
+    /*
+    * Returns a pointer to the data points col_begin, ..., col_begin + n_cols - 1
+    * as floats; the points of the data sets not stored as floats are
+    * converted into buffer.
+    */
+    const float *float_data(int col_begin, int n_cols, Eigen::MatrixXf &buffer) const {
+      if (std::is_same<Scalar, float>::value)
+        return reinterpret_cast<const float *>(X.data()) + static_cast<std::ptrdiff_t>(col_begin) * dim;
+      buffer.resize(dim, n_cols);
+      to_float(X.data() + static_cast<std::ptrdiff_t>(col_begin) * dim, buffer.size(), buffer.data());
+      return buffer.data();
+    }
+
+    /*
+    * Returns the number of rows of the random matrix: the size of the shared
+    * pool, or the number of levels of all the trees if there is no pool.
+    */
+    int matrix_rows() const {
+      return pool_size ? pool_size : n_pool;
+    }
+
+    /*
+    * Draws the indices of the random vectors of each level of each tree from
+    * a pool of pool_size vectors, such that each tree uses depth distinct
+    * vectors in a random order; the choices of each tree are made using
+    * their own Philox stream.
+    */
+    static void build_pool_directions(std::vector<int> &pool_directions, int n_trees, int depth,
+                                      int pool_size, int seed) {
+      pool_directions.resize(static_cast<std::size_t>(n_trees) * depth);
+
+      #pragma omp parallel for
+      for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
+        Philox gen(~static_cast<uint32_t>(seed), n_tree);
+        std::vector<int> pool(pool_size);
+        std::iota(pool.begin(), pool.end(), 0);
+        for (int d = 0; d < depth; ++d) {
+          int j = d + gen() % (pool_size - d);
+          std::swap(pool[d], pool[j]);
+          pool_directions[n_tree * depth + d] = pool[d];
+        }
+      }
+    }
+
+    /*
+    * Returns the pool indices of the random vectors of the first n_trees_new
+    * trees, when the trees grown to the depth depth_old are pruned to the
+    * depth depth_new.
+    */
+    std::vector<int> prune_pool_directions(int n_trees_new, int depth_old, int depth_new) const {
+      std::vector<int> directions;
+      for (int n_tree = 0; n_tree < n_trees_new; ++n_tree)
+        for (int d = 0; d < depth_new; ++d)
+          directions.push_back(pool_directions[n_tree * depth_old + d]);
+      return directions;
+    }
+
+    /*
+    * Packs a sparse Gaussian random matrix into the SELL format used to
+    * compute the projections; the data sets whose dimension does not fit
+    * into 16-bit column indices use the Eigen matrix.
+    */
+    void pack_random_matrix() {
+      if (projection == gaussian_projection && density < 1 && dim <= Sell_Matrix::max_cols)
+        sell_random_matrix = Sell_Matrix(sparse_random_matrix);
+      else
+        sell_random_matrix = Sell_Matrix();
+    }
+
+    /*
+    * Counts the votes of the query q at each depth, and adds to the element
+    * (v - 1, t) of cs_sizes the number of the data points which get their
+    * v:th vote from the tree t, and of recalls the number of those which are
+    * true nearest neighbors; the cumulative sums over the trees then give the
+    * candidate set sizes and the recalls of the indices of 1, 2, ... trees.
+    * If several values of k are autotuned for, the recalls of each value of
+    * ks are in consecutive blocks of depths, and the true nearest neighbors in
+    * exact are ordered by distance. The votes of the trees 0, ..., tree_offset are added into the column 0
+    * and those of a later tree t into the column t - tree_offset, so that
+    * only the columns of the trees added after tree_offset are counted.
+    * votes and is_exact are the work space of the calling thread, of
+    * n_samples zeros each; the elements touched are reset before returning.
+    */
+    void count_elected(const float *q, const int *exact, int votes_max, std::vector<Eigen::MatrixXd> &recalls,
+                       std::vector<Eigen::MatrixXd> &cs_sizes, std::vector<int> &votes,
+                       std::vector<char> &is_exact, int tree_offset = 0) const {
+      Eigen::VectorXf projected_query(n_pool);
+      project(q, projected_query);
+
+      const int n_depths = cs_sizes.size(), depth_min = depth - n_depths + 1, n_ks = recalls.size() / n_depths;
+      std::vector<int> start_indices(static_cast<std::size_t>(n_trees) * n_depths);
+
+      for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
+        int idx_tree = 0;
+        for (int d = 0; d < depth; ++d) {
+          const int j = n_tree * depth + d;
+          const int idx_left = 2 * idx_tree + 1;
+          const int idx_right = idx_left + 1;
+          const float split_point = split_points(idx_tree, n_tree);
+          if (projected_query(j) <= split_point) {
+            idx_tree = idx_left;
+          } else {
+            idx_tree = idx_right;
+          }
+          if (d >= depth_min - 1)
+            start_indices[n_tree * n_depths + d - depth_min + 1] = idx_tree - (1 << (d + 1)) + 1;
+        }
+      }
+
+      // a true nearest neighbor is marked by the index of the smallest k for which it is one, plus one
+      for (int i = 0, j = 0; i < k; ++i) {
+        while (j < n_ks - 1 && i >= ks[j])
+          ++j;
+        if (exact[i] >= 0)
+          is_exact[exact[i]] = j + 1;
+      }
+
+      for (int depth_crnt = depth_min; depth_crnt <= depth; ++depth_crnt) {
+        Eigen::MatrixXd &candidate_set_size = cs_sizes[depth_crnt - depth_min];
+
+        for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
+          const int leaf = start_indices[n_tree * n_depths + depth_crnt - depth_min];
+          const int leaf_begin = leaf_first_index(n_tree, leaf, depth_crnt);
+          const int leaf_end = leaf_first_index(n_tree, leaf + 1, depth_crnt);
+
+          const std::vector<int> &indices = tree_leaves[n_tree];
+          const int column = std::max(n_tree - tree_offset, 0);
+          for (int i = leaf_begin; i < leaf_end; ++i) {
+            int idx = indices[i];
+            int v = ++votes[idx];
+            if (v <= votes_max) {
+              candidate_set_size(v - 1, column)++;
+              if (is_exact[idx])
+                for (int j = is_exact[idx] - 1; j < n_ks; ++j)
+                  recalls[j * n_depths + depth_crnt - depth_min](v - 1, column)++;
+            }
+          }
+        }
+
+        for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
+          const int leaf = start_indices[n_tree * n_depths + depth_crnt - depth_min];
+          const int leaf_end = leaf_first_index(n_tree, leaf + 1, depth_crnt);
+          const std::vector<int> &indices = tree_leaves[n_tree];
+          for (int i = leaf_first_index(n_tree, leaf, depth_crnt); i < leaf_end; ++i)
+            votes[indices[i]] = 0;
+        }
+      }
+
+      for (int i = 0; i < k; ++i)
+        if (exact[i] >= 0)
+          is_exact[exact[i]] = 0;
+    }
+
+    enum gtype {legacy, philox}; // generators of the random vectors
+
+    /**
+    * Counter-based random number generator Philox4x32-10 (Salmon et al. 2011).
+    * A stream is identified by a seed and a stream number (a row of a random
+    * matrix), and its output depends on nothing else, so that streams can be
+    * generated in parallel and in any order with identical results.
+    */
+    class Philox {
+     public:
+      Philox(uint32_t seed, uint32_t stream) : key{seed, 0x4d525054}, ctr{0, stream, 0, 0} {}
+
+      uint32_t operator()() {
+        if (pos == 4) {
+          generate();
+          pos = 0;
+        }
+        return out[pos++];
+      }
+
+      // uniform on the open interval (0,1)
+      double uniform() {
+        return ((*this)() + 0.5) * (1.0 / 4294967296.0);
+      }
+
+      // standard normal by the Box-Muller transform
+      float normal() {
+        if (has_spare) {
+          has_spare = false;
+          return spare;
+        }
+        double r = std::sqrt(-2.0 * std::log(uniform()));
+        double theta = 6.283185307179586 * uniform();
+        spare = r * std::sin(theta);
+        has_spare = true;
+        return r * std::cos(theta);
+      }
+
+     private:
+      void generate() {
+        uint32_t c[4] = {ctr[0], ctr[1], ctr[2], ctr[3]};
+        uint32_t k[2] = {key[0], key[1]};
+        for (int round = 0; round < 10; ++round) {
+          uint64_t p0 = static_cast<uint64_t>(0xd2511f53) * c[0];
+          uint64_t p1 = static_cast<uint64_t>(0xcd9e8d57) * c[2];
+          uint32_t c0 = static_cast<uint32_t>(p1 >> 32) ^ c[1] ^ k[0];
+          uint32_t c2 = static_cast<uint32_t>(p0 >> 32) ^ c[3] ^ k[1];
+          c[1] = static_cast<uint32_t>(p1);
+          c[3] = static_cast<uint32_t>(p0);
+          c[0] = c0;
+          c[2] = c2;
+          k[0] += 0x9e3779b9;
+          k[1] += 0xbb67ae85;
+        }
+        std::copy(c, c + 4, out);
+        if (!++ctr[0]) ++ctr[2];
+      }
+
+      uint32_t key[2];
+      uint32_t ctr[4];
+      uint32_t out[4];
+      int pos = 4;
+      bool has_spare = false;
+      float spare = 0;
+    };
+
+    /**
+    * Sparse random matrix whose non-zero components are +1 or -1, stored in
+    * a compressed row format. Each entry of `inner` holds the column index of
+    * a non-zero component in its lower 31 bits and its sign in the highest
+    * bit, so that the matrix takes half the memory of a sparse float matrix
+    * with the same non-zeros.
+    */
+    struct Sign_Matrix {
+      // inner product of the row j and the vector q
+      float dot(int j, const float *q) const {
+        const uint32_t *first = inner.data() + outer[j];
+        const uint32_t *last = inner.data() + outer[j + 1];
+        float sum = 0;
+#ifdef MRPT_SIMD_DISPATCH
+        if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+          sum = dot_avx2(first, last, q);
+#endif
+        for (; first < last; ++first) {
+          float v = q[*first & 0x7fffffff];
+          sum += *first >> 31 ? -v : v;
+        }
+        return sum;
+      }
+
+      // products of the rows row_begin, ... , row_begin + n_rows - 1 and the vector q
+      void multiply(const float *q, float *out, int row_begin, int n_rows) const {
+        for (int j = 0; j < n_rows; ++j)
+          out[j] = dot(row_begin + j, q);
+      }
+
+#ifdef MRPT_SIMD_DISPATCH
+      // sums the non-zeros from first in blocks of eight, and advances first past them
+      MRPT_TARGET("avx2")
+      static float dot_avx2(const uint32_t *&first, const uint32_t *last, const float *q) {
+        const __m256i index_mask = _mm256_set1_epi32(0x7fffffff);
+        __m256 acc = _mm256_setzero_ps();
+        for (; last - first >= 8; first += 8) {
+          __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+          __m256 v = _mm256_i32gather_ps(q, _mm256_and_si256(e, index_mask), 4);
+          __m256 sign = _mm256_castsi256_ps(_mm256_andnot_si256(index_mask, e));
+          acc = _mm256_add_ps(acc, _mm256_xor_ps(v, sign));
+        }
+        return hsum(acc);
+      }
+#endif
+
+      // first depth_new rows of each of the first n_trees trees of depth depth_old
+      Sign_Matrix tree_rows(int n_trees, int depth_old, int depth_new) const {
+        Sign_Matrix m;
+        m.rows = n_trees * depth_new;
+        m.cols = cols;
+        for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
+          for (int d = 0; d < depth_new; ++d) {
+            int j = n_tree * depth_old + d;
+            m.inner.insert(m.inner.end(), inner.begin() + outer[j], inner.begin() + outer[j + 1]);
+            m.outer.push_back(m.inner.size());
+          }
+        }
+        return m;
+      }
+
+      int nonZeros() const {
+        return inner.size();
+      }
+
+      int rows = 0;
+      int cols = 0;
+      std::vector<int> outer = std::vector<int>(1); // row j is inner[outer[j]], ... , inner[outer[j + 1] - 1]
+      std::vector<uint32_t> inner;
+    };
+
+    /**
+    * Builds a random sparse matrix for use in random projection. The components of
+    * the matrix are drawn from the distribution
+    *
+    *       0 w.p. 1 - a
+    * N(0, 1) w.p. a
+    *
+    * where a = density. Each row is generated from its own Philox stream
+    * (seed, row), and the positions of the non-zero components are drawn
+    * directly by geometric skipping, so that the cost is proportional to the
+    * number of non-zeros and the result does not depend on the number of
+    * threads. The legacy generator draws all the components from a single
+    * std::mt19937.
+    *
+    * The rows of trees pruned from a depth row_stride to a depth tree_depth
+    * can be regenerated by setting these parameters: then row j is taken
+    * from the stream of the row (j / tree_depth) * row_stride + j % tree_depth
+    * of the original matrix.
+    */
+    static void build_sparse_random_matrix(Eigen::SparseMatrix<float, Eigen::RowMajor> &sparse_random_matrix,
+                                           int n_row, int n_col, float density, int seed = 0,
+                                           gtype generator = philox, int tree_depth = 1, int row_stride = 1) {
+      sparse_random_matrix = Eigen::SparseMatrix<float, Eigen::RowMajor>(n_row, n_col);
+
+      std::random_device rd;
+      int s = seed ? seed : rd();
+
+      if (generator == legacy) {
+        std::mt19937 gen(s);
+        std::uniform_real_distribution<float> uni_dist(0, 1);
+        std::normal_distribution<float> norm_dist(0, 1);
+
+        std::vector<Eigen::Triplet<float>> triplets;
+        for (int j = 0; j < n_row; ++j) {
+          for (int i = 0; i < n_col; ++i) {
+            if (uni_dist(gen) > density) continue;
+            triplets.push_back(Eigen::Triplet<float>(j, i, norm_dist(gen)));
+          }
+        }
+
+        sparse_random_matrix.setFromTriplets(triplets.begin(), triplets.end());
+        sparse_random_matrix.makeCompressed();
+        return;
+      }
+
+      std::vector<std::vector<std::pair<int,float>>> rows(n_row);
+      const double log_q = std::log1p(-static_cast<double>(density));
+
+      #pragma omp parallel for
+      for (int j = 0; j < n_row; ++j) {
+        Philox gen(s, (j / tree_depth) * row_stride + j % tree_depth);
+        std::vector<std::pair<int,float>> &row = rows[j];
+        row.reserve(density * n_col * 1.5 + 4);
+        for (int i = 0; ; ++i) {
+          i += static_cast<int>(std::min(std::floor(std::log(gen.uniform()) / log_q),
+                                         static_cast<double>(n_col)));
+          if (i >= n_col) break;
+          row.push_back(std::make_pair(i, gen.normal()));
+        }
+      }
+
+      int *outer = sparse_random_matrix.outerIndexPtr();
+      outer[0] = 0;
+      for (int j = 0; j < n_row; ++j)
+        outer[j + 1] = outer[j] + rows[j].size();
+      sparse_random_matrix.resizeNonZeros(outer[n_row]);
+
+      int *inner = sparse_random_matrix.innerIndexPtr();
+      float *values = sparse_random_matrix.valuePtr();
+
+      #pragma omp parallel for
+      for (int j = 0; j < n_row; ++j) {
+        for (int l = 0; l < (int) rows[j].size(); ++l) {
+          inner[outer[j] + l] = rows[j][l].first;
+          values[outer[j] + l] = rows[j][l].second;
+        }
+      }
+    }
+
+    /*
+    * Builds a random dense matrix for use in random projection. The components of
+    * the matrix are drawn from the standard normal distribution. Each row is
+    * generated from its own Philox stream (seed, row) unless the legacy
+    * generator is requested; tree_depth and row_stride are used as in
+    * build_sparse_random_matrix().
+    */
+    static void build_dense_random_matrix(Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> &dense_random_matrix,
+                                          int n_row, int n_col, int seed = 0, gtype generator = philox,
+                                          int tree_depth = 1, int row_stride = 1) {
+      dense_random_matrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>(n_row, n_col);
+
+      std::random_device rd;
+      int s = seed ? seed : rd();
+
+      if (generator == legacy) {
+        std::mt19937 gen(s);
+        std::normal_distribution<float> normal_dist(0, 1);
+
+        std::generate(dense_random_matrix.data(), dense_random_matrix.data() + n_row * n_col,
+                      [&normal_dist, &gen] { return normal_dist(gen); });
+        return;
       }
 
-      grow_subtree(begin, mid, tree_level + 1, idx_left, n_tree, tree_projections);
-      grow_subtree(mid, end, tree_level + 1, idx_right, n_tree, tree_projections);
+      #pragma omp parallel for
+      for (int j = 0; j < n_row; ++j) {
+        Philox gen(s, (j / tree_depth) * row_stride + j % tree_depth);
+        float *row = dense_random_matrix.data() + static_cast<std::ptrdiff_t>(j) * n_col;
+        for (int i = 0; i < n_col; ++i)
+          row[i] = gen.normal();
+      }
     }
 
     /**
-    * Find k nearest neighbors from data for the query point
+    * Random matrix quantized to 8-bit integers. Row j is stored as
+    * round(r_j * 63 / max_i |r_ji|), padded with zeros to `stride` columns,
+    * and scales[j] = max_i |r_ji| / 63 converts the integer products back to
+    * the scale of the original matrix. The components are limited to
+    * [-63, 63] so that the sums of pairs of products of an 8-bit unsigned
+    * component and a matrix component fit into the 16-bit lanes of AVX2
+    * pmaddubsw; the products are then exact, and identical with the VNNI
+    * dot product instructions and the scalar code.
     */
-    void exact_knn(const Eigen::Map<const Eigen::VectorXf> &q, int k, const Eigen::VectorXi &indices,
-                   int n_elected, int *out, float *out_distances = nullptr) const {
+    struct Int8_Matrix {
+      static const int width = 32; // number of components processed at a time
+
+      Int8_Matrix() {}
+
+      Int8_Matrix(int rows_, int cols_) : rows(rows_), cols(cols_), stride((cols_ + width - 1) / width * width),
+        values(static_cast<std::size_t>(rows_) * stride), scales(rows_) {}
+
+      // quantizes row j of a float matrix
+      void set_row(int j, const float *row) {
+        float max_abs = 0;
+        for (int i = 0; i < cols; ++i)
+          max_abs = std::max(max_abs, std::abs(row[i]));
+        scales[j] = max_abs > 0 ? max_abs / 63 : 1;
+        int8_t *out = values.data() + static_cast<std::ptrdiff_t>(j) * stride;
+        for (int i = 0; i < cols; ++i)
+          out[i] = static_cast<int8_t>(std::lround(row[i] / scales[j]));
+      }
 
-      if (!n_elected) {
-        for (int i = 0; i < k; ++i)
-          out[i] = -1;
+      // integer product of row j and the vector q of stride components
+      int32_t dot(int j, const uint8_t *q) const {
+        const int8_t *w = values.data() + static_cast<std::ptrdiff_t>(j) * stride;
+#ifdef MRPT_SIMD_DISPATCH
+        if (Mrpt_Simd::current() >= Mrpt_Simd::avx512 && Mrpt_Simd::vnni())
+          return dot_vnni(q, w, stride);
+        if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+          return dot_avx2(q, w, stride);
+#endif
+        int32_t sum = 0;
+        for (int i = 0; i < cols; ++i)
+          sum += static_cast<int32_t>(q[i]) * w[i];
+        return sum;
+      }
 
-        if (out_distances) {
-          for (int i = 0; i < k; ++i)
-            out_distances[i] = -1;
-        }
+#ifdef MRPT_SIMD_DISPATCH
+      MRPT_TARGET("avx512f,avx512vl,avx512vnni")
+      static int32_t dot_vnni(const uint8_t *q, const int8_t *w, int stride) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int i = 0; i < stride; i += width)
+          acc = _mm256_dpbusd_epi32(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(q + i)),
+                                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w + i)));
+        return hsum(acc);
+      }
 
-        return;
+      MRPT_TARGET("avx2")
+      static int32_t dot_avx2(const uint8_t *q, const int8_t *w, int stride) {
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i acc = _mm256_setzero_si256();
+        for (int i = 0; i < stride; i += width) {
+          __m256i pairs = _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(q + i)),
+                                               _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w + i)));
+          acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+        }
+        return hsum(acc);
       }
+#endif
 
-      Eigen::VectorXf distances(n_elected);
+      // products of the rows row_begin, ... , row_begin + n_rows - 1 and the quantized vector q
+      void multiply(const uint8_t *q, float *out, int row_begin, int n_rows) const {
+        for (int j = 0; j < n_rows; ++j)
+          out[j] = dot(row_begin + j, q) * scales[row_begin + j];
+      }
 
-      #pragma omp parallel for
-      for (int i = 0; i < n_elected; ++i)
-        distances(i) = (X.col(indices(i)) - q).squaredNorm();
+      // products of the rows row_begin, ... , row_begin + n_rows - 1 and the vector q
+      void multiply(const float *q, float *out, int row_begin, int n_rows) const {
+        std::vector<uint8_t> q_uint8(stride);
+        quantize(q, cols, stride, q_uint8.data());
+        multiply(q_uint8.data(), out, row_begin, n_rows);
+      }
 
-      if (k == 1) {
-        Eigen::MatrixXf::Index index;
-        distances.minCoeff(&index);
-        out[0] = n_elected ? indices(index) : -1;
+      // first depth_new rows of each of the first n_trees trees of depth depth_old
+      Int8_Matrix tree_rows(int n_trees, int depth_old, int depth_new) const {
+        Int8_Matrix m(n_trees * depth_new, cols);
+        for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
+          for (int d = 0; d < depth_new; ++d) {
+            int j = n_tree * depth_old + d, j_new = n_tree * depth_new + d;
+            std::copy(values.begin() + static_cast<std::ptrdiff_t>(j) * stride,
+                      values.begin() + static_cast<std::ptrdiff_t>(j + 1) * stride,
+                      m.values.begin() + static_cast<std::ptrdiff_t>(j_new) * stride);
+            m.scales[j_new] = scales[j];
+          }
+        }
+        return m;
+      }
 
-        if (out_distances)
-          out_distances[0] = n_elected ? std::sqrt(distances(index)) : -1;
+      // rounds the components of x to the nearest integers on [0, 255] and pads them with zeros
+      template <typename T>
+      static void quantize(const T *x, int n, int stride, uint8_t *out) {
+        for (int i = 0; i < n; ++i)
+          out[i] = static_cast<uint8_t>(std::min(std::max(static_cast<float>(x[i]), 0.0f), 255.0f) + 0.5f);
+        std::fill(out + n, out + stride, 0);
+      }
 
-        return;
+#ifdef MRPT_SIMD_DISPATCH
+      MRPT_TARGET("avx2")
+      static int32_t hsum(__m256i x) {
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+        return _mm_cvtsi128_si32(s);
       }
+#endif
 
-      int n_to_sort = n_elected > k ? k : n_elected;
-      Eigen::VectorXi idx(n_elected);
-      std::iota(idx.data(), idx.data() + n_elected, 0);
-      std::partial_sort(idx.data(), idx.data() + n_to_sort, idx.data() + n_elected,
-                       [&distances](int i1, int i2) { return distances(i1) < distances(i2); });
+      int rows = 0;
+      int cols = 0;
+      int stride = 0; // number of columns padded to a multiple of width
+      std::vector<int8_t> values; // quantized components, rows x stride, row-major
+      std::vector<float> scales; // scale of each row
+    };
 
-      for (int i = 0; i < k; ++i)
-        out[i] = i < n_elected ? indices(idx(i)) : -1;
+    /**
+    * Sparse matrix in the SELL-C-sigma format with C = 8 and sigma = 8: the
+    * rows are grouped into chunks of eight consecutive rows, each chunk is
+    * padded to the length of its longest row, and the non-zeros of a chunk
+    * are stored slot by slot, so that a slot holds one non-zero (or zero
+    * padding) of each of its eight rows. The products of a chunk are then
+    * computed in the lanes of one AVX2 register. Column indices are stored as
+    * 16-bit integers, so the number of columns is limited to max_cols.
+    * Sorting the rows by their lengths over windows larger than a chunk is
+    * left out, since the rows of the random matrices have binomially
+    * distributed lengths and the rows of a tree must stay consecutive.
+    */
+    struct Sell_Matrix {
+      static const int C = 8;
+      static const int max_cols = 1 << 16;
+
+      Sell_Matrix() {}
+
+      explicit Sell_Matrix(const Eigen::SparseMatrix<float, Eigen::RowMajor> &m) : rows(m.rows()), cols(m.cols()) {
+        const int n_chunks = (rows + C - 1) / C;
+        const int *outer = m.outerIndexPtr();
+        chunk_offsets.resize(n_chunks + 1);
+        for (int c = 0; c < n_chunks; ++c) {
+          int length = 0;
+          for (int j = c * C; j < std::min((c + 1) * C, rows); ++j)
+            length = std::max(length, outer[j + 1] - outer[j]);
+          chunk_offsets[c + 1] = chunk_offsets[c] + length;
+        }
 
-      if (out_distances) {
-        for (int i = 0; i < k; ++i)
-          out_distances[i] = i < n_elected ? std::sqrt(distances(idx(i))) : -1;
+        columns.assign(static_cast<std::size_t>(chunk_offsets[n_chunks]) * C, 0);
+        values.assign(columns.size(), 0);
+        for (int j = 0; j < rows; ++j) {
+          std::size_t slot = static_cast<std::size_t>(chunk_offsets[j / C]) * C + j % C;
+          for (int l = outer[j]; l < outer[j + 1]; ++l, slot += C) {
+            columns[slot] = m.innerIndexPtr()[l];
+            values[slot] = m.valuePtr()[l];
+          }
+        }
       }
-    }
 
-    void prune(double target_recall) {
-      if (target_recall < 0.0 - epsilon || target_recall > 1.0 + epsilon) {
-        throw std::out_of_range("Target recall must be on the interval [0,1].");
+      // products of the rows row_begin, ... , row_begin + n_rows - 1 and the vector q
+      void multiply(const float *q, float *out, int row_begin, int n_rows) const {
+        const int row_end = row_begin + n_rows;
+        for (int c = row_begin / C; c * C < row_end; ++c) {
+          float sums[C];
+          chunk_dot(c, q, sums);
+          for (int j = std::max(c * C, row_begin); j < std::min((c + 1) * C, row_end); ++j)
+            out[j - row_begin] = sums[j - c * C];
+        }
       }
 
-      par = parameters(target_recall);
-      if (!par.n_trees) {
-        return;
+      // products of the eight rows of the chunk c and the vector q
+      void chunk_dot(int c, const float *q, float *sums) const {
+        const uint16_t *col = columns.data() + static_cast<std::size_t>(chunk_offsets[c]) * C;
+        const float *val = values.data() + static_cast<std::size_t>(chunk_offsets[c]) * C;
+        const int length = chunk_offsets[c + 1] - chunk_offsets[c];
+#ifdef MRPT_SIMD_DISPATCH
+        if (Mrpt_Simd::current() >= Mrpt_Simd::avx2)
+          return chunk_dot_avx2(col, val, length, q, sums);
+#endif
+        std::fill(sums, sums + C, 0.0f);
+        for (int l = 0; l < length; ++l, col += C, val += C)
+          for (int i = 0; i < C; ++i)
+            sums[i] += val[i] * q[col[i]];
       }
 
-      int depth_max = depth;
+#ifdef MRPT_SIMD_DISPATCH
+      MRPT_TARGET("avx2")
+      static void chunk_dot_avx2(const uint16_t *col, const float *val, int length, const float *q, float *sums) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        int l = 0;
+        for (; l + 1 < length; l += 2, col += 2 * C, val += 2 * C) {
+          __m256i idx0 = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(col)));
+          __m256i idx1 = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(col + C)));
+          acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(val), _mm256_i32gather_ps(q, idx0, 4)));
+          acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(val + C), _mm256_i32gather_ps(q, idx1, 4)));
+        }
+        if (l < length) {
+          __m256i idx0 = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(col)));
+          acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(val), _mm256_i32gather_ps(q, idx0, 4)));
+        }
+        _mm256_storeu_ps(sums, _mm256_add_ps(acc0, acc1));
+      }
+#endif
 
-      n_trees = par.n_trees;
-      depth = par.depth;
-      votes = par.votes;
-      n_pool = depth * n_trees;
-      n_array = 1 << (depth + 1);
+      bool empty() const {
+        return rows == 0;
+      }
 
-      tree_leaves.resize(n_trees);
-      tree_leaves.shrink_to_fit();
-      split_points.conservativeResize(n_array, n_trees);
-      leaf_first_indices = leaf_first_indices_all[depth];
+      int rows = 0;
+      int cols = 0;
+      std::vector<int> chunk_offsets = std::vector<int>(1); // first slot of each chunk
+      std::vector<uint16_t> columns; // column indices of the non-zeros, chunk by chunk and slot by slot
+      std::vector<float> values; // values of the non-zeros in the same order
+    };
 
-      if (density < 1) {
-        Eigen::SparseMatrix<float, Eigen::RowMajor> srm_new(n_pool, dim);
-        for (int n_tree = 0; n_tree < n_trees; ++n_tree)
-          srm_new.middleRows(n_tree * depth, depth) = sparse_random_matrix.middleRows(n_tree * depth_max, depth);
-        sparse_random_matrix = srm_new;
-      } else {
-        Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> drm_new(n_pool, dim);
-        for (int n_tree = 0; n_tree < n_trees; ++n_tree)
-          drm_new.middleRows(n_tree * depth, depth) = dense_random_matrix.middleRows(n_tree * depth_max, depth);
-        dense_random_matrix = drm_new;
+    /**
+    * Structured random vectors given by random sign flips, a fast
+    * Walsh-Hadamard transform and subsampling. A vector is padded with zeros
+    * to the dimension `size`, a power of two, and each block b of the
+    * transform computes \f$H D_b x\f$, where \f$D_b\f$ is a diagonal matrix
+    * of random signs and \f$H\f$ is the (unnormalized) Hadamard matrix of
+    * order `size`. The random vector j is the row rows[j] % size of
+    * \f$H D_b\f$, where b = rows[j] / size.
+    */
+    struct Hadamard_Transform {
+      // projections of the vector q onto all the random vectors
+      void multiply(const float *q, float *out) const {
+        std::vector<float> buffer(signs.size());
+        for (int b = 0; b < n_blocks(); ++b) {
+          float *y = buffer.data() + static_cast<std::ptrdiff_t>(b) * size;
+          const float *s = signs.data() + static_cast<std::ptrdiff_t>(b) * size;
+          for (int i = 0; i < dim; ++i)
+            y[i] = q[i] * s[i];
+          fwht(y, size);
+        }
+        for (int j = 0; j < (int) rows.size(); ++j)
+          out[j] = buffer[rows[j]];
       }
 
-      index_type = autotuned;
-    }
+      // random vectors row_begin, ... , row_begin + n_rows - 1 as a dense matrix
+      Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> dense_rows(int row_begin, int n_rows) const {
+        Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> m(n_rows, dim);
+        for (int j = 0; j < n_rows; ++j) {
+          int b = rows[row_begin + j] / size, r = rows[row_begin + j] % size;
+          const float *s = signs.data() + static_cast<std::ptrdiff_t>(b) * size;
+          for (int i = 0; i < dim; ++i)
+            m(j, i) = __builtin_parity(r & i) ? -s[i] : s[i];
+        }
+        return m;
+      }
 
-    void count_elected(const Eigen::VectorXf &q, const Eigen::Map<Eigen::VectorXi> &exact, int votes_max,
-                       std::vector<Eigen::MatrixXd> &recalls, std::vector<Eigen::MatrixXd> &cs_sizes) const {
-      Eigen::VectorXf projected_query(n_pool);
-      if (density < 1)
-        projected_query.noalias() = sparse_random_matrix * q;
-      else
-        projected_query.noalias() = dense_random_matrix * q;
+      // first depth_new random vectors of each of the first n_trees trees of depth depth_old
+      Hadamard_Transform tree_rows(int n_trees, int depth_old, int depth_new) const {
+        std::vector<int> selected;
+        for (int n_tree = 0; n_tree < n_trees; ++n_tree)
+          for (int d = 0; d < depth_new; ++d)
+            selected.push_back(rows[n_tree * depth_old + d]);
+        return select(selected);
+      }
 
-      int depth_min = depth - recalls.size() + 1;
-      std::vector<std::vector<int>> start_indices(n_trees);
+      // transform consisting of the given rows (b * size + r) and of only the blocks they use
+      Hadamard_Transform select(const std::vector<int> &selected) const {
+        Hadamard_Transform h;
+        h.dim = dim;
+        h.size = size;
+        std::map<int,int> blocks;
+        for (int row : selected) {
+          int b = row / size;
+          if (!blocks.count(b)) {
+            int b_new = blocks.size();
+            blocks[b] = b_new;
+            h.signs.insert(h.signs.end(), signs.begin() + static_cast<std::ptrdiff_t>(b) * size,
+                           signs.begin() + static_cast<std::ptrdiff_t>(b + 1) * size);
+          }
+          h.rows.push_back(blocks[b] * size + row % size);
+        }
+        return h;
+      }
 
-      #pragma omp parallel for
-      for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
-        start_indices[n_tree] = std::vector<int>(depth - depth_min + 1);
-        int idx_tree = 0;
-        for (int d = 0; d < depth; ++d) {
-          const int j = n_tree * depth + d;
-          const int idx_left = 2 * idx_tree + 1;
-          const int idx_right = idx_left + 1;
-          const float split_point = split_points(idx_tree, n_tree);
-          if (projected_query(j) <= split_point) {
-            idx_tree = idx_left;
-          } else {
-            idx_tree = idx_right;
+      // in-place unnormalized fast Walsh-Hadamard transform of a vector of length n = 2^m
+      static void fwht(float *x, int n) {
+        for (int h = 1; h < n; h <<= 1) {
+          for (int i = 0; i < n; i += 2 * h) {
+            for (int j = i; j < i + h; ++j) {
+              float a = x[j], b = x[j + h];
+              x[j] = a + b;
+              x[j + h] = a - b;
+            }
           }
-          if (d >= depth_min - 1)
-            start_indices[n_tree][d - depth_min + 1] = idx_tree - (1 << (d + 1)) + 1;
         }
       }
 
-      const int *exact_begin = exact.data();
-      const int *exact_end = exact.data() + exact.size();
+      int n_blocks() const {
+        return size ? signs.size() / size : 0;
+      }
 
-      for (int depth_crnt = depth_min; depth_crnt <= depth; ++depth_crnt) {
-        Eigen::VectorXi votes = Eigen::VectorXi::Zero(n_samples);
-        const std::vector<int> &leaf_first_indices = leaf_first_indices_all[depth_crnt];
+      int dim = 0;
+      int size = 0; // dim rounded up to a power of two
+      std::vector<float> signs; // random signs of the blocks, n_blocks x size
+      std::vector<int> rows; // block and row of the transform for each random vector
+    };
 
-        Eigen::MatrixXd recall(votes_max, n_trees);
-        Eigen::MatrixXd candidate_set_size(votes_max, n_trees);
-        recall.col(0) = Eigen::VectorXd::Zero(votes_max);
-        candidate_set_size.col(0) = Eigen::VectorXd::Zero(votes_max);
+    /*
+    * Builds a structured random transform with n_row random vectors of
+    * dimension n_col. The random vectors of each block of the transform are
+    * distinct rows of the Hadamard matrix drawn by a random permutation, so
+    * that the random vectors of a tree are orthogonal if n_col is a power of
+    * two and the tree does not span two blocks. The signs and the permutation of block b are drawn from the
+    * Philox stream (seed, b); tree_depth and row_stride are used as in
+    * build_sparse_random_matrix(), only the blocks used by the selected rows
+    * are kept.
+    */
+    static void build_hadamard_transform(Hadamard_Transform &hadamard_transform, int n_row, int n_col,
+                                         int seed = 0, int tree_depth = 1, int row_stride = 1) {
+      Hadamard_Transform full;
+      full.dim = n_col;
+      full.size = 1;
+      while (full.size < n_col) full.size <<= 1;
+      const int size = full.size;
 
-        // count votes
-        for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
-          std::vector<int> &found_leaves = start_indices[n_tree];
+      std::random_device rd;
+      int s = seed ? seed : rd();
 
-          if (n_tree) {
-            recall.col(n_tree) = recall.col(n_tree - 1);
-            candidate_set_size.col(n_tree) = candidate_set_size.col(n_tree - 1);
-          }
+      std::vector<int> original_rows(n_row);
+      for (int j = 0; j < n_row; ++j)
+        original_rows[j] = (j / tree_depth) * row_stride + j % tree_depth;
+      int n_blocks = n_row ? original_rows.back() / size + 1 : 0;
 
-          int leaf_begin = leaf_first_indices[found_leaves[depth_crnt - depth_min]];
-          int leaf_end = leaf_first_indices[found_leaves[depth_crnt - depth_min] + 1];
+      full.signs.resize(static_cast<std::size_t>(n_blocks) * size);
+      std::vector<int> permutations(full.signs.size());
 
-          const std::vector<int> &indices = tree_leaves[n_tree];
-          for (int i = leaf_begin; i < leaf_end; ++i) {
-            int idx = indices[i];
-            int v = ++votes(idx);
-            if (v <= votes_max) {
-              candidate_set_size(v - 1, n_tree)++;
-              if (std::find(exact_begin, exact_end, idx) != exact_end)
-                recall(v - 1, n_tree)++;
-            }
-          }
-        }
+      #pragma omp parallel for
+      for (int b = 0; b < n_blocks; ++b) {
+        Philox gen(s, b);
+        float *signs = full.signs.data() + static_cast<std::ptrdiff_t>(b) * size;
+        int *permutation = permutations.data() + static_cast<std::ptrdiff_t>(b) * size;
+        for (int i = 0; i < size; ++i)
+          signs[i] = gen() & 0x80000000 ? -1 : 1;
+        std::iota(permutation, permutation + size, 0);
+        for (int i = size - 1; i > 0; --i)
+          std::swap(permutation[i], permutation[static_cast<int>(gen.uniform() * (i + 1))]);
+      }
 
-        recalls[depth_crnt - depth_min] = recall;
-        cs_sizes[depth_crnt - depth_min] = candidate_set_size;
+      std::vector<int> selected(n_row);
+      for (int j = 0; j < n_row; ++j) {
+        int b = original_rows[j] / size;
+        selected[j] = b * size + permutations[b * size + original_rows[j] % size];
       }
+
+      hadamard_transform = full.select(selected);
     }
 
-    /**
-    * Builds a random sparse matrix for use in random projection. The components of
-    * the matrix are drawn from the distribution
+    /*
+    * Builds a sparse (if density < 1) or dense Gaussian random matrix as in
+    * build_sparse_random_matrix() and build_dense_random_matrix() and
+    * quantizes it to 8-bit integers.
+    */
+    static void build_int8_random_matrix(Int8_Matrix &int8_random_matrix, int n_row, int n_col, float density,
+                                         int seed = 0, gtype generator = philox, int tree_depth = 1,
+                                         int row_stride = 1) {
+      Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> random_matrix;
+      if (density < 1) {
+        Eigen::SparseMatrix<float, Eigen::RowMajor> sparse_random_matrix;
+        build_sparse_random_matrix(sparse_random_matrix, n_row, n_col, density, seed, generator,
+                                   tree_depth, row_stride);
+        random_matrix = sparse_random_matrix;
+      } else {
+        build_dense_random_matrix(random_matrix, n_row, n_col, seed, generator, tree_depth, row_stride);
+      }
+
+      int8_random_matrix = Int8_Matrix(n_row, n_col);
+      for (int j = 0; j < n_row; ++j)
+        int8_random_matrix.set_row(j, random_matrix.data() + static_cast<std::ptrdiff_t>(j) * n_col);
+    }
+
+    /*
+    * Checks that all the components of the data are integers on [0, 255].
+    */
+    static bool is_uint8_valued(const Eigen::Map<const Data_Matrix> &X) {
+      const Scalar *x = X.data();
+      for (std::ptrdiff_t i = 0; i < X.size(); ++i)
+        if (!(x[i] >= 0 && x[i] <= 255 && x[i] == std::floor(x[i])))
+          return false;
+      return true;
+    }
+
+    /*
+    * Builds a random sign matrix for use in random projection. The components
+    * of the matrix are drawn from the distribution
     *
-    *       0 w.p. 1 - a
-    * N(0, 1) w.p. a
+    *  0 w.p. 1 - a
+    * -1 w.p. a / 2
+    * +1 w.p. a / 2
     *
-    * where a = density.
+    * where a = density. The usual scaling by 1 / sqrt(a) is left out, since
+    * it does not change the trees. The rows are generated as in
+    * build_sparse_random_matrix().
     */
-    static void build_sparse_random_matrix(Eigen::SparseMatrix<float, Eigen::RowMajor> &sparse_random_matrix,
-                                           int n_row, int n_col, float density, int seed = 0) {
-      sparse_random_matrix = Eigen::SparseMatrix<float, Eigen::RowMajor>(n_row, n_col);
+    static void build_sign_random_matrix(Sign_Matrix &sign_random_matrix, int n_row, int n_col,
+                                         float density, int seed = 0, int tree_depth = 1,
+                                         int row_stride = 1) {
+      sign_random_matrix = Sign_Matrix();
+      sign_random_matrix.rows = n_row;
+      sign_random_matrix.cols = n_col;
 
       std::random_device rd;
       int s = seed ? seed : rd();
-      std::mt19937 gen(s);
-      std::uniform_real_distribution<float> uni_dist(0, 1);
-      std::normal_distribution<float> norm_dist(0, 1);
 
-      std::vector<Eigen::Triplet<float>> triplets;
+      std::vector<std::vector<uint32_t>> rows(n_row);
+      const double log_q = std::log1p(-static_cast<double>(density));
+
+      #pragma omp parallel for
       for (int j = 0; j < n_row; ++j) {
-        for (int i = 0; i < n_col; ++i) {
-          if (uni_dist(gen) > density) continue;
-          triplets.push_back(Eigen::Triplet<float>(j, i, norm_dist(gen)));
+        Philox gen(s, (j / tree_depth) * row_stride + j % tree_depth);
+        std::vector<uint32_t> &row = rows[j];
+        row.reserve(density * n_col * 1.5 + 4);
+        for (int i = 0; ; ++i) {
+          i += static_cast<int>(std::min(std::floor(std::log(gen.uniform()) / log_q),
+                                         static_cast<double>(n_col)));
+          if (i >= n_col) break;
+          row.push_back(i | (gen() & 0x80000000));
         }
       }
 
-      sparse_random_matrix.setFromTriplets(triplets.begin(), triplets.end());
-      sparse_random_matrix.makeCompressed();
-    }
-
-    /*
-    * Builds a random dense matrix for use in random projection. The components of
-    * the matrix are drawn from the standard normal distribution.
-    */
-    static void build_dense_random_matrix(Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> &dense_random_matrix,
-                                          int n_row, int n_col, int seed = 0) {
-      dense_random_matrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>(n_row, n_col);
+      std::vector<int> &outer = sign_random_matrix.outer;
+      outer.resize(n_row + 1);
+      for (int j = 0; j < n_row; ++j)
+        outer[j + 1] = outer[j] + rows[j].size();
 
-      std::random_device rd;
-      int s = seed ? seed : rd();
-      std::mt19937 gen(s);
-      std::normal_distribution<float> normal_dist(0, 1);
+      std::vector<uint32_t> &inner = sign_random_matrix.inner;
+      inner.resize(outer[n_row]);
 
-      std::generate(dense_random_matrix.data(), dense_random_matrix.data() + n_row * n_col,
-                    [&normal_dist, &gen] { return normal_dist(gen); });
+      #pragma omp parallel for
+      for (int j = 0; j < n_row; ++j)
+        std::copy(rows[j].begin(), rows[j].end(), inner.begin() + outer[j]);
     }
 
+    /*
+    * Computes the k nearest neighbors of each test query among the data
+    * points, sorted by their indices (or by their distances if by_distance
+    * is set). The squared distances between a block
+    * of data points and a block of queries are computed by one matrix
+    * product as ||x||^2 - 2 x^T q (the norm of the query does not change
+    * the order of its neighbors), the blocks of data points are divided
+    * between the threads, and each thread keeps a heap of the k nearest
+    * neighbors of each query; the heaps of the threads are then merged.
+    * If indices_test is given, the data point indices_test[i] is excluded
+    * from the neighbors of the query i.
+    */
     void compute_exact(const Eigen::Map<const Eigen::MatrixXf> &Q, Eigen::MatrixXi &out_exact,
-                       const std::vector<int> &indices_test = {}) const {
-      int n_test = Q.cols();
-
-      Eigen::VectorXi idx(n_samples);
-      std::iota(idx.data(), idx.data() + n_samples, 0);
+                       const std::vector<int> &indices_test = {}, bool by_distance = false) const {
+      typedef std::pair<float, int> Neighbor;
+      const int n_test = Q.cols(), block_size = 1024, query_block_size = 256;
+      const int n_blocks = (n_samples + block_size - 1) / block_size, n_threads = omp_get_max_threads();
+      std::vector<std::vector<Neighbor>> heaps(static_cast<std::size_t>(n_threads) * n_test);
+
+      #pragma omp parallel
+      {
+        std::vector<Neighbor> *thread_heaps = heaps.data() + static_cast<std::size_t>(omp_get_thread_num()) * n_test;
+        Eigen::MatrixXf buffer, products;
+
+        #pragma omp for schedule(dynamic)
+        for (int block = 0; block < n_blocks; ++block) {
+          const int begin = block * block_size, n_cols = std::min(block_size, n_samples - begin);
+          const Eigen::Map<const Eigen::MatrixXf> points(float_data(begin, n_cols, buffer), dim, n_cols);
+          const Eigen::VectorXf norms = points.colwise().squaredNorm().transpose();
+
+          for (int q_begin = 0; q_begin < n_test; q_begin += query_block_size) {
+            const int n_queries = std::min(query_block_size, n_test - q_begin);
+            products.noalias() = points.transpose() * Q.middleCols(q_begin, n_queries);
+
+            for (int j = 0; j < n_queries; ++j) {
+              const int i = q_begin + j, excluded = indices_test.empty() ? -1 : indices_test[i];
+              std::vector<Neighbor> &heap = thread_heaps[i];
+              for (int l = 0; l < n_cols; ++l) {
+                Neighbor neighbor(norms(l) - 2 * products(l, j), begin + l);
+                if (neighbor.second == excluded)
+                  continue;
+                if (heap.size() < static_cast<std::size_t>(k)) {
+                  heap.push_back(neighbor);
+                  std::push_heap(heap.begin(), heap.end());
+                } else if (neighbor < heap.front()) {
+                  std::pop_heap(heap.begin(), heap.end());
+                  heap.back() = neighbor;
+                  std::push_heap(heap.begin(), heap.end());
+                }
+              }
+            }
+          }
+        }
+      }
 
+      #pragma omp parallel for
       for (int i = 0; i < n_test; ++i) {
-        if(!indices_test.empty()) {
-          std::remove(idx.data(), idx.data() + n_samples, indices_test[i]);
-        }
-        exact_knn(Eigen::Map<const Eigen::VectorXf>(Q.data() + i * dim, dim), k, idx,
-                  (indices_test.empty() ? n_samples : n_samples - 1), out_exact.data() + i * k);
-        std::sort(out_exact.data() + i * k, out_exact.data() + i * k + k);
-        if(!indices_test.empty()) {
-          idx[n_samples - 1] = indices_test[i];
+        std::vector<Neighbor> neighbors;
+        for (int thread = 0; thread < n_threads; ++thread) {
+          const std::vector<Neighbor> &heap = heaps[static_cast<std::size_t>(thread) * n_test + i];
+          neighbors.insert(neighbors.end(), heap.begin(), heap.end());
         }
+        const int n_found = std::min(k, static_cast<int>(neighbors.size()));
+        std::partial_sort(neighbors.begin(), neighbors.begin() + n_found, neighbors.end());
+
+        int *out = out_exact.data() + static_cast<std::ptrdiff_t>(i) * k;
+        for (int j = 0; j < k; ++j)
+          out[j] = j < n_found ? neighbors[j].second : -1;
+        if (!by_distance)
+          std::sort(out, out + k);
       }
     }
 
@@ -1357,10 +4644,13 @@ class Mrpt {
       return par1.estimated_qtime < par2.estimated_qtime;
     }
 
+    static bool is_faster_quantile(const Mrpt_Parameters &par1, const Mrpt_Parameters &par2) {
+      return par1.estimated_qtime_quantile < par2.estimated_qtime_quantile;
+    }
+
     void vote(const Eigen::VectorXf &projected_query, int vote_threshold, Eigen::VectorXi &elected,
-      int &n_elected, int n_trees, int depth_crnt) {
+      int &n_elected, int n_trees, int depth_crnt) const {
       std::vector<int> found_leaves(n_trees);
-      const std::vector<int> &leaf_first_indices = leaf_first_indices_all[depth_crnt];
 
       #pragma omp parallel for
       for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
@@ -1379,14 +4669,17 @@ class Mrpt {
         found_leaves[n_tree] = idx_tree - (1 << depth_crnt) + 1;
       }
 
-      int max_leaf_size = n_samples / (1 << depth_crnt) + 1;
-      elected = Eigen::VectorXi(n_trees * max_leaf_size);
+      int n_found = 0;
+      for (int n_tree = 0; n_tree < n_trees; ++n_tree)
+        n_found += leaf_first_index(n_tree, found_leaves[n_tree] + 1, depth_crnt) -
+                   leaf_first_index(n_tree, found_leaves[n_tree], depth_crnt);
+      elected = Eigen::VectorXi(n_found);
       Eigen::VectorXi votes = Eigen::VectorXi::Zero(n_samples);
 
       // count votes
       for (int n_tree = 0; n_tree < n_trees; ++n_tree) {
-        int leaf_begin = leaf_first_indices[found_leaves[n_tree]];
-        int leaf_end = leaf_first_indices[found_leaves[n_tree] + 1];
+        int leaf_begin = leaf_first_index(n_tree, found_leaves[n_tree], depth_crnt);
+        int leaf_end = leaf_first_index(n_tree, found_leaves[n_tree] + 1, depth_crnt);
         const std::vector<int> &indices = tree_leaves[n_tree];
         for (int i = leaf_begin; i < leaf_end; ++i) {
           int idx = indices[i];
@@ -1411,25 +4704,45 @@ class Mrpt {
           projection_x.push_back(n_random_vectors);
           Eigen::SparseMatrix<float, Eigen::RowMajor> sparse_mat;
           Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> dense_mat;
-
-          if (density < 1) {
+          Sign_Matrix sign_mat;
+          Hadamard_Transform hadamard;
+          Sell_Matrix sell_mat;
+          Int8_Matrix int8_mat;
+
+          if (projection == int8_projection) {
+            build_int8_random_matrix(int8_mat, n_random_vectors, dim, density);
+          } else if (projection == hadamard_projection) {
+            build_hadamard_transform(hadamard, n_random_vectors, dim);
+          } else if (projection == sign_projection) {
+            build_sign_random_matrix(sign_mat, n_random_vectors, dim, density);
+          } else if (density < 1) {
             build_sparse_random_matrix(sparse_mat, n_random_vectors, dim, density);
+            if (dim <= Sell_Matrix::max_cols) sell_mat = Sell_Matrix(sparse_mat);
           } else {
             build_dense_random_matrix(dense_mat, n_random_vectors, dim);
           }
 
-          double start_proj = omp_get_wtime();
-          Eigen::VectorXf projected_query(n_random_vectors);
-
-          if (density < 1) {
-            projected_query.noalias() = sparse_mat * Q.col(0);
-          } else {
-            projected_query.noalias() = dense_mat * Q.col(0);
-          }
-
-          double end_proj = omp_get_wtime();
-          projection_times.push_back(end_proj - start_proj);
-          idx_sum += projected_query.norm();
+          std::vector<Eigen::VectorXf> projected_queries(load_threads, Eigen::VectorXf(n_random_vectors));
+          projection_times.push_back(time_under_load([&](int thread) {
+            const float *q = Q.data() + static_cast<std::ptrdiff_t>(thread % Q.cols()) * dim;
+            Eigen::VectorXf &projected_query = projected_queries[thread];
+
+            if (projection == int8_projection) {
+              int8_mat.multiply(q, projected_query.data(), 0, n_random_vectors);
+            } else if (projection == hadamard_projection) {
+              hadamard.multiply(q, projected_query.data());
+            } else if (projection == sign_projection) {
+              sign_mat.multiply(q, projected_query.data(), 0, n_random_vectors);
+            } else if (!sell_mat.empty()) {
+              sell_mat.multiply(q, projected_query.data(), 0, n_random_vectors);
+            } else if (density < 1) {
+              projected_query.noalias() = sparse_mat * Eigen::Map<const Eigen::VectorXf>(q, dim);
+            } else {
+              projected_query.noalias() = dense_mat * Eigen::Map<const Eigen::VectorXf>(q, dim);
+            }
+          }));
+          for (const auto &projected_query : projected_queries)
+            idx_sum += projected_query.norm();
 
           int votes_index = votes_max < t ? votes_max : t;
           for (int v = 1; v <= votes_index; ++v) {
@@ -1466,25 +4779,21 @@ class Mrpt {
 
           for (int i = 0; i < (int) tested_trees.size(); ++i) {
             int t = tested_trees[i];
-            int n_el = 0;
-            Eigen::VectorXi elected;
             auto ri = uni(rng);
 
-            Eigen::VectorXf projected_query(n_trees * depth);
-            if (density < 1) {
-              projected_query.noalias() = sparse_random_matrix * Q.col(ri);
-            } else {
-              projected_query.noalias() = dense_random_matrix * Q.col(ri);
-            }
-
-            double start_voting = omp_get_wtime();
-            vote(projected_query, v, elected, n_el, t, d);
-            double end_voting = omp_get_wtime();
+            std::vector<Eigen::VectorXf> projected_queries(load_threads, Eigen::VectorXf(n_trees * depth));
+            for (int thread = 0; thread < load_threads; ++thread)
+              project(Q.data() + static_cast<std::ptrdiff_t>((ri + thread) % n_test) * dim, projected_queries[thread]);
 
-            voting_times.push_back(end_voting - start_voting);
+            std::vector<Eigen::VectorXi> elected(load_threads);
+            std::vector<int> n_el(load_threads);
+            voting_times.push_back(time_under_load([&](int thread) {
+              vote(projected_queries[thread], v, elected[thread], n_el[thread], t, d);
+            }));
             voting_x.push_back(t);
-            for (int i = 0; i < n_el; ++i)
-              idx_sum += elected(i);
+            for (int thread = 0; thread < load_threads; ++thread)
+              for (int i = 0; i < n_el[thread]; ++i)
+                idx_sum += elected[thread](i);
           }
           voting_x[0] += idx_sum > 1.0 ? 0.0 : 0.00001;
           beta[v] = fit_theil_sen(voting_x, voting_times);
@@ -1530,18 +4839,20 @@ class Mrpt {
 
         for (int m = 0; m < n_sim; ++m) {
           auto ri = uni(rng);
-          Eigen::VectorXi elected(s_size);
-          for (int j = 0; j < elected.size(); ++j)
-            elected(j) = uni2(rng);
-
-          double start_exact = omp_get_wtime();
-          std::vector<int> res(k);
-          exact_knn(Eigen::Map<const Eigen::VectorXf>(Q.data() + ri * dim, dim), k, elected, s_size, &res[0]);
-          double end_exact = omp_get_wtime();
-          mean_exact_time += (end_exact - start_exact);
+          std::vector<Eigen::VectorXi> elected(load_threads, Eigen::VectorXi(s_size));
+          for (auto &e : elected)
+            for (int j = 0; j < e.size(); ++j)
+              e(j) = uni2(rng);
+
+          std::vector<std::vector<int>> res(load_threads, std::vector<int>(k));
+          mean_exact_time += time_under_load([&](int thread) {
+            const float *q = Q.data() + static_cast<std::ptrdiff_t>((ri + thread) % n_test) * dim;
+            exact_knn(Eigen::Map<const Eigen::VectorXf>(q, dim), k, elected[thread], s_size, &res[thread][0]);
+          });
 
-          for (int l = 0; l < k; ++l)
-            idx_sum += res[l];
+          for (const auto &r : res)
+            for (int l = 0; l < k; ++l)
+              idx_sum += r[l];
         }
         mean_exact_time /= n_sim;
         exact_times.push_back(mean_exact_time);
@@ -1551,8 +4862,16 @@ class Mrpt {
       return fit_theil_sen(ex, exact_times);
     }
 
-    std::set<Mrpt_Parameters,decltype(is_faster)*> list_parameters(const std::vector<Eigen::MatrixXd> &recalls) {
-      std::set<Mrpt_Parameters,decltype(is_faster)*> pars(is_faster);
+    /*
+    * Lists the parameters of all the indices for the value k_ of k (0 for the
+    * largest value k); the recalls of the values of ks are in consecutive
+    * blocks of depths.
+    */
+    std::set<Mrpt_Parameters,decltype(is_faster)*> list_parameters(const std::vector<Eigen::MatrixXd> &recalls,
+                                                                   int k_ = 0) {
+      std::set<Mrpt_Parameters,decltype(is_faster)*> pars(latency_quantile < 0 ? is_faster : is_faster_quantile);
+      const int n_depths = depth - depth_min + 1;
+      const int offset = k_ ? (std::find(ks.begin(), ks.end(), k_) - ks.begin()) * n_depths : recalls.size() - n_depths;
       std::vector<Eigen::MatrixXd> query_times(depth - depth_min + 1);
       for (int d = depth_min; d <= depth; ++d) {
         Eigen::MatrixXd query_time = Eigen::MatrixXd::Zero(votes_max, n_trees);
@@ -1562,13 +4881,21 @@ class Mrpt {
           for (int v = 1; v <= votes_index; ++v) {
             double qt = get_query_time(t, d, v);
             query_time(v - 1, t - 1) = qt;
+            int64_t bytes = get_index_bytes(t, d);
+            if (memory_budget && bytes > memory_budget)
+              continue;
             Mrpt_Parameters p;
             p.n_trees = t;
             p.depth = d;
             p.votes = v;
-            p.k = k;
+            p.k = k_ ? k_ : k;
             p.estimated_qtime = qt;
-            p.estimated_recall = recalls[d - depth_min](v - 1, t - 1);
+            p.estimated_recall = recalls[offset + d - depth_min](v - 1, t - 1);
+            p.estimated_bytes = bytes;
+            if (latency_quantile > 0)
+              p.estimated_qtime_quantile = get_query_time_quantile(t, d, v);
+            p.n_threads = load_threads;
+            p.estimated_qps = load_threads / (latency_quantile > 0 ? p.estimated_qtime_quantile : qt);
             pars.insert(p);
           }
         }
@@ -1579,19 +4906,80 @@ class Mrpt {
       return pars;
     }
 
+    /*
+    * Computes the pareto frontier for the query times, the recalls and the
+    * memory of the indices: the parameters are visited from the fastest, and
+    * a parameter combination is kept unless a faster one already kept has as
+    * high a recall and takes at most as much memory.
+    */
     std::set<Mrpt_Parameters,decltype(is_faster)*> pareto_frontier(const std::set<Mrpt_Parameters,decltype(is_faster)*> &pars) {
-      opt_pars = std::set<Mrpt_Parameters,decltype(is_faster)*>(is_faster);
-      double best_recall = -1.0;
-      for (const auto &p : pars) { // compute pareto frontier for query times and recalls
-        if (p.estimated_recall > best_recall) {
+      opt_pars = std::set<Mrpt_Parameters,decltype(is_faster)*>(pars.key_comp());
+      for (const auto &p : pars) {
+        bool dominated = std::any_of(opt_pars.begin(), opt_pars.end(), [&p](const Mrpt_Parameters &q) {
+          return q.estimated_recall >= p.estimated_recall && q.estimated_bytes <= p.estimated_bytes;
+        });
+        if (!dominated)
           opt_pars.insert(p);
-          best_recall = p.estimated_recall;
-        }
       }
 
       return opt_pars;
     }
 
+    /*
+    * Derives the pareto frontier of each value of ks from the estimated
+    * recalls; the frontier of the largest value k is kept in opt_pars, and
+    * those of the others in k_opt_pars.
+    */
+    void update_frontiers() {
+      k_opt_pars.clear();
+      for (int k_ : ks)
+        if (k_ != k)
+          k_opt_pars.emplace(k_, pareto_frontier(list_parameters(recalls, k_)));
+      pareto_frontier(list_parameters(recalls));
+    }
+
+    /*
+    * Returns the pareto frontier of the value k_ of k (0 for the value the
+    * index is grown for).
+    */
+    const std::set<Mrpt_Parameters,decltype(is_faster)*> &frontier(int k_) const {
+      if (!k_ || k_ == k) {
+        return opt_pars;
+      }
+
+      auto it = k_opt_pars.find(k_);
+      if (it == k_opt_pars.end()) {
+        throw std::out_of_range("The index is not autotuned for k_.");
+      }
+      return it->second;
+    }
+
+    /*
+    * Runs f(thread) on load_threads threads started at the same time, and
+    * returns the mean of their running times; a single thread runs f on the
+    * calling thread. The nested parallel regions of f run serially.
+    */
+    template <typename F>
+    double time_under_load(F f) const {
+      if (load_threads == 1) {
+        double start = omp_get_wtime();
+        f(0);
+        return omp_get_wtime() - start;
+      }
+
+      double total = 0;
+      int n_started = 0;
+      #pragma omp parallel num_threads(load_threads) reduction(+:total,n_started)
+      {
+        #pragma omp barrier
+        double start = omp_get_wtime();
+        f(omp_get_thread_num());
+        total += omp_get_wtime() - start;
+        ++n_started;
+      }
+      return total / n_started;
+    }
+
     void fit_times(const Eigen::Map<const Eigen::MatrixXf> &Q) {
       double start = omp_get_wtime();
       std::vector<int> exact_x;
@@ -1646,15 +5034,47 @@ class Mrpt {
       fwrite(&p->k, sizeof(int), 1, fd);
       fwrite(&p->estimated_qtime, sizeof(double), 1, fd);
       fwrite(&p->estimated_recall, sizeof(double), 1, fd);
+      fwrite(&p->estimated_qtime_quantile, sizeof(double), 1, fd);
+      fwrite(&p->estimated_bytes, sizeof(int64_t), 1, fd);
+      fwrite(&p->n_threads, sizeof(int), 1, fd);
+      fwrite(&p->estimated_qps, sizeof(double), 1, fd);
+      fwrite(&p->measured_qtime, sizeof(double), 1, fd);
+      fwrite(&p->measured_recall, sizeof(double), 1, fd);
+    }
+
+    /*
+    * Reads parameters written by write_parameters() to an index file of the
+    * format version version; returns false if the file ends.
+    */
+    bool read_parameters(Mrpt_Parameters *p, FILE *fd, int version) {
+      *p = Mrpt_Parameters();
+      bool ok = fread(&p->n_trees, sizeof(int), 1, fd) == 1 && fread(&p->depth, sizeof(int), 1, fd) == 1 &&
+                fread(&p->votes, sizeof(int), 1, fd) == 1 && fread(&p->k, sizeof(int), 1, fd) == 1 &&
+                fread(&p->estimated_qtime, sizeof(double), 1, fd) == 1 &&
+                fread(&p->estimated_recall, sizeof(double), 1, fd) == 1;
+      if (version >= 1) {
+        ok = ok && fread(&p->estimated_qtime_quantile, sizeof(double), 1, fd) == 1 &&
+             fread(&p->estimated_bytes, sizeof(int64_t), 1, fd) == 1 &&
+             fread(&p->n_threads, sizeof(int), 1, fd) == 1 &&
+             fread(&p->estimated_qps, sizeof(double), 1, fd) == 1 &&
+             fread(&p->measured_qtime, sizeof(double), 1, fd) == 1 &&
+             fread(&p->measured_recall, sizeof(double), 1, fd) == 1;
+      }
+      return ok;
     }
 
-    void read_parameters(Mrpt_Parameters *p, FILE *fd) {
-      fread(&p->n_trees, sizeof(int), 1, fd);
-      fread(&p->depth, sizeof(int), 1, fd);
-      fread(&p->votes, sizeof(int), 1, fd);
-      fread(&p->k, sizeof(int), 1, fd);
-      fread(&p->estimated_qtime, sizeof(double), 1, fd);
-      fread(&p->estimated_recall, sizeof(double), 1, fd);
+    /*
+    * Closes the index file fd whose loading failed, and leaves the index
+    * empty and not autotuned; returns false.
+    */
+    bool load_failed(FILE *fd) {
+      fclose(fd);
+      n_trees = 0;
+      index_type = normal;
+      par = Mrpt_Parameters();
+      opt_pars.clear();
+      k_opt_pars.clear();
+      return false;
     }
 
     void write_parameter_list(const std::set<Mrpt_Parameters,decltype(is_faster)*> &pars, FILE *fd) const {
@@ -1663,41 +5083,54 @@ class Mrpt {
       }
 
       int par_sz = pars.size();
+      fwrite(&latency_quantile, sizeof(double), 1, fd);
       fwrite(&par_sz, sizeof(int), 1, fd);
 
       for (const auto p : pars)
         write_parameters(&p, fd);
     }
 
-    void read_parameter_list(FILE *fd) {
+    bool read_parameter_list(FILE *fd, int version) {
       if (!fd) {
-        return;
+        return false;
       }
 
-      opt_pars = std::set<Mrpt_Parameters,decltype(is_faster)*>(is_faster);
+      latency_quantile = -1.0;
+      bool ok = version < 1 || fread(&latency_quantile, sizeof(double), 1, fd) == 1;
+      opt_pars = std::set<Mrpt_Parameters,decltype(is_faster)*>(latency_quantile < 0 ? is_faster : is_faster_quantile);
       int par_sz = 0;
-      fread(&par_sz, sizeof(int), 1, fd);
+      ok = ok && fread(&par_sz, sizeof(int), 1, fd) == 1;
 
-      for (int i = 0; i < par_sz; ++i) {
+      for (int i = 0; ok && i < par_sz; ++i) {
         Mrpt_Parameters p;
-        read_parameters(&p, fd);
+        ok = read_parameters(&p, fd, version);
         opt_pars.insert(p);
       }
+      return ok;
     }
 
-    Mrpt_Parameters parameters(double target_recall) const {
+    /*
+    * Returns the fastest parameters on the frontier of k_ (see frontier())
+    * reaching the target recall among those fitting in memory_budget bytes
+    * (0 sets no limit), or the ones giving the highest recall if the target
+    * is not reached.
+    */
+    Mrpt_Parameters parameters(double target_recall, int64_t memory_budget = 0, int k_ = 0) const {
       double tr = target_recall - epsilon;
-      for (const auto &p : opt_pars) {
+      const Mrpt_Parameters *best = nullptr;
+      for (const auto &p : frontier(k_)) {
+        if (memory_budget && p.estimated_bytes > memory_budget) {
+          continue;
+        }
         if (p.estimated_recall > tr) {
           return p;
         }
+        if (!best || p.estimated_recall > best->estimated_recall) {
+          best = &p;
+        }
       }
 
-      if (!opt_pars.empty()) {
-        return *(opt_pars.rbegin());
-      }
-
-      return Mrpt_Parameters();
+      return best ? *best : Mrpt_Parameters();
     }
 
     /**
@@ -1748,7 +5181,7 @@ class Mrpt {
     }
 
     double get_projection_time(int n_trees, int depth, int v) const {
-      return predict_theil_sen(n_trees * depth, beta_projection);
+      return predict_theil_sen(pool_size ? pool_size : n_trees * depth, beta_projection);
     }
 
     double get_voting_time(int n_trees, int depth, int v) const {
@@ -1777,6 +5210,59 @@ class Mrpt {
            + get_exact_time(tree, depth, v);
     }
 
+    /**
+    * Estimates the latency_quantile quantile of the query times: the exact
+    * search time grows with the candidate set size, so it is the time of the
+    * quantile of the candidate set sizes of the test queries.
+    */
+    double get_query_time_quantile(int tree, int depth, int v) const {
+      return get_projection_time(tree, depth, v)
+           + get_voting_time(tree, depth, v)
+           + predict_theil_sen(cs_quantiles[depth - depth_min](v - 1, tree - 1), beta_exact);
+    }
+
+    int64_t get_index_bytes(int n_trees, int depth) const {
+      int64_t bytes = index_bytes(n_trees, depth, pool_size, projection, density, matrix_depth);
+      if (!leaf_offsets.empty())
+        bytes += static_cast<int64_t>(n_trees) * ((1 << depth) + 1) * sizeof(int);
+      return bytes;
+    }
+
+    /*
+    * Estimates the memory taken by an index of n_trees trees of depth depth
+    * pruned from trees of depth matrix_depth: the leaves, the split points
+    * and the random vectors, but not the data set. The number of non-zeros
+    * of a sparse matrix is estimated by its expected value.
+    */
+    int64_t index_bytes(int n_trees, int depth, int pool_size, ptype projection, float density,
+                        int matrix_depth) const {
+      const int64_t rows = pool_size ? pool_size : static_cast<int64_t>(n_trees) * depth;
+      int64_t bytes = static_cast<int64_t>(n_trees) * n_samples * sizeof(int)
+                    + (static_cast<int64_t>(n_trees) << (depth + 1)) * sizeof(float);
+      if (pool_size)
+        bytes += static_cast<int64_t>(n_trees) * depth * sizeof(int);
+
+      const double non_zeros = static_cast<double>(rows) * dim * density;
+      if (projection == int8_projection) {
+        const int stride = (dim + Int8_Matrix::width - 1) / Int8_Matrix::width * Int8_Matrix::width;
+        bytes += rows * (stride + sizeof(float));
+      } else if (projection == hadamard_projection) {
+        int size = 1;
+        while (size < dim) size <<= 1;
+        const int64_t last_row = pool_size ? pool_size : static_cast<int64_t>(n_trees - 1) * matrix_depth + depth;
+        bytes += (last_row + size - 1) / size * size * sizeof(float) + rows * sizeof(int);
+      } else if (projection == sign_projection) {
+        bytes += static_cast<int64_t>(non_zeros * sizeof(uint32_t)) + (rows + 1) * sizeof(int);
+      } else if (density < 1) {
+        // the compressed matrix and its copy packed for the vectorized products
+        const int packed = dim <= Sell_Matrix::max_cols ? sizeof(float) + sizeof(uint16_t) : 0;
+        bytes += static_cast<int64_t>(non_zeros * (sizeof(float) + sizeof(int) + packed)) + (rows + 1) * sizeof(int);
+      } else {
+        bytes += rows * dim * sizeof(float);
+      }
+      return bytes;
+    }
+
     std::vector<int> sample_indices(int n_test, int seed = 0) const {
       std::random_device rd;
       int s = seed ? seed : rd();
@@ -1788,23 +5274,45 @@ class Mrpt {
       return std::vector<int>(indices_data.begin(), indices_data.begin() + n_test);
     }
 
+    /**
+    * Draws a simple random sample of data point indices by selection sampling;
+    * the indices are returned in increasing order.
+    */
+    std::vector<int> sample_indices_sorted(int n_sample, unsigned seed) const {
+      std::mt19937 gen(seed);
+      std::uniform_real_distribution<double> uni_dist(0, 1);
+
+      std::vector<int> indices;
+      indices.reserve(n_sample);
+      for (int i = 0; i < n_samples && (int) indices.size() < n_sample; ++i) {
+        if (uni_dist(gen) * (n_samples - i) < n_sample - (int) indices.size())
+          indices.push_back(i);
+      }
+      return indices;
+    }
+
     Eigen::MatrixXf subset(const std::vector<int> &indices) const {
       int n_test = indices.size();
       Eigen::MatrixXf Q = Eigen::MatrixXf(dim, n_test);
       for(int i = 0; i < n_test; ++i)
-        Q.col(i) = X.col(indices[i]);
+        Q.col(i) = X.col(indices[i]).template cast<float>();
 
       return Q;
     }
 
 
-    const Eigen::Map<const Eigen::MatrixXf> X; // the data matrix
+    const Eigen::Map<const Data_Matrix> X; // the data matrix
     Eigen::MatrixXf split_points; // all split points in all trees
     std::vector<std::vector<int>> tree_leaves; // contains all leaves of all trees
     Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> dense_random_matrix; // random vectors needed for all the RP-trees
     Eigen::SparseMatrix<float, Eigen::RowMajor> sparse_random_matrix; // random vectors needed for all the RP-trees
+    Sign_Matrix sign_random_matrix; // random vectors needed for all the RP-trees if sign projections are used
+    Sell_Matrix sell_random_matrix; // sparse_random_matrix packed for the vectorized products
+    Int8_Matrix int8_random_matrix; // random vectors needed for all the RP-trees if quantized projections are used
+    Hadamard_Transform hadamard_transform; // random vectors needed for all the RP-trees if structured projections are used
     std::vector<std::vector<int>> leaf_first_indices_all; // first indices for each level
     std::vector<int> leaf_first_indices; // first indices of each leaf of tree in tree_leaves
+    std::vector<std::vector<int>> leaf_offsets; // per-tree first indices of leaves if split points are sampled
 
     const int n_samples; // sample size of data
     const int dim; // dimension of data
@@ -1813,20 +5321,43 @@ class Mrpt {
     int depth = 0; // depth of an RP-tree with median split
     float density = -1.0; // expected ratio of non-zero components in a projection matrix
     int n_pool = 0; // amount of random vectors needed for all the RP-trees
+    int pool_size = 0; // number of random vectors shared by the trees, or 0 if they are not shared
+    std::vector<int> pool_directions; // pool index of the random vector of each level of each tree
     int n_array = 0; // length of the one RP-tree as array
     int votes = 0; // optimal number of votes to use
     int k = 0;
+    std::vector<int> ks; // values of k autotuned for in ascending order; the largest one is k
     enum itype {normal, autotuned, autotuned_unpruned};
     itype index_type = normal;
+    gtype generator = philox; // generator of the random vectors
+    int random_seed = 0; // seed of the generator of the random vectors
+    int matrix_depth = 0; // depth of the trees when the random matrix was generated
+    enum mformat {full_format, seed_format}; // formats of the random matrix in an index file
+    static const int file_magic = 0x5450524d; // first bytes ("MRPT") of an index file with a format version
+    static const int file_version = 2; // format version of the index files written by save()
+    ptype projection = gaussian_projection; // distribution of the non-zero components of the random vectors
 
     // Member variables used in autotuning:
     int depth_min = 0;
     int votes_max = 0;
     const double epsilon = 0.0001; // error bound for comparisons of recall levels
+    const double pool_reference_recall = 0.9; // recall level for tuning the pool size, the threads and the test set size if no target is set
+    const int64_t quantile_bytes_max = int64_t(1) << 30; // maximum memory of the candidate set sizes kept for latency_quantile
+    double latency_quantile = -1.0; // quantile of the query times minimized, or -1 for the mean
+    int64_t memory_budget = 0; // maximum memory of the index in bytes, or 0 for no limit
+    int load_threads = 1; // number of threads querying concurrently when the query times are measured
+    std::vector<Eigen::MatrixXd> recalls; // estimated recalls of the indices of the unpruned trees
     std::vector<Eigen::MatrixXd> cs_sizes;
+    std::vector<Eigen::MatrixXd> cs_quantiles; // latency_quantile quantiles of the candidate set sizes
     std::pair<double,double> beta_projection, beta_exact;
     std::vector<std::map<int,std::pair<double,double>>> beta_voting;
     std::set<Mrpt_Parameters,decltype(is_faster)*> opt_pars;
+    std::map<int,std::set<Mrpt_Parameters,decltype(is_faster)*>> k_opt_pars; // frontiers of the smaller values of ks
 };
 
+/**
+* An MRPT index for a data set of floats.
+*/
+typedef Mrpt_Index<float> Mrpt;
+
 #endif // CPP_MRPT_H_
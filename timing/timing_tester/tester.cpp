@@ -121,6 +121,12 @@ int main(int argc, char **argv) {
 
     double build_time;
 
+    // one index is autotuned for all the values of k
+    double build_start = omp_get_wtime();
+    Mrpt mrpt(M);
+    mrpt.grow_autotune(ks, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, n_auto);
+    double build_end = omp_get_wtime();
+
     for (const auto &k : ks) {
       std::string votes_file(result_path + "votes_" + std::to_string(k));
       std::string top_votes_file(result_path + "top_votes_" + std::to_string(k));
@@ -148,18 +154,12 @@ int main(int argc, char **argv) {
       std::string result_file(result_path + "truth_" + std::to_string(k));
       std::vector<std::vector<int>> correct = read_results(result_file, k);
 
-      double build_start = omp_get_wtime();
-      Mrpt mrpt(M);
-      mrpt.grow_autotune(k, trees_max, depth_max, depth_min, votes_max, density, seed_mrpt, n_auto);
-
-      double build_end = omp_get_wtime();
-
       std::vector<std::vector<std::vector<int>>> vec_vote_counts;
       std::vector<std::vector<std::vector<int>>> vec_nn_found;
       std::vector<std::vector<std::vector<int>>> vec_top_votes;
 
       for(const auto &tr : target_recalls) {
-        Mrpt mrpt_new = mrpt.subset(tr);
+        Mrpt mrpt_new = mrpt.subset(tr, 0, k);
         Mrpt_Parameters par(mrpt_new.parameters());
 
         if(mrpt_new.empty()) {
@@ -269,7 +269,7 @@ int main(int argc, char **argv) {
         for(int j = 0; j < target_recalls.size(); ++j) {
           double tr = target_recalls[j];
 
-          Mrpt mrpt_new = mrpt.subset(tr);
+          Mrpt mrpt_new = mrpt.subset(tr, 0, k);
           Mrpt_Parameters par(mrpt_new.parameters());
 
           if(mrpt_new.empty()) {
@@ -50,7 +50,7 @@ def rdata_to_binary(fname, out, matrix, n=-1):
             _write_floats(row.astype(np.float32), outfile)
 
 
-def fvecs_to_binary(fname, out, n=-1):
+def fvecs_to_binary(fname, out, n=-1, half=None):
     sz = os.path.getsize(fname)
 
     with open(fname, 'rb') as inp:
@@ -64,10 +64,13 @@ def fvecs_to_binary(fname, out, n=-1):
                 tmp = struct.unpack('<i', inp.read(4))[0]
                 vec = array.array('f')
                 vec.read(inp, dim)
-                _write_floats(vec, outfile)
+                if half:
+                    _write_halves(vec, outfile, half)
+                else:
+                    _write_floats(vec, outfile)
 
 
-def bvecs_to_binary(fname, out, n=-1):
+def bvecs_to_binary(fname, out, n=-1, uint8=False):
     sz = os.path.getsize(fname)
 
     with open(fname, 'rb') as inp:
@@ -78,10 +81,13 @@ def bvecs_to_binary(fname, out, n=-1):
         with open(out, 'wb') as outfile:
             for i in xrange(rows):
                 if i == n: break
-                tmp = struct.unpack('<B', inp.read(1))[0]
+                tmp = inp.read(4)
                 vec = array.array('B')
                 vec.read(inp, dim)
-                _write_floats([float(x) for x in vec], outfile)
+                if uint8:
+                    vec.tofile(outfile)
+                else:
+                    _write_floats([float(x) for x in vec], outfile)
 
 
 def stdin_to_binary(out, delimiter=',', n=-1):
@@ -102,15 +108,17 @@ def stl_to_binary(fname, out, n=-1):
             _write_floats(row[:96 * 96].astype(np.float32), outfile)
 
 
-def mnist_to_binary(fname, out, n=-1):
+def mnist_to_binary(fname, out, n=-1, uint8=False):
     import struct
 
     with open(fname, 'rb') as train_image:
         _, _, img_row, img_col = struct.unpack('>IIII', train_image.read(16))
         images = np.fromfile(train_image, dtype=np.uint8).reshape(60000, img_row * img_col)
-        data = images.astype(np.float32)
 
-    ndarray_to_binary(data, out, n)
+    if uint8:
+        images[:n if n >= 0 else None].tofile(out)
+    else:
+        ndarray_to_binary(images.astype(np.float32), out, n)
 
 
 def trevi_to_binary(fname, out):
@@ -157,6 +165,17 @@ def _write_floats(floats, outfile):
     outfile.write(s)
 
 
+def _write_halves(floats, outfile, half):
+    x = np.asarray(floats, dtype=np.float32)
+    if half == 'float16':
+        x.astype(np.float16).tofile(outfile)
+    else:
+        # round the floats to the nearest bfloat16 and keep their upper halves
+        bits = x.view(np.uint32).astype(np.uint64)
+        bits = (bits + 0x7fff + ((bits >> 16) & 1)) >> 16
+        bits.astype(np.uint16).tofile(outfile)
+
+
 if __name__ == '__main__':
     import sys
 
@@ -164,12 +183,23 @@ if __name__ == '__main__':
         sample_test_set(sys.argv[2], sys.argv[3], sys.argv[4], int(sys.argv[5]), int(sys.argv[6]))
         sys.exit(0)
 
+    # write 8-bit data sets (bvecs, MNIST) as bytes for the indices of uint8 data
+    uint8 = sys.argv[1] == '--uint8'
+    if uint8:
+        del sys.argv[1]
+
+    # write fvecs data sets (embeddings) as 16-bit floats for the indices of Mrpt_Float16 or Mrpt_BFloat16 data
+    half = None
+    if sys.argv[1] in ('--float16', '--bfloat16'):
+        half = sys.argv[1][2:]
+        del sys.argv[1]
+
     inf, outf = sys.argv[1], sys.argv[2]
 
     if inf.endswith('.fvecs'):
-        fvecs_to_binary(inf, outf, -1 if len(sys.argv) == 3 else int(sys.argv[3]))
+        fvecs_to_binary(inf, outf, -1 if len(sys.argv) == 3 else int(sys.argv[3]), half)
     elif inf.endswith('.bvecs'):
-        bvecs_to_binary(inf, outf, -1 if len(sys.argv) == 3 else int(sys.argv[3]))
+        bvecs_to_binary(inf, outf, -1 if len(sys.argv) == 3 else int(sys.argv[3]), uint8)
     elif inf.endswith('.csv'):
         csv_to_binary(inf, outf)
     elif inf.endswith('.txt'):
@@ -181,7 +211,7 @@ if __name__ == '__main__':
     elif inf.endswith('.RData'):
         rdata_to_binary(inf, outf, sys.argv[3])
     elif inf.endswith('idx3-ubyte'):
-        mnist_to_binary(inf, outf)
+        mnist_to_binary(inf, outf, uint8=uint8)
     elif inf.endswith('/'):
         trevi_to_binary(inf, outf)
     else: